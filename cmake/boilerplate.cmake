@@ -57,6 +57,8 @@ if (GS_ENABLE_SANITIZERS)
     endif()
 endif()
 
+option(GS_ENABLE_BENCHMARKS "Build the micro-benchmarks (tests/benchmarks)" OFF)
+
 option(GS_ENABLE_TSAN "Enable Thread Sanitizer" OFF)
 if (GS_ENABLE_TSAN)
     message(STATUS "TSan enabled")
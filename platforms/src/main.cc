@@ -9,13 +9,21 @@
 #include <systemc>
 
 #include <chrono>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <cci_configuration>
 
 #include <cciutils.h>
 #include <argparser.h>
 #include <module_factory_container.h>
+#include <qk_controller.h>
+#include <host_affinity.h>
+#ifndef WIN32
+#include <io_reactor.h>
+#endif
 
 #if SC_VERSION_MAJOR < 3
 #warning PLEASE UPDATE TO SYSTEMC 3.0, OLDER VERSIONS ARE DEPRECATED AND MAY NOT WORK
@@ -26,18 +34,109 @@ class GreenSocsPlatform : public gs::ModuleFactory::Container
 protected:
     cci::cci_param<int> m_quantum_ns;
     cci::cci_param<int> m_gdb_port;
+    cci::cci_param<bool> m_adaptive_quantum;
+    std::unique_ptr<gs::QuantumController> m_quantum_controller;
+    cci::cci_param<std::string> m_systemc_host_cpus;
+    cci::cci_param<std::string> m_io_host_cpus;
+    cci::cci_param<std::string> m_reserved_host_cpus;
+
+    std::vector<int> host_cpus(cci::cci_param<std::string>& p)
+    {
+        std::vector<int> cpus;
+        if (!gs::parse_host_cpus(p, cpus)) {
+            SCP_FATAL(()) << "Invalid list of host cores for " << p.name() << ": " << p.get_value();
+        }
+        return cpus;
+    }
+
+    void place(const std::string& thread, const std::vector<int>& cpus)
+    {
+        int err = gs::HostPlacement::get().place(thread, cpus);
+        if (err) {
+            SCP_WARN(()) << "Could not place the " << thread << " thread on host cores "
+                         << gs::format_host_cpus(cpus) << ": " << strerror(err);
+        }
+    }
+
+    /*
+     * Threads QEMU starts from a placed thread (e.g. its worker threads, started on demand from the
+     * SystemC thread) inherit its cores. They are moved back off the reserved cores periodically.
+     */
+    void place_systemc_thread() { place("SystemC", host_cpus(m_systemc_host_cpus)); }
+
+#ifndef WIN32
+    static std::chrono::seconds unplaced_threads_period() { return std::chrono::seconds(1); }
+
+    /* Runs on the reactor thread, which may outlive the platform */
+    static void place_unplaced_threads()
+    {
+        int moved = gs::HostPlacement::get().place_unplaced("unplaced");
+        if (moved) {
+            SCP_INFO("HostPlacement") << "Moved " << moved << " threads back off the reserved host cores";
+        }
+        gs::IoReactor::get().call_after(unplaced_threads_period(), place_unplaced_threads);
+    }
+#endif
 
 public:
     GreenSocsPlatform(const sc_core::sc_module_name& n)
         : gs::ModuleFactory::Container(n)
         , m_quantum_ns("quantum_ns", 1000000, "TLM-2.0 global quantum in ns")
         , m_gdb_port("gdb_port", 0, "GDB port")
+        , m_adaptive_quantum("adaptive_quantum", false,
+                             "Adjust the global quantum at runtime, within the bounds of the quantum_controller")
+        , m_systemc_host_cpus("systemc_host_cpus", "", "Host cores to pin the SystemC thread to (e.g. \"0\")")
+        , m_io_host_cpus("io_host_cpus", "", "Host cores to pin the I/O backends thread to")
+        , m_reserved_host_cpus("reserved_host_cpus", "",
+                               "Host cores reserved for the threads explicitly pinned to them (e.g. vCPU threads)")
     {
         using tlm_utils::tlm_quantumkeeper;
 
         sc_core::sc_time global_quantum(m_quantum_ns, sc_core::SC_NS);
         tlm_quantumkeeper::set_global_quantum(global_quantum);
+
+        if (m_adaptive_quantum) {
+            m_quantum_controller = std::make_unique<gs::QuantumController>("quantum_controller");
+        }
+
+        /* Threads started from now on inherit this, until they are placed */
+        std::vector<int> reserved = host_cpus(m_reserved_host_cpus);
+        if (!reserved.empty()) {
+            gs::HostPlacement::get().reserve(reserved);
+            place("main", {});
+        }
     };
+
+    void start_of_simulation() override
+    {
+#ifndef WIN32
+        std::vector<int> io_cpus = host_cpus(m_io_host_cpus);
+        if (!io_cpus.empty()) {
+            gs::IoReactor::get().call_after(std::chrono::microseconds(0),
+                                            [this, io_cpus]() { place("I/O", io_cpus); });
+        }
+        if (!m_reserved_host_cpus.get_value().empty()) {
+            gs::IoReactor::get().call_after(unplaced_threads_period(), place_unplaced_threads);
+        }
+#endif
+        if (!m_systemc_host_cpus.get_value().empty()) {
+            sc_core::sc_spawn(std::bind(&GreenSocsPlatform::place_systemc_thread, this), "place_systemc_thread");
+        }
+    }
+
+    /* Only when threads were placed */
+    bool placement_configured()
+    {
+        return !m_systemc_host_cpus.get_value().empty() || !m_io_host_cpus.get_value().empty() ||
+               !m_reserved_host_cpus.get_value().empty();
+    }
+
+    void end_of_simulation() override
+    {
+        if (placement_configured()) {
+            SCP_INFO(()) << gs::HostPlacement::get().report();
+        }
+    }
 };
 
 int sc_main(int argc, char* argv[])
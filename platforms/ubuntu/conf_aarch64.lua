@@ -63,6 +63,7 @@ platform = {
         moduletype="gs_memory";
         target_socket = {address = INITIAL_DDR_SPACE; size = 0x100000000, bind= "&router.initiator_socket"},
         log_level=0,
+        sparse=true,
         shared_memory=IS_SHARED_MEM};
 
     qemu_inst_mgr = {
@@ -139,6 +140,7 @@ platform = {
         target_socket = {address = 0x0; size = 0x800000000, bind= "&router.initiator_socket", priority=1},
         dmi_allow=false,
         log_level=0,
+        sparse=true,
         shared_memory=IS_SHARED_MEM};
 
     load={
@@ -13,6 +13,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <cstring>
 
 #include <tlm>
 #include <tlm_utils/simple_initiator_socket.h>
@@ -20,6 +21,7 @@
 #include <cci_configuration>
 
 #include <libgssync.h>
+#include <host_affinity.h>
 
 #include "device.h"
 #include "ports/initiator.h"
@@ -62,6 +64,12 @@ protected:
     QemuCpuHintTlmExtension m_cpu_hint_ext;
 
     uint64_t m_quantum_ns; // For convenience
+    /* The CPU is waiting for work */
+    std::atomic<bool> m_halted{ false };
+    /* The deadline timer was not rearmed because all the CPUs were halted */
+    std::atomic<bool> m_deadline_dropped{ false };
+    /* The vCPU thread was placed on its host cores (vCPU thread only) */
+    bool m_placed = false;
 
     /*
      * Request quantum keeper from instance
@@ -142,6 +150,8 @@ protected:
     void kick_cb()
     {
         SCP_TRACE(())("QEMU deadline KICK callback");
+        // An interrupt, or anything else that may give the CPU work to do
+        set_halted(false);
         if (m_coroutines) {
             if (!m_finished) m_qemu_kick_ev.async_notify();
         } else {
@@ -158,8 +168,21 @@ protected:
     void deadline_timer_cb()
     {
         SCP_TRACE(())("QEMU deadline timer callback");
-        // All syncing will be done in end_of_loop_cb
-        m_cpu.kick();
+        bool idle = is_idle();
+        if (idle && !m_finished && m_inst.all_cpus_halted()) {
+            // Nothing runs: let the virtual clock jump to the next timer instead of ticking every
+            // quantum. set_halted rearms the timer once the CPU has work again. Check again after
+            // dropping the timer, in case the CPU woke up meanwhile.
+            m_deadline_dropped = true;
+            if (m_inst.all_cpus_halted() || !m_deadline_dropped.exchange(false)) {
+                return;
+            }
+        }
+        // All syncing will be done in end_of_loop_cb. A halted CPU has no loop to leave, it is woken
+        // up by interrupts.
+        if (!idle) {
+            m_cpu.kick();
+        }
         // Rearm timer for next time ....
         if (!m_finished) {
             rearm_deadline_timer();
@@ -173,6 +196,27 @@ protected:
         }
     }
 
+    /*
+     * Keep the instance count of halted CPUs, used to skip idle time. A CPU
+     * leaving the halted state restarts its deadline timer if it was dropped.
+     */
+    void set_halted(bool halted)
+    {
+        if (m_halted.exchange(halted) == halted) return;
+        m_inst.cpu_halted(halted);
+        if (!halted && m_deadline_dropped.exchange(false)) {
+            rearm_deadline_timer();
+        }
+    }
+
+    /* Halted, and only to be woken up by interrupts */
+    bool is_idle()
+    {
+        if (!m_inst.idle_skip()) return false;
+        if (m_inst.get_tcg_mode() == QemuInstance::TCG_SINGLE) return m_inst.all_cpus_halted();
+        return m_halted;
+    }
+
     /*
      * The CPU does not have work anymore. Pause the CPU thread until we have
      * some work to do.
@@ -188,6 +232,7 @@ protected:
         m_qk->stop();
         if (m_finished) return;
 
+        set_halted(true);
         if (m_coroutines) {
             m_on_sysc.run_on_sysc([this]() { wait(m_external_ev); });
         } else {
@@ -201,6 +246,7 @@ protected:
                 m_inst.g_signaled = false;
             }
         }
+        set_halted(false);
         if (m_finished) return;
         SCP_TRACE(())("Have work, running CPU");
         m_qk->start();
@@ -213,6 +259,11 @@ protected:
     {
         // This is a simple "every quantum" tick. Whether the QK makes use of it or not
         // is down to the sync policy
+        uint64_t quantum_ns = gs::SyncStats::get().quantum_ns.load(std::memory_order_relaxed);
+        if (quantum_ns) {
+            // The quantum controller adjusted the global quantum
+            m_quantum_ns = quantum_ns;
+        }
         m_deadline_timer->mod(m_inst.get().get_virtual_clock() + m_quantum_ns);
     }
 
@@ -239,6 +290,7 @@ protected:
                     // In the case of accelerators, allow them to handle signals etc.
                     SCP_TRACE(())("Stopping QK");
                     m_qk->stop();              // Stop the QK, it will be enabled when we next see work to do.
+                    set_halted(true);          // Until QEMU kicks the CPU, or it exits its loop
                     break;
                 }
                 wait_for_work();
@@ -248,6 +300,10 @@ protected:
         if (m_started) {
             m_cpu.set_soft_stopped(false);
         }
+        /* In SINGLE mode, the CPU may not be the one that waited for work */
+        if (m_deadline_dropped.exchange(false)) {
+            rearm_deadline_timer();
+        }
         /*
          * The QEMU CPU loop expect us to enter it with the iothread mutex locked.
          * It is then unlocked when we come back from the CPU loop, in
@@ -283,6 +339,7 @@ protected:
         int64_t now = m_inst.get().get_virtual_clock();
 
         m_cpu.set_soft_stopped(true);
+        set_halted(false);
 
         m_inst.get().unlock_iothread();
         if (!m_coroutines) {
@@ -296,6 +353,29 @@ protected:
         m_qk->sync();
     }
 
+    /*
+     * Pin the vCPU thread to its host cores, from the vCPU thread, the first
+     * time it exits its loop. Only MULTI mode gives each CPU its own thread.
+     */
+    void place_vcpu_thread()
+    {
+        m_placed = true;
+        if (m_inst.get_tcg_mode() != QemuInstance::TCG_MULTI) return;
+
+        std::vector<int> cpus;
+        if (!gs::parse_host_cpus(p_host_cpus, cpus)) {
+            SCP_FATAL(()) << "Invalid host_cpus: " << p_host_cpus.get_value();
+        }
+        if (cpus.empty()) {
+            cpus = m_inst.vcpu_host_cpus(m_cpu.get_index());
+        }
+        int err = gs::HostPlacement::get().place(name(), cpus);
+        if (err) {
+            SCP_WARN(()) << "Could not pin the vCPU thread to host cores " << gs::format_host_cpus(cpus) << ": "
+                         << strerror(err);
+        }
+    }
+
     /*
      * Callback called when the CPU exits its execution loop. In coroutine
      * mode, we yield here to come back to run_cpu_loop(). In TCG thread mode,
@@ -309,6 +389,7 @@ protected:
             m_inst.get().coroutine_yield();
         } else {
             std::lock_guard<std::mutex> lock(m_can_delete);
+            if (!m_placed) place_vcpu_thread();
             sync_with_kernel();
             prepare_run_cpu();
         }
@@ -330,6 +411,7 @@ protected:
 
 public:
     cci::cci_param<unsigned int> p_gdb_port;
+    cci::cci_param<std::string> p_host_cpus;
 
     /* The default memory socket. Mapped to the default CPU address space in QEMU */
     QemuInitiatorSocket<> socket;
@@ -345,6 +427,9 @@ public:
         , m_qemu_kick_ev(false)
         , m_signaled(false)
         , p_gdb_port("gdb_port", 0, "Wait for gdb connection on TCP port <gdb_port>")
+        , p_host_cpus("host_cpus", "",
+                      "Host cores the vCPU thread may run on in MULTI mode (e.g. \"2-3\"), "
+                      "overrides the instance vcpu_host_cpus")
         , socket("mem", *this, inst)
     {
         using namespace std::placeholders;
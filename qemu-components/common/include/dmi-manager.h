@@ -9,11 +9,13 @@
 #ifndef LIBQBOX_DMI_MANAGER_H_
 #define LIBQBOX_DMI_MANAGER_H_
 
+#include <functional>
 #include <map>
 #include <mutex>
 #include <limits>
 #include <cassert>
 #include <memory>
+#include <vector>
 
 #include <tlm>
 
@@ -142,6 +144,8 @@ public:
         uint64_t m_start;
         uint64_t m_end;
         unsigned char* m_ptr;
+        int m_fd = -1;
+        tlm::tlm_dmi::dmi_access_e m_access = tlm::tlm_dmi::DMI_ACCESS_NONE;
 
         QemuContainer m_container;
         qemu::MemoryRegion m_alias;
@@ -156,10 +160,12 @@ public:
         /* Construct an invalid alias */
         DmiRegionAlias() {}
 
-        DmiRegionAlias(qemu::MemoryRegion& root, const tlm::tlm_dmi& info, qemu::LibQemu& inst)
+        DmiRegionAlias(qemu::MemoryRegion& root, const tlm::tlm_dmi& info, qemu::LibQemu& inst, int fd = -1)
             : m_start(info.get_start_address())
             , m_end(info.get_end_address())
             , m_ptr(info.get_dmi_ptr())
+            , m_fd(fd)
+            , m_access(info.get_granted_access())
             , m_container(inst.object_new_unparented<QemuContainer>())
             , m_alias(inst.object_new_unparented<qemu::MemoryRegion>())
         {
@@ -185,6 +191,12 @@ public:
 
         unsigned char* get_dmi_ptr() const { return m_ptr; }
 
+        /* Shared memory fd backing the aliased region, -1 for private memory */
+        int get_fd() const { return m_fd; }
+
+        /* Access granted by the target the aliased region comes from */
+        tlm::tlm_dmi::dmi_access_e get_granted_access() const { return m_access; }
+
         /**
          * @brief Mark the alias as mapped onto QEMU root MR
          *
@@ -223,6 +235,23 @@ protected:
      */
     DmiRegionMap m_regions;
 
+public:
+    using InvalidateFn = std::function<void(uint64_t start, uint64_t end)>;
+
+private:
+    /*
+     * Aliases currently mapped, per root memory region they are mapped on (start -> alias), and the
+     * target sockets exposing these roots to SystemC, to be told when an alias goes away. The
+     * aliases are owned by the initiators mapping them.
+     */
+    struct InstalledAliases {
+        std::map<uint64_t, std::weak_ptr<DmiRegionAlias>> aliases;
+        std::map<int, InvalidateFn> watchers;
+    };
+    std::mutex m_installed_mutex;
+    std::map<const QemuObject*, InstalledAliases> m_installed;
+    int m_next_watcher = 0;
+
 public:
     /**
      * @brief This regions are added as subregions of the manager root memory
@@ -284,7 +313,137 @@ public:
     DmiRegionAlias::Ptr get_new_region_alias(const tlm::tlm_dmi& info, int fd = -1)
     {
         get_region(info, fd);
-        return std::make_shared<DmiRegionAlias>(m_root, info, m_inst);
+        return std::make_shared<DmiRegionAlias>(m_root, info, m_inst, fd);
+    }
+
+    /**
+     * @brief Record that alias has been mapped on root
+     */
+    void alias_installed(const qemu::MemoryRegion& root, DmiRegionAlias::Ptr alias)
+    {
+        std::lock_guard<std::mutex> lock(m_installed_mutex);
+        m_installed[root.get_qemu_obj()].aliases[alias->get_start()] = alias;
+    }
+
+    /**
+     * @brief Record that alias has been unmapped from root, the watchers of root are told to drop
+     * any direct access they gave to it.
+     */
+    void alias_removed(const qemu::MemoryRegion& root, const DmiRegionAlias::Ptr alias)
+    {
+        std::vector<InvalidateFn> watchers;
+        {
+            std::lock_guard<std::mutex> lock(m_installed_mutex);
+            auto it = m_installed.find(root.get_qemu_obj());
+            if (it == m_installed.end()) {
+                return;
+            }
+            auto a = it->second.aliases.find(alias->get_start());
+            if (a == it->second.aliases.end() || a->second.lock() != alias) {
+                return;
+            }
+            it->second.aliases.erase(a);
+            for (auto& w : it->second.watchers) {
+                watchers.push_back(w.second);
+            }
+        }
+        for (auto& fn : watchers) {
+            fn(alias->get_start(), alias->get_end());
+        }
+    }
+
+    /**
+     * @brief Record that the aliases mapped on root overlapping [start, end] are about to be unmapped,
+     * e.g. because the target they come from invalidated them. They are no longer given out, and the
+     * watchers of root are told to drop any direct access they gave to them.
+     */
+    void range_invalidated(const qemu::MemoryRegion& root, uint64_t start, uint64_t end)
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        std::vector<InvalidateFn> watchers;
+        {
+            std::lock_guard<std::mutex> lock(m_installed_mutex);
+            auto it = m_installed.find(root.get_qemu_obj());
+            if (it == m_installed.end()) {
+                return;
+            }
+            auto& aliases = it->second.aliases;
+            auto a = aliases.upper_bound(start);
+            if (a != aliases.begin()) {
+                a--;
+            }
+            while (a != aliases.end() && a->first <= end) {
+                DmiRegionAlias::Ptr alias = a->second.lock();
+                if (alias && alias->get_end() >= start) {
+                    ranges.emplace_back(alias->get_start(), alias->get_end());
+                    a = aliases.erase(a);
+                } else {
+                    a++;
+                }
+            }
+            if (ranges.empty()) {
+                return;
+            }
+            for (auto& w : it->second.watchers) {
+                watchers.push_back(w.second);
+            }
+        }
+        for (auto& fn : watchers) {
+            for (auto& r : ranges) {
+                fn(r.first, r.second);
+            }
+        }
+    }
+
+    /**
+     * @brief Fill dmi with the alias mapped on root at addr, if any
+     */
+    bool find_installed_alias(const qemu::MemoryRegion& root, uint64_t addr, tlm::tlm_dmi& dmi)
+    {
+        std::lock_guard<std::mutex> lock(m_installed_mutex);
+        auto it = m_installed.find(root.get_qemu_obj());
+        if (it == m_installed.end()) {
+            return false;
+        }
+        auto& aliases = it->second.aliases;
+        auto a = aliases.upper_bound(addr);
+        if (a == aliases.begin()) {
+            return false;
+        }
+        a--;
+        DmiRegionAlias::Ptr alias = a->second.lock();
+        if (!alias || addr > alias->get_end()) {
+            return false;
+        }
+
+        dmi.set_start_address(alias->get_start());
+        dmi.set_end_address(alias->get_end());
+        dmi.set_dmi_ptr(alias->get_dmi_ptr());
+        dmi.set_granted_access(alias->get_granted_access());
+        dmi.set_read_latency(sc_core::SC_ZERO_TIME);
+        dmi.set_write_latency(sc_core::SC_ZERO_TIME);
+        return true;
+    }
+
+    /**
+     * @brief Call fn with the range of each alias unmapped from root from now on. fn is called from
+     * the thread unmapping the alias, which may be a vCPU thread.
+     * @return an id to pass to remove_watcher()
+     */
+    int add_watcher(const qemu::MemoryRegion& root, InvalidateFn fn)
+    {
+        std::lock_guard<std::mutex> lock(m_installed_mutex);
+        int id = m_next_watcher++;
+        m_installed[root.get_qemu_obj()].watchers[id] = fn;
+        return id;
+    }
+
+    void remove_watcher(int id)
+    {
+        std::lock_guard<std::mutex> lock(m_installed_mutex);
+        for (auto& i : m_installed) {
+            i.second.watchers.erase(id);
+        }
     }
 };
 #endif
@@ -9,7 +9,11 @@
 #ifndef _LIBQEMU_CXX_INTERNALS_
 #define _LIBQEMU_CXX_INTERNALS_
 
-#include <map>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include <libqemu/libqemu.h>
 #include <libqemu-cxx/libqemu-cxx.h>
@@ -23,25 +27,124 @@ public:
     virtual void clear(Object obj) = 0;
 };
 
+/*
+ * Callbacks attached to QEMU objects. They are dispatched for every vCPU kick and end of loop, and
+ * for every IOMMU translation: the dispatch is a lookup in an open addressing hash table, without
+ * any lock. Registrations are rare and serialised by a lock. Tables and callbacks are only released
+ * with this object, so that a concurrent dispatch never sees them go away: every register_cb() keeps
+ * a new copy of its callback, and registering an object again or clearing it does not release the
+ * previous one. Memory use grows with the number of registrations, not of objects.
+ */
 template <typename T>
 class LibQemuObjectCallback : public LibQemuObjectCallbackBase
 {
 private:
-    std::map<QemuObject*, T> m_cbs;
+    struct slot {
+        std::atomic<QemuObject*> obj{ nullptr };
+        std::atomic<const T*> cb{ nullptr };
+    };
+
+    struct table {
+        size_t mask;
+        /* 64 - log2 of the size: the hash keeps its top bits */
+        unsigned int shift = 64;
+        std::unique_ptr<slot[]> slots;
+
+        explicit table(size_t size): mask(size - 1), slots(new slot[size])
+        {
+            for (size_t s = size; s > 1; s >>= 1) shift--;
+        }
+    };
+
+    static constexpr size_t MIN_TABLE_SIZE = 16;
+
+    std::atomic<table*> m_table{ nullptr };
+    std::vector<std::unique_ptr<table>> m_tables;
+    std::vector<std::unique_ptr<T>> m_cb_store;
+    size_t m_used = 0;
+    std::mutex m_mutex;
+
+    /*
+     * Returns the slot of obj, or the empty slot it would go in. The table is never more than half full.
+     * Fibonacci hashing: the top bits of the product are the well mixed ones.
+     */
+    static slot& find(const table& t, const QemuObject* obj)
+    {
+        size_t i = size_t((uint64_t(reinterpret_cast<uintptr_t>(obj) >> 4) * 0x9e3779b97f4a7c15ull) >> t.shift);
+
+        for (;; i++) {
+            slot& s = t.slots[i & t.mask];
+            QemuObject* o = s.obj.load(std::memory_order_acquire);
+            if (o == obj || o == nullptr) {
+                return s;
+            }
+        }
+    }
+
+    /* Must be called with m_mutex held */
+    table& reserve_slot()
+    {
+        table* t = m_table.load(std::memory_order_relaxed);
+        if (t && 2 * (m_used + 1) <= t->mask + 1) {
+            return *t;
+        }
+
+        table* nt = new table(t ? 2 * (t->mask + 1) : size_t(MIN_TABLE_SIZE));
+        if (t) {
+            for (size_t i = 0; i <= t->mask; i++) {
+                QemuObject* o = t->slots[i].obj.load(std::memory_order_relaxed);
+                if (o) {
+                    slot& s = find(*nt, o);
+                    s.cb.store(t->slots[i].cb.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    s.obj.store(o, std::memory_order_relaxed);
+                }
+            }
+        }
+        m_tables.emplace_back(nt);
+        m_table.store(nt, std::memory_order_release);
+        return *nt;
+    }
 
 public:
-    void register_cb(Object obj, T cb) { m_cbs[obj.get_qemu_obj()] = cb; }
+    void register_cb(Object obj, T cb)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        table& t = reserve_slot();
+        slot& s = find(t, obj.get_qemu_obj());
+
+        m_cb_store.emplace_back(new T(cb));
+        s.cb.store(m_cb_store.back().get(), std::memory_order_release);
+        if (s.obj.load(std::memory_order_relaxed) == nullptr) {
+            s.obj.store(obj.get_qemu_obj(), std::memory_order_release);
+            m_used++;
+        }
+    }
 
-    void clear(Object obj) { m_cbs.erase(obj.get_qemu_obj()); }
+    void clear(Object obj)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        table* t = m_table.load(std::memory_order_relaxed);
+        if (t == nullptr) {
+            return;
+        }
+        /* The slot stays allocated to obj, registering it again reuses it */
+        find(*t, obj.get_qemu_obj()).cb.store(nullptr, std::memory_order_release);
+    }
 
     template <typename... Args>
     void call(QemuObject* obj, Args... args) const
     {
-        if (m_cbs.find(obj) == m_cbs.end()) {
+        const table* t = m_table.load(std::memory_order_acquire);
+        if (t == nullptr) {
+            return;
+        }
+
+        const T* cb = find(*t, obj).cb.load(std::memory_order_acquire);
+        if (cb == nullptr) {
             return;
         }
 
-        m_cbs.at(obj)(args...);
+        (*cb)(args...);
     }
 };
 
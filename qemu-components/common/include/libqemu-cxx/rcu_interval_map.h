@@ -0,0 +1,348 @@
+/*
+ * This file is part of libqemu-cxx
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gs {
+
+/**
+ * @brief Read-copy-update support: read side critical sections and grace periods
+ *
+ * @details Each thread that reads gets its own record, holding a sequence number that is odd while the
+ * thread is in a read side critical section. A grace period waits for every thread that was in a
+ * critical section to leave it. Records are recycled when their thread exits.
+ */
+class Rcu
+{
+    struct reader {
+        std::atomic<uint64_t> seq{ 0 };
+        std::atomic<bool> in_use{ true };
+        reader* next = nullptr;
+    };
+
+    static std::atomic<reader*>& readers()
+    {
+        static std::atomic<reader*> head{ nullptr };
+        return head;
+    }
+
+    static reader* acquire_reader()
+    {
+        for (reader* r = readers().load(); r; r = r->next) {
+            bool expected = false;
+            if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(expected, true)) {
+                return r;
+            }
+        }
+        reader* r = new reader();
+        r->next = readers().load();
+        while (!readers().compare_exchange_weak(r->next, r)) {
+        }
+        return r;
+    }
+
+    /* Gives the record back when the thread exits */
+    struct reader_handle {
+        reader* r = acquire_reader();
+        ~reader_handle() { r->in_use.store(false); }
+    };
+
+    static reader& self()
+    {
+        static thread_local reader_handle h;
+        return *h.r;
+    }
+
+public:
+    class ReadLock
+    {
+        reader& m_r;
+
+    public:
+        ReadLock(): m_r(self())
+        {
+            /* seq_cst, as are the loads of the data it protects, so that they are not reordered before it */
+            m_r.seq.fetch_add(1);
+        }
+        ~ReadLock() { m_r.seq.fetch_add(1, std::memory_order_release); }
+        ReadLock(const ReadLock&) = delete;
+        ReadLock& operator=(const ReadLock&) = delete;
+    };
+
+    /**
+     * @brief A grace period that can be polled rather than waited for: it records the read side
+     * critical sections in progress when it starts, and has elapsed once they all finished.
+     */
+    class GracePeriod
+    {
+        std::vector<std::pair<reader*, uint64_t>> m_pending;
+
+    public:
+        GracePeriod()
+        {
+            for (reader* r = readers().load(); r; r = r->next) {
+                uint64_t seq = r->seq.load();
+                if (seq & 1) m_pending.emplace_back(r, seq);
+            }
+        }
+
+        bool elapsed()
+        {
+            m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(),
+                                           [](const std::pair<reader*, uint64_t>& p) {
+                                               return p.first->seq.load() != p.second;
+                                           }),
+                            m_pending.end());
+            return m_pending.empty();
+        }
+    };
+
+    /**
+     * @brief Wait for all the read side critical sections in progress to finish. Must not be called
+     * from within one.
+     */
+    static void synchronize()
+    {
+        GracePeriod gp;
+        while (!gp.elapsed()) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+/**
+ * @brief Map of disjoint address intervals to values, with lock free lookups
+ *
+ * @details Lookups binary search an immutable snapshot of the intervals inside an RCU read side critical
+ * section. A snapshot is made of a large sorted base, shared between snapshots, and a small sorted delta
+ * holding the latest inserts. Updates are serialised by a lock:
+ * - insert() publishes a new snapshot, copying the delta only. Once the delta grows past the square root
+ *   of the base size, both are merged into a new base, so that inserts cost O(sqrt(n)) amortised. The
+ *   intervals the new one overlaps are marked dead in place.
+ * - invalidate() marks the intervals overlapping a range dead in place, in O(log n + k), and waits for a
+ *   grace period before returning them, so that no lookup still uses them afterwards.
+ * Dead intervals are dropped by the next merge. Replaced snapshots are retired without waiting: they are
+ * freed by a later update, once a grace period has elapsed.
+ */
+template <class T>
+class RcuIntervalMap
+{
+public:
+    struct interval {
+        uint64_t start;
+        uint64_t end; /* inclusive */
+        T value;
+    };
+
+private:
+    static constexpr size_t MIN_DELTA_SIZE = 16;
+
+    struct node {
+        interval iv;
+        mutable std::atomic<bool> live{ true };
+
+        node(const interval& i): iv(i) {}
+        node(const node& o): iv(o.iv), live(o.live.load(std::memory_order_relaxed)) {}
+    };
+    using nodes = std::vector<node>;
+
+    struct snapshot {
+        std::shared_ptr<const nodes> base;
+        nodes delta;
+    };
+
+    struct retired {
+        const snapshot* s;
+        Rcu::GracePeriod gp;
+    };
+
+    std::atomic<const snapshot*> m_current;
+    std::mutex m_update;
+    std::vector<retired> m_retired;
+
+    /* First node whose interval ends at or after addr */
+    static typename nodes::const_iterator lower(const nodes& n, uint64_t addr)
+    {
+        return std::lower_bound(n.begin(), n.end(), addr, [](const node& a, uint64_t b) { return a.iv.end < b; });
+    }
+
+    static const node* find(const nodes& n, uint64_t addr)
+    {
+        auto it = lower(n, addr);
+        if (it == n.end() || it->iv.start > addr || !it->live.load()) {
+            return nullptr;
+        }
+        return &*it;
+    }
+
+    /* Mark the live nodes overlapping [start, end] dead, calling fn on them */
+    template <typename Fn>
+    static void kill(const nodes& n, uint64_t start, uint64_t end, Fn fn)
+    {
+        /* Intervals are disjoint and sorted, so the overlapping ones follow the first one ending in the range */
+        for (auto it = lower(n, start); it != n.end() && it->iv.start <= end; ++it) {
+            if (it->live.load(std::memory_order_relaxed)) {
+                it->live.store(false);
+                fn(it->iv);
+            }
+        }
+    }
+
+    static size_t count_live(const nodes& n)
+    {
+        return std::count_if(n.begin(), n.end(), [](const node& x) { return x.live.load(std::memory_order_relaxed); });
+    }
+
+    /* Must be called with m_update held */
+    void free_retired()
+    {
+        m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                                       [](retired& r) {
+                                           if (!r.gp.elapsed()) return false;
+                                           delete r.s;
+                                           return true;
+                                       }),
+                        m_retired.end());
+    }
+
+    /* Must be called with m_update held */
+    void publish(const snapshot* s)
+    {
+        const snapshot* old = m_current.exchange(s);
+        m_retired.push_back({ old, Rcu::GracePeriod() });
+        free_retired();
+    }
+
+public:
+    RcuIntervalMap(): m_current(new snapshot{ std::make_shared<const nodes>(), nodes() }) {}
+    ~RcuIntervalMap()
+    {
+        for (auto& r : m_retired) delete r.s;
+        delete m_current.load();
+    }
+    RcuIntervalMap(const RcuIntervalMap&) = delete;
+    RcuIntervalMap& operator=(const RcuIntervalMap&) = delete;
+
+    /**
+     * @brief Copy the value of the interval holding addr into value
+     * @return false if there is none
+     */
+    bool lookup(uint64_t addr, T& value) const
+    {
+        Rcu::ReadLock lock;
+        const snapshot& s = *m_current.load();
+
+        const node* n = find(s.delta, addr);
+        if (!n) n = find(*s.base, addr);
+        if (!n) {
+            return false;
+        }
+        value = n->iv.value;
+        return true;
+    }
+
+    /**
+     * @brief Map [start, end] to value, replacing the intervals it overlaps
+     */
+    void insert(uint64_t start, uint64_t end, const T& value)
+    {
+        std::lock_guard<std::mutex> lock(m_update);
+        const snapshot& cur = *m_current.load();
+        snapshot* s = new snapshot();
+
+        /* Lookups search the delta first, so the new interval hides the ones it overlaps until they are dead */
+        auto overlaps = [&](const node& n) { return n.iv.start <= end && n.iv.end >= start; };
+        auto pos = lower(cur.delta, start);
+        s->delta.reserve(cur.delta.size() + 1);
+        for (auto it = cur.delta.begin(); it != pos; ++it) {
+            if (it->live.load(std::memory_order_relaxed) && !overlaps(*it)) s->delta.push_back(*it);
+        }
+        s->delta.emplace_back(interval{ start, end, value });
+        for (auto it = pos; it != cur.delta.end(); ++it) {
+            if (it->live.load(std::memory_order_relaxed) && !overlaps(*it)) s->delta.push_back(*it);
+        }
+
+        size_t max_delta = std::max<size_t>(size_t(MIN_DELTA_SIZE), std::sqrt(double(cur.base->size())));
+        if (s->delta.size() <= max_delta) {
+            s->base = cur.base;
+            /* cur may be freed by publish() */
+            publish(s);
+            kill(*s->base, start, end, [](const interval&) {});
+            return;
+        }
+
+        /* Merge: the new base holds the live intervals of both, the overlapped ones left out */
+        auto base = std::make_shared<nodes>();
+        base->reserve(cur.base->size() + s->delta.size());
+        auto b = cur.base->begin();
+        for (const node& d : s->delta) {
+            for (; b != cur.base->end() && b->iv.start < d.iv.start; ++b) {
+                if (b->live.load(std::memory_order_relaxed) && !overlaps(*b)) base->push_back(*b);
+            }
+            base->push_back(d);
+        }
+        for (; b != cur.base->end(); ++b) {
+            if (b->live.load(std::memory_order_relaxed) && !overlaps(*b)) base->push_back(*b);
+        }
+        s->base = std::move(base);
+        s->delta.clear();
+        publish(s);
+    }
+
+    /**
+     * @brief Remove the intervals overlapping [start, end], calling fn on each of them once no lookup
+     * can return it any more.
+     * @return the number of intervals removed
+     */
+    size_t invalidate(uint64_t start, uint64_t end, const std::function<void(interval&)>& fn = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_update);
+        const snapshot& s = *m_current.load();
+        std::vector<interval> removed;
+
+        auto collect = [&](const interval& iv) { removed.push_back(iv); };
+        kill(s.delta, start, end, collect);
+        kill(*s.base, start, end, collect);
+        if (removed.empty()) {
+            return 0;
+        }
+
+        Rcu::synchronize();
+        free_retired();
+        if (fn) {
+            for (auto& iv : removed) fn(iv);
+        }
+        return removed.size();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_update);
+        publish(new snapshot{ std::make_shared<const nodes>(), nodes() });
+    }
+
+    /* Number of live intervals */
+    size_t size() const
+    {
+        Rcu::ReadLock lock;
+        const snapshot& s = *m_current.load();
+        return count_live(s.delta) + count_live(*s.base);
+    }
+};
+
+} // namespace gs
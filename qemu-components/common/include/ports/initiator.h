@@ -9,8 +9,13 @@
 #ifndef _LIBQBOX_PORTS_INITIATOR_H
 #define _LIBQBOX_PORTS_INITIATOR_H
 
+#include <algorithm>
 #include <functional>
+#include <iterator>
 #include <limits>
+#include <list>
+#include <map>
+#include <vector>
 #include <cassert>
 #include <cinttypes>
 
@@ -26,6 +31,7 @@
 #include <tlm-extensions/qemu-mr-hint.h>
 #include <tlm-extensions/exclusive-access.h>
 #include <tlm-extensions/shmem_extension.h>
+#include <tlm-extensions/thread-safe-hint.h>
 #include <tlm-extensions/underlying-dmi.h>
 #include <tlm_sockets_buswidth.h>
 
@@ -63,7 +69,9 @@ class QemuInitiatorSocket
 {
 private:
     std::mutex m_mutex;
-    std::vector<std::pair<sc_dt::uint64, sc_dt::uint64>> m_ranges;
+    /* Pending DMI invalidations, disjoint and non adjacent: start -> end (inclusive) */
+    std::map<sc_dt::uint64, sc_dt::uint64> m_ranges;
+    bool m_invalidation_pending = false;
 
 public:
     SCP_LOGGER(());
@@ -100,10 +108,32 @@ protected:
     };
     m_mem_obj* m_r = nullptr;
 
+    /*
+     * Address ranges (start -> inclusive end) that only lead to thread safe
+     * targets, as reported by the routers on the way. Accesses within them are
+     * made directly from the vCPU thread. Only used with the iothread lock held.
+     */
+    std::map<uint64_t, uint64_t> m_thread_safe_ranges;
+
     // we use an ordered map to find and combine elements
     std::map<DmiRegionAliasKey, DmiRegionAlias::Ptr> m_dmi_aliases;
     using AliasesIterator = std::map<DmiRegionAliasKey, DmiRegionAlias::Ptr>::iterator;
 
+    /* Aliases of m_dmi_aliases, most recently requested first, for eviction */
+    std::list<DmiRegionAliasKey> m_dmi_lru;
+
+    struct DmiAliasInfo {
+        std::list<DmiRegionAliasKey>::iterator lru;
+        /* Priority the alias is mapped with, above the aliases it shadows */
+        int priority = 0;
+        /*
+         * Aliases this one replaced when coalescing. They stay mapped underneath it, as unmapping
+         * each of them would rebuild the QEMU flatview, and are unmapped together with it.
+         */
+        std::vector<DmiRegionAlias::Ptr> shadowed;
+    };
+    std::map<DmiRegionAliasKey, DmiAliasInfo> m_dmi_alias_info;
+
     void init_payload(TlmPayload& trans, tlm::tlm_command command, uint64_t addr, uint64_t* val, unsigned int size)
     {
         trans.set_command(command);
@@ -118,12 +148,18 @@ protected:
         m_initiator.initiator_customize_tlm_payload(trans);
     }
 
-    void add_dmi_mr_alias(DmiRegionAlias::Ptr alias)
+    void add_dmi_mr_alias(DmiRegionAlias::Ptr alias, int priority = 0)
     {
         SCP_INFO(()) << "Adding " << *alias;
         qemu::MemoryRegion alias_mr = alias->get_alias_mr();
-        m_r->m_root->add_subregion(alias_mr, alias->get_start());
+        if (priority) {
+            alias_mr.set_priority(priority);
+            m_r->m_root->add_subregion_overlap(alias_mr, alias->get_start());
+        } else {
+            m_r->m_root->add_subregion(alias_mr, alias->get_start());
+        }
         alias->set_installed();
+        m_inst.get_dmi_manager().alias_installed(*m_r->m_root, alias);
     }
 
     void del_dmi_mr_alias(const DmiRegionAlias::Ptr alias)
@@ -132,6 +168,8 @@ protected:
             return;
         }
         SCP_INFO(()) << "Removing " << *alias;
+        /* Stop giving the alias to SystemC initiators before QEMU stops using it */
+        m_inst.get_dmi_manager().alias_removed(*m_r->m_root, alias);
         m_r->m_root->del_subregion(alias->get_alias_mr());
     }
 
@@ -158,41 +196,18 @@ protected:
 
         /*
          * Fast path : check to see if the TE is already cached, if so return it straight away.
+         * The cache is lock free for lookups.
          */
-        {
-            // Really wish we didn't need the lock here
-            std::lock_guard<std::mutex> lock(m_mutex);
-
-#ifdef USE_UNORD
-            auto m = iommumr->m_mapped_te.find(addr >> iommumr->min_page_sz);
-            if (m != iommumr->m_mapped_te.end()) {
-                *te = m->second;
-                SCP_TRACE(())
-                ("FAST (unord) translate for 0x{:x} :  0x{:x}->0x{:x} (mask 0x{:x}) perm={}", addr, te->iova,
-                 te->translated_addr, te->addr_mask, te->perm);
-                return;
-            }
-#else // USE_UNORD
-
-            if (iommumr->m_mapped_te.size() > 0) {
-                auto it = iommumr->m_mapped_te.upper_bound(addr);
-                if (it != iommumr->m_mapped_te.begin()) {
-                    it--;
-                    if (it != iommumr->m_mapped_te.end() && (it->first) == (addr & ~it->second.addr_mask)) {
-                        *te = it->second;
+        if (iommumr->m_mapped_te.lookup(addr, *te)) {
 #if DEBUG_CACHE
-                        tmpte = *te;
-                        incache = true;
+            tmpte = *te;
+            incache = true;
+#else
+            SCP_TRACE(())
+            ("FAST translate for 0x{:x} :  0x{:x}->0x{:x} (mask 0x{:x}) perm={}", addr, te->iova, te->translated_addr,
+             te->addr_mask, te->perm);
+            return;
 #endif // DEBUG_CACHE
-                        SCP_TRACE(())
-                        ("FAST translate for 0x{:x} :  0x{:x}->0x{:x} (mask 0x{:x}) perl={}", addr, te->iova,
-                         te->translated_addr, te->addr_mask, te->perm);
-
-                        return;
-                    }
-                }
-            }
-#endif // USE_UNORD
         }
 
         /*
@@ -275,12 +290,7 @@ protected:
                 assert(te->perm == tmpte.perm);
             }
 #endif // DEBUG_CACHE
-            std::lock_guard<std::mutex> lock(m_mutex);
-#ifdef USE_UNORD
-            iommumr->m_mapped_te[(addr & ~te->addr_mask) >> iommumr->min_page_sz] = *te;
-#else  // USE_UNORD
-            iommumr->m_mapped_te[addr & ~te->addr_mask] = *te;
-#endif //  USE_UNORD
+            iommumr->m_mapped_te.insert(addr & ~te->addr_mask, (addr & ~te->addr_mask) | te->addr_mask, *te);
             SCP_DEBUG(())
             ("Caching TE at addr 0x{:x} (mask {:x})", addr & ~te->addr_mask, te->addr_mask);
 
@@ -452,41 +462,149 @@ protected:
 
         SCP_INFO(()) << "DMI Adding for address 0x" << std::hex << trans.get_address();
 
-        // The upper limit is set within QEMU by the TBU
-        // e.g. 1k small pages for ARM.
-        // setting to 1/2 the size of the ARM TARGET_PAGE_SIZE,
-        // Comment from QEMU code:
-        /* The physical section number is ORed with a page-aligned
-         * pointer to produce the iotlb entries.  Thus it should
-         * never overflow into the page-aligned value.
-         */
-#define MAX_MAP 250
-
         // Current function may be called by the MMIO thread which does not hold
         // any RCU read lock. This is required in case of a memory transaction
         // commit on a TCG accelerated Qemu instance
         qemu::RcuReadLock rcu_read_lock = m_inst.get().rcu_read_lock_new();
 
-        if (m_dmi_aliases.size() > MAX_MAP) {
-            SCP_FATAL(())("Too many DMI regions requested, consider using an IOMMU");
-        }
         uint64_t start = dmi_data.get_start_address();
         uint64_t end = dmi_data.get_end_address();
 
-        if (0 == m_dmi_aliases.count(start)) {
-            SCP_INFO(()) << "Adding DMI for range [0x" << std::hex << dmi_data.get_start_address() << "-0x" << std::hex
-                         << dmi_data.get_end_address() << "]";
+        AliasesIterator existing = find_covering_alias(dmi_data, shm_fd);
+        if (existing != m_dmi_aliases.end()) {
+            SCP_INFO(())("Already have DMI for 0x{:x}", start);
+            touch_dmi_alias(existing->first);
+            return dmi_data;
+        }
 
-            DmiRegionAlias::Ptr alias = m_inst.get_dmi_manager().get_new_region_alias(dmi_data, shm_fd);
+        tlm::tlm_dmi alias_dmi = dmi_data;
+        DmiAliasInfo info;
+        if (shm_fd < 0) {
+            coalesce_dmi_aliases(alias_dmi, info);
+            start = alias_dmi.get_start_address();
+            end = alias_dmi.get_end_address();
+        }
 
-            m_dmi_aliases[start] = alias;
-            add_dmi_mr_alias(m_dmi_aliases[start]);
-        } else {
-            SCP_INFO(())("Already have DMI for 0x{:x}", start);
+        while (m_dmi_aliases.size() >= MAX_DMI_ALIASES) {
+            evict_lru_dmi_alias();
         }
+
+        SCP_INFO(()) << "Adding DMI for range [0x" << std::hex << start << "-0x" << std::hex << end << "]";
+
+        DmiRegionAlias::Ptr alias = m_inst.get_dmi_manager().get_new_region_alias(alias_dmi, shm_fd);
+
+        m_dmi_aliases[start] = alias;
+        add_dmi_mr_alias(alias, info.priority);
+        info.lru = m_dmi_lru.insert(m_dmi_lru.begin(), start);
+        m_dmi_alias_info[start] = std::move(info);
+
         return dmi_data;
     }
 
+    /*
+     * The upper limit is set within QEMU by the TBU, e.g. 1k small pages for
+     * ARM. We use 1/2 the size of the ARM TARGET_PAGE_SIZE. Comment from QEMU
+     * code:
+     *   The physical section number is ORed with a page-aligned pointer to
+     *   produce the iotlb entries.  Thus it should never overflow into the
+     *   page-aligned value.
+     * Once reached, the least recently requested alias is evicted: accesses to
+     * it go through the MMIO path again, which will request it back. Shadowed
+     * aliases do not count, QEMU makes no section for what it cannot see.
+     */
+    static constexpr size_t MAX_DMI_ALIASES = 250;
+
+    /* Host pointer minus guest address, identical for grants of the same host mapping */
+    static uintptr_t dmi_host_offset(const unsigned char* ptr, uint64_t start)
+    {
+        return reinterpret_cast<uintptr_t>(ptr) - start;
+    }
+
+    /* [a_start, a_end] and [b_start, b_end] overlap or are adjacent */
+    static bool dmi_touches(uint64_t a_start, uint64_t a_end, uint64_t b_start, uint64_t b_end)
+    {
+        return (b_start == 0 || b_start - 1 <= a_end) && (a_start == 0 || a_start - 1 <= b_end);
+    }
+
+    static bool same_dmi_mapping(const DmiRegionAlias& alias, const tlm::tlm_dmi& dmi, int fd)
+    {
+        return alias.get_fd() == fd && alias.get_granted_access() == dmi.get_granted_access() &&
+               dmi_host_offset(alias.get_dmi_ptr(), alias.get_start()) ==
+                   dmi_host_offset(dmi.get_dmi_ptr(), dmi.get_start_address());
+    }
+
+    AliasesIterator find_covering_alias(const tlm::tlm_dmi& dmi, int fd)
+    {
+        for (auto it = m_dmi_aliases.begin(); it != m_dmi_aliases.end(); it++) {
+            const DmiRegionAlias& a = *it->second;
+            if (a.get_start() > dmi.get_start_address()) break;
+            if (a.get_end() >= dmi.get_end_address() && same_dmi_mapping(a, dmi, fd)) return it;
+        }
+        return m_dmi_aliases.end();
+    }
+
+    /*
+     * Grow dmi over the aliases it overlaps or touches that map the same host
+     * memory at the same offset, with the same access, so that a single alias
+     * replaces them all. They are moved to info, to be shadowed by the new
+     * alias rather than unmapped one by one.
+     */
+    void coalesce_dmi_aliases(tlm::tlm_dmi& dmi, DmiAliasInfo& info)
+    {
+        uintptr_t offset = dmi_host_offset(dmi.get_dmi_ptr(), dmi.get_start_address());
+        bool merged;
+
+        do {
+            merged = false;
+            uint64_t start = dmi.get_start_address();
+            uint64_t end = dmi.get_end_address();
+
+            for (auto it = m_dmi_aliases.begin(); it != m_dmi_aliases.end();) {
+                DmiRegionAlias::Ptr a = it->second;
+                if (!dmi_touches(start, end, a->get_start(), a->get_end()) || !same_dmi_mapping(*a, dmi, -1)) {
+                    it++;
+                    continue;
+                }
+                SCP_DEBUG(()) << "Coalescing DMI alias [0x" << std::hex << a->get_start() << "-0x" << a->get_end()
+                              << "]";
+                start = std::min(start, a->get_start());
+                end = std::max(end, a->get_end());
+
+                auto ai = m_dmi_alias_info.find(it->first);
+                assert(ai != m_dmi_alias_info.end());
+                info.priority = std::max(info.priority, ai->second.priority + 1);
+                info.shadowed.push_back(a);
+                std::move(ai->second.shadowed.begin(), ai->second.shadowed.end(), std::back_inserter(info.shadowed));
+                m_dmi_lru.erase(ai->second.lru);
+                m_dmi_alias_info.erase(ai);
+                it = m_dmi_aliases.erase(it);
+                merged = true;
+            }
+
+            dmi.set_start_address(start);
+            dmi.set_end_address(end);
+            dmi.set_dmi_ptr(reinterpret_cast<unsigned char*>(offset + start));
+        } while (merged);
+    }
+
+    void touch_dmi_alias(DmiRegionAliasKey key)
+    {
+        auto ai = m_dmi_alias_info.find(key);
+        assert(ai != m_dmi_alias_info.end());
+        m_dmi_lru.splice(m_dmi_lru.begin(), m_dmi_lru, ai->second.lru);
+    }
+
+    void evict_lru_dmi_alias()
+    {
+        assert(!m_dmi_lru.empty());
+
+        auto it = m_dmi_aliases.find(m_dmi_lru.back());
+        assert(it != m_dmi_aliases.end());
+        SCP_INFO(()) << "Too many DMI regions, evicting [0x" << std::hex << it->second->get_start() << "-0x"
+                     << it->second->get_end() << "]";
+        remove_alias(it);
+    }
+
     void check_qemu_mr_hint(TlmPayload& trans)
     {
         QemuMrHintTlmExtension* ext = nullptr;
@@ -518,15 +636,22 @@ protected:
 
         uint64_t addr = trans.get_address();
         sc_time now = m_initiator.initiator_get_local_time();
+        gs::ThreadSafeHintExtension ts_hint;
 
+        trans.set_extension(&ts_hint);
+        gs::SyncStats::add(gs::SyncStats::get().cross_thread_accesses);
         m_inst.get().unlock_iothread();
         m_on_sysc.run_on_sysc([this, &trans, &now] { (*this)->b_transport(trans, now); });
         m_inst.get().lock_iothread();
+        trans.clear_extension(&ts_hint);
         /*
          * Reset transaction address before dmi check (could be altered by
          * b_transport).
          */
         trans.set_address(addr);
+        if (ts_hint.is_safe()) {
+            add_thread_safe_range(ts_hint.get_start(addr), ts_hint.get_end(addr));
+        }
         check_qemu_mr_hint(trans);
         if (trans.is_dmi_allowed()) {
             check_dmi_hint_locked(trans);
@@ -548,6 +673,45 @@ protected:
         (*this)->b_transport(trans, now);
     }
 
+    void add_thread_safe_range(uint64_t start, uint64_t end)
+    {
+        SCP_INFO(())("Thread safe target at [0x{:x} - 0x{:x}], calling it from the vCPU thread", start, end);
+        auto it = m_thread_safe_ranges.find(start);
+        if (it == m_thread_safe_ranges.end() || it->second < end) {
+            m_thread_safe_ranges[start] = end;
+        }
+    }
+
+    bool is_thread_safe(uint64_t addr, unsigned int size)
+    {
+        auto it = m_thread_safe_ranges.upper_bound(addr);
+        if (it == m_thread_safe_ranges.begin()) {
+            return false;
+        }
+        --it;
+        return addr + size - 1 <= it->second;
+    }
+
+    /*
+     * The target accepts b_transport from any thread: call it from here,
+     * keeping the iothread lock, with the quantum keeper local time.
+     */
+    void do_thread_safe_access(TlmPayload& trans)
+    {
+        uint64_t addr = trans.get_address();
+        sc_core::sc_time now = m_initiator.initiator_get_local_time();
+
+        (*this)->b_transport(trans, now);
+
+        trans.set_address(addr);
+        check_qemu_mr_hint(trans);
+        if (trans.is_dmi_allowed()) {
+            check_dmi_hint_locked(trans);
+        }
+
+        m_initiator.initiator_set_local_time(now);
+    }
+
     MemTxResult qemu_io_access(tlm::tlm_command command, uint64_t addr, uint64_t* val, unsigned int size,
                                MemTxAttrs attrs)
     {
@@ -561,6 +725,8 @@ protected:
              * clearly dangerous, but exclusives are not guaranteed to work on IO space anyway
              */
             do_direct_access(trans);
+        } else if (!attrs.debug && is_thread_safe(addr, size)) {
+            do_thread_safe_access(trans);
         } else {
             if (!m_inst.g_rec_qemu_io_lock.try_lock()) {
                 /* Allow only a single access, but handle re-entrant code,
@@ -641,6 +807,9 @@ public:
         m_dev = dev;
     }
 
+    /* Root memory region QEMU maps this socket's address space on, once initialised */
+    std::shared_ptr<qemu::MemoryRegion> get_root_mr() const { return m_r ? m_r->m_root : nullptr; }
+
     void end_of_simulation()
     {
         m_finished = true;
@@ -763,6 +932,11 @@ public:
          * Remove the alias from the root MR. This is enough to perform
          * required invalidations on QEMU's side in a thread-safe manner.
          */
+        auto ai = m_dmi_alias_info.find(it->first);
+        assert(ai != m_dmi_alias_info.end());
+        for (auto& s : ai->second.shadowed) {
+            del_dmi_mr_alias(s);
+        }
         del_dmi_mr_alias(r);
 
         /*
@@ -772,6 +946,8 @@ public:
          * region, it is in turn destructed, effectively destroying the
          * corresponding memory region in QEMU.
          */
+        m_dmi_lru.erase(ai->second.lru);
+        m_dmi_alias_info.erase(ai);
         return m_dmi_aliases.erase(it);
     }
 
@@ -808,16 +984,65 @@ private:
         }
     }
 
+    /*
+     * Add a range to the pending invalidations, merging it with the ranges it overlaps or is adjacent
+     * to. Must be called with m_mutex held.
+     */
+    void add_pending_range(sc_dt::uint64 start_range, sc_dt::uint64 end_range)
+    {
+        auto it = m_ranges.upper_bound(start_range);
+        if (it != m_ranges.begin() && (start_range == 0 || std::prev(it)->second >= start_range - 1)) {
+            it--;
+            start_range = it->first;
+        }
+        while (it != m_ranges.end() && (end_range == UINT64_MAX || it->first <= end_range + 1)) {
+            end_range = std::max(end_range, it->second);
+            it = m_ranges.erase(it);
+        }
+        m_ranges[start_range] = end_range;
+    }
+
+    /*
+     * Apply all the pending invalidations at once: both the ranges and the aliases are sorted, so
+     * a single walk over the aliases is enough.
+     */
     void invalidate_ranges_safe_cb()
     {
         std::lock_guard<std::mutex> lock(m_mutex);
 
+        m_invalidation_pending = false;
+        if (m_ranges.empty()) {
+            return;
+        }
+
         SCP_DEBUG(()) << "Invalidating " << m_ranges.size() << " ranges";
         auto rit = m_ranges.begin();
-        while (rit != m_ranges.end()) {
-            invalidate_single_range(rit->first, rit->second);
-            rit = m_ranges.erase(rit);
+        auto it = m_dmi_aliases.upper_bound(rit->first);
+        if (it != m_dmi_aliases.begin()) {
+            /* The preceding region may already cross the first range */
+            it--;
         }
+        while (it != m_dmi_aliases.end() && rit != m_ranges.end()) {
+            DmiRegionAlias::Ptr r = it->second;
+
+            if (rit->second < r->get_start()) {
+                /* This range is done with */
+                rit++;
+                continue;
+            }
+
+            if (r->get_end() < rit->first) {
+                /* We are not in yet */
+                it++;
+                continue;
+            }
+
+            it = remove_alias(it);
+
+            SCP_DEBUG(()) << "Invalidated region [0x" << std::hex << r->get_start() << ", 0x" << std::hex
+                          << r->get_end() << "]";
+        }
+        m_ranges.clear();
     }
 
 public:
@@ -834,25 +1059,37 @@ public:
                 auto mr_end = m.first + m.second->get_size();
                 if ((mr_start >= start_range && mr_start <= end_range) ||
                     (mr_end >= start_range && mr_end <= end_range) || (mr_start < start_range && mr_end > end_range)) {
-                    for (auto it = m.second->m_mapped_te.begin(); it != m.second->m_mapped_te.end();) {
-#ifdef USE_UNORD
-                        if ((it->first << m.second->min_page_sz) + mr_start >= start_range &&
-                            (it->first << m.second->min_page_sz) + mr_start < end_range) {
-#else
-                        if (it->first + mr_start >= start_range && it->first + mr_start < end_range) {
-#endif
-                            m.second->iommu_unmap(&(it->second));
-                            it = m.second->m_mapped_te.erase(it);
-                        } else
-                            it++;
-                    }
+                    /* Cached translations are keyed relative to the region */
+                    uint64_t start = start_range > mr_start ? start_range - mr_start : 0;
+                    uint64_t end = end_range - mr_start;
+                    auto iommumr = m.second;
+                    iommumr->m_mapped_te.invalidate(
+                        start, end, [&](gs::RcuIntervalMap<qemu::IOMMUMemoryRegion::IOMMUTLBEntry>::interval& iv) {
+                            iommumr->iommu_unmap(&iv.value);
+                        });
                     return; // If we found this, then we're done. Overlapping IOMMU's are not allowed.
                 }
             }
         }
+        if (m_r) {
+            /*
+             * The aliases are only unmapped by the job below. Meanwhile, the SystemC initiators given
+             * direct access to them through a target socket are told to drop it right away, from
+             * the thread the target invalidated them on.
+             */
+            m_inst.get_dmi_manager().range_invalidated(*m_r->m_root, start_range, end_range);
+        }
         {
+            /*
+             * Invalidations arriving before the pending ones are applied are merged with them, and
+             * applied by the same job: repeated invalidations of the same ranges only cost one pass.
+             */
             std::lock_guard<std::mutex> lock(m_mutex);
-            m_ranges.push_back(std::make_pair(start_range, end_range));
+            add_pending_range(start_range, end_range);
+            if (m_invalidation_pending) {
+                return;
+            }
+            m_invalidation_pending = true;
         }
 
         m_initiator.initiator_async_run([&]() { invalidate_ranges_safe_cb(); });
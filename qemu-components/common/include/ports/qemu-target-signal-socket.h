@@ -14,6 +14,7 @@
 #include <libqemu-cxx/libqemu-cxx.h>
 
 #include <ports/target-signal-socket.h>
+#include <qk_controller.h>
 
 /**
  * @class QemuTargetSignalSocket
@@ -30,7 +31,13 @@ class QemuTargetSignalSocket : public TargetSignalSocket<bool>
 protected:
     qemu::Gpio m_gpio_in;
 
-    void value_changed_cb(const bool& val) { m_gpio_in.set(val); }
+    void value_changed_cb(const bool& val)
+    {
+        if (val) {
+            gs::SyncStats::add(gs::SyncStats::get().irqs);
+        }
+        m_gpio_in.set(val);
+    }
 
     void init_with_gpio(qemu::Gpio gpio)
     {
@@ -11,6 +11,8 @@
 
 #include <tlm>
 
+#include <libgssync.h>
+
 #include "qemu-instance.h"
 #include "tlm-extensions/qemu-cpu-hint.h"
 #include "tlm-extensions/qemu-mr-hint.h"
@@ -27,10 +29,22 @@ protected:
     qemu::MemoryRegion m_mr;
     std::shared_ptr<qemu::AddressSpace> m_as;
 
+    /*
+     * DMI is given to the parts of m_mr QEMU maps from DMI regions (i.e. RAM), as known by the DMI
+     * manager. Initiators are told to drop it when QEMU unmaps them.
+     */
+    QemuInstanceDmiManager* m_dmi_mgr = nullptr;
+    QemuInstanceDmiManager::InvalidateFn m_invalidate;
+    int m_dmi_watcher = -1;
+
     void init_as()
     {
         m_as = m_mr.get_inst().address_space_new();
         m_as->init(m_mr, "qemu-target-socket");
+
+        if (m_dmi_mgr && m_invalidate) {
+            m_dmi_watcher = m_dmi_mgr->add_watcher(m_mr, m_invalidate);
+        }
     }
 
     qemu::Cpu push_current_cpu(TlmPayload& trans)
@@ -67,6 +81,20 @@ protected:
     }
 
 public:
+    ~TlmTargetToQemuBridge()
+    {
+        if (m_dmi_watcher != -1) {
+            m_dmi_mgr->remove_watcher(m_dmi_watcher);
+        }
+    }
+
+    /* Must be called before init() */
+    void init_dmi(QemuInstanceDmiManager& dmi_mgr, QemuInstanceDmiManager::InvalidateFn invalidate)
+    {
+        m_dmi_mgr = &dmi_mgr;
+        m_invalidate = invalidate;
+    }
+
     void init(qemu::SysBusDevice sbd, int mmio_idx)
     {
         m_mr = sbd.mmio_get_region(mmio_idx);
@@ -140,7 +168,13 @@ public:
         return tlm::TLM_ACCEPTED;
     }
 
-    virtual bool get_direct_mem_ptr(TlmPayload& trans, tlm::tlm_dmi& dmi_data) { return false; }
+    virtual bool get_direct_mem_ptr(TlmPayload& trans, tlm::tlm_dmi& dmi_data)
+    {
+        if (m_dmi_mgr == nullptr) {
+            return false;
+        }
+        return m_dmi_mgr->find_installed_alias(m_mr, trans.get_address(), dmi_data);
+    }
 
     virtual unsigned int transport_dbg(TlmPayload& trans)
     {
@@ -167,11 +201,26 @@ protected:
     TlmTargetToQemuBridge m_bridge;
     QemuInstance& m_inst;
     qemu::SysBusDevice m_sbd;
+    gs::runonsysc m_on_sysc;
 
 public:
-    QemuTargetSocket(const char* name, QemuInstance& inst): TlmTargetSocket(name), m_inst(inst)
+    QemuTargetSocket(const char* name, QemuInstance& inst)
+        : TlmTargetSocket(name), m_inst(inst), m_on_sysc(sc_core::sc_gen_unique_name("run_on_sysc"))
     {
         TlmTargetSocket::bind(m_bridge);
+        m_bridge.init_dmi(m_inst.get_dmi_manager(), [this](uint64_t start, uint64_t end) {
+            /*
+             * Aliases may be unmapped from a vCPU thread. Initiators are told on the SystemC thread,
+             * right away when already on it, without making the vCPU wait otherwise.
+             */
+            m_on_sysc.run_on_sysc(
+                [this, start, end]() {
+                    if (TlmTargetSocket::get_base_port().size()) {
+                        (*this)->invalidate_direct_mem_ptr(start, end);
+                    }
+                },
+                false);
+        });
     }
 
     void init(qemu::SysBusDevice sbd, int mmio_idx) { m_bridge.init(sbd, mmio_idx); }
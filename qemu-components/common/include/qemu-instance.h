@@ -9,6 +9,8 @@
 #ifndef LIBQBOX_QEMU_INSTANCE_H_
 #define LIBQBOX_QEMU_INSTANCE_H_
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <sstream>
 #include <systemc>
@@ -19,6 +21,8 @@
 #include <cciutils.h>
 #include <report.h>
 #include <libgssync.h>
+#include <qkmulti-switchable.h>
+#include <host_affinity.h>
 
 #include <libqemu-cxx/libqemu-cxx.h>
 
@@ -91,11 +95,17 @@ class QemuInstance : public sc_core::sc_module
 {
 private:
     std::shared_ptr<gs::tlm_quantumkeeper_extended> m_first_qk = NULL;
+    /* Quantum keepers following p_sync_policy changes */
+    std::vector<std::shared_ptr<gs::tlm_quantumkeeper_switchable>> m_switchable_qks;
+    /* Policies p_sync_policy may be set to, once it may be switched */
+    std::vector<std::string> m_sync_policies;
     std::mutex m_lock;
     std::list<QemuDeviceBaseIF*> devices;
     cci::cci_broker_handle m_conf_broker;
 
     bool m_running = false;
+    /* CPUs waiting for work */
+    std::atomic<int> m_halted_cpus{ 0 };
     SCP_LOGGER();
 
 public:
@@ -108,6 +118,7 @@ public:
     void add_dev(QemuDeviceBaseIF* d)
     {
         std::lock_guard<std::mutex> lock(m_lock);
+        if (devices.empty()) gs::SyncStats::get().cpu_instances.fetch_add(1);
         devices.push_back(d);
     }
     void del_dev(QemuDeviceBaseIF* d)
@@ -115,6 +126,7 @@ public:
         if (m_running) {
             std::lock_guard<std::mutex> lock(m_lock);
             devices.remove(d);
+            if (devices.empty()) gs::SyncStats::get().cpu_instances.fetch_sub(1);
         }
     }
     bool can_run()
@@ -131,6 +143,58 @@ public:
         }
         return can_run;
     }
+
+    /* Host core for the thread of the vCPU with this index, none if vcpu_host_cpus is not set */
+    std::vector<int> vcpu_host_cpus(int index)
+    {
+        std::vector<int> cpus;
+        if (!gs::parse_host_cpus(p_vcpu_host_cpus, cpus)) {
+            SCP_FATAL(()) << "Invalid vcpu_host_cpus: " << p_vcpu_host_cpus.get_value();
+        }
+        if (cpus.empty()) return cpus;
+        return { cpus[index % cpus.size()] };
+    }
+
+    /*
+     * Called by CPUs when they start and stop waiting for work. Also tells the
+     * quantum controller when all_cpus_halted() starts or stops holding.
+     */
+    void cpu_halted(bool halted)
+    {
+        int before = m_halted_cpus.fetch_add(halted ? 1 : -1);
+        if (!idle_skip()) return;
+
+        int all;
+        if (m_tcg_mode == TCG_SINGLE) {
+            all = 1;
+        } else {
+            std::lock_guard<std::mutex> lock(m_lock);
+            all = int(devices.size());
+        }
+        if (halted && before + 1 == all) {
+            gs::SyncStats::get().idle_instances.fetch_add(1);
+        } else if (!halted && before == all) {
+            gs::SyncStats::get().idle_instances.fetch_sub(1);
+            gs::SyncStats::get().cpus_woke();
+        }
+    }
+
+    /* Halted CPUs are only woken up by interrupts, not every quantum */
+    bool idle_skip() { return p_idle_skip; }
+
+    /**
+     * @brief True if idle skipping is enabled and no CPU has work: CPUs may then stop ticking every
+     * quantum, and let time jump to the next timer or SystemC event.
+     *
+     * In SINGLE mode, the thread running all the CPUs only waits for work once none of them can run.
+     */
+    bool all_cpus_halted()
+    {
+        if (!idle_skip()) return false;
+        if (m_tcg_mode == TCG_SINGLE) return m_halted_cpus.load() > 0;
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_halted_cpus.load() == int(devices.size());
+    }
     using Target = qemu::Target;
     using LibLoader = qemu::LibraryLoaderIface;
 
@@ -155,6 +219,9 @@ protected:
 
     cci::cci_param<std::string> p_tcg_mode;
     cci::cci_param<std::string> p_sync_policy;
+    cci::cci_param<std::string> p_sync_policies;
+    cci::cci_param<uint64_t> p_sync_policy_switch_time_ns;
+    cci::cci_param<std::string> p_sync_policy_switch_to;
     TcgMode m_tcg_mode;
 
     cci::cci_param<bool> p_icount;
@@ -164,6 +231,8 @@ protected:
     bool p_display_argument_set;
 
     cci::cci_param<std::string> p_accel;
+    cci::cci_param<bool> p_idle_skip;
+    cci::cci_param<std::string> p_vcpu_host_cpus;
 
     void push_default_args()
     {
@@ -295,12 +364,21 @@ public:
         , m_dmi_mgr(m_inst)
         , p_tcg_mode("tcg_mode", "MULTI", "The TCG mode required, SINGLE, COROUTINE or MULTI")
         , p_sync_policy("sync_policy", "multithread-quantum", "Synchronization Policy to use")
+        , p_sync_policies("sync_policies", "",
+                          "Space separated list of the policies sync_policy may be changed to during the simulation")
+        , p_sync_policy_switch_time_ns("sync_policy_switch_time_ns", 0,
+                                       "Simulated time at which to change sync_policy to sync_policy_switch_to")
+        , p_sync_policy_switch_to("sync_policy_switch_to", "", "Sync policy to use from sync_policy_switch_time_ns")
         , m_tcg_mode(StringToTcgMode(p_tcg_mode))
         , p_icount("icount", false, "Enable virtual instruction counter")
         , p_icount_mips("icount_mips_shift", 0, "The MIPS shift value for icount mode (1 insn = 2^(mips) ns)")
         , p_args("qemu_args", "", "additional space separated arguments")
         , p_display_argument_set(false)
         , p_accel("accel", "tcg", "Virtualization accelerator")
+        , p_idle_skip("idle_skip", false,
+                      "When all the CPUs are halted, stop ticking every quantum and let time jump to the next event")
+        , p_vcpu_host_cpus("vcpu_host_cpus", "",
+                           "Host cores to pin the vCPU threads to in MULTI mode, one per vCPU by index (e.g. \"4-7\")")
     {
         SCP_DEBUG(()) << "Libqbox QemuInstance constructor";
         m_running = true;
@@ -359,6 +437,8 @@ public:
         /* only multi-mode sync should have separate QK's per CPU */
         if (m_first_qk && m_tcg_mode != TCG_MULTI) {
             qk = m_first_qk;
+        } else if (!p_sync_policies.get_value().empty()) {
+            qk = create_switchable_quantum_keeper();
         } else {
             qk = gs::tlm_quantumkeeper_factory(p_sync_policy);
         }
@@ -367,11 +447,59 @@ public:
         if (qk->get_thread_type() == gs::SyncPolicy::SYSTEMC_THREAD) {
             assert(m_tcg_mode == TCG_COROUTINE);
         }
-        /* The p_sync_policy parameter should not be modified anymore */
-        p_sync_policy.lock();
+        /* The p_sync_policy parameter should not be modified anymore, unless it may be switched */
+        if (m_switchable_qks.empty()) {
+            p_sync_policy.lock();
+        }
+        return qk;
+    }
+
+private:
+    std::shared_ptr<gs::tlm_quantumkeeper_extended> create_switchable_quantum_keeper()
+    {
+        std::vector<std::string> policies;
+        std::stringstream ss(p_sync_policies);
+        std::string policy;
+        while (ss >> policy) {
+            policies.push_back(policy);
+        }
+
+        auto qk = std::make_shared<gs::tlm_quantumkeeper_switchable>(p_sync_policy, policies);
+        if (m_switchable_qks.empty()) {
+            p_sync_policies.lock();
+            m_sync_policies = policies;
+            m_sync_policies.push_back(p_sync_policy);
+            /* Reject policies the quantum keepers can't switch to, rather than ignoring them */
+            p_sync_policy.register_pre_write_callback([this](const cci::cci_param_write_event<std::string>& ev) {
+                if (sync_policy_allowed(ev.new_value)) return true;
+                SCP_WARN(())("Sync policy {} is not listed in sync_policies, rejecting it", ev.new_value);
+                return false;
+            });
+            p_sync_policy.register_post_write_callback([this](auto ev) {
+                for (auto& q : m_switchable_qks) {
+                    q->switch_to(p_sync_policy);
+                }
+            });
+        }
+        m_switchable_qks.push_back(qk);
         return qk;
     }
 
+    bool sync_policy_allowed(const std::string& policy)
+    {
+        return std::find(m_sync_policies.begin(), m_sync_policies.end(), policy) != m_sync_policies.end();
+    }
+
+    /* Spawned at the start of the simulation, to switch the sync policy at a given simulated time */
+    void sync_policy_switch_thread()
+    {
+        sc_core::wait(sc_core::sc_time(double(p_sync_policy_switch_time_ns.get_value()), sc_core::SC_NS));
+        SCP_INFO(())("Switching sync policy to {}", p_sync_policy_switch_to.get_value());
+        p_sync_policy = p_sync_policy_switch_to.get_value();
+    }
+
+public:
+
     /**
      * @brief Initialize the QEMU instance
      *
@@ -461,7 +589,21 @@ public:
     int number_devices() { return devices.size(); }
 
 private:
-    void start_of_simulation(void) { get().finish_qemu_init(); }
+    void start_of_simulation(void)
+    {
+        get().finish_qemu_init();
+
+        if (!p_sync_policy_switch_to.get_value().empty()) {
+            if (m_switchable_qks.empty()) {
+                SCP_WARN(())("sync_policy_switch_to is ignored, sync_policies does not list policies to switch to");
+            } else if (!sync_policy_allowed(p_sync_policy_switch_to)) {
+                SCP_FATAL(())("sync_policy_switch_to {} is not listed in sync_policies",
+                              p_sync_policy_switch_to.get_value());
+            } else {
+                sc_core::sc_spawn(std::bind(&QemuInstance::sync_policy_switch_thread, this), "sync_policy_switch");
+            }
+        }
+    }
 };
 
 GSC_MODULE_REGISTER(QemuInstanceManager);
@@ -140,6 +140,13 @@ public:
 #endif
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <map>
+#include <vector>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#endif
 
 const char* dlpath(void* handle)
 {
@@ -184,34 +191,85 @@ public:
 class DefaultLibraryLoader : public qemu::LibraryLoaderIface
 {
 private:
-    const char* m_base = nullptr;
+    /* Path of the first instance of each library, the one further instances are copied from */
+    std::map<std::string, std::string> m_bases;
+    std::vector<int> m_memfds;
     std::string m_last_error;
 
-public:
-    qemu::LibraryLoaderIface::LibraryIfacePtr load_library(const char* lib_name)
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    /*
+     * Copy the library into an anonymous memory backed file, so that nothing
+     * is written to disk. The copy is done by the kernel, from the page cache
+     * of the original library. Returns the file descriptor, or -1.
+     */
+    int memfd_copy(const std::string& src)
     {
-        if (!m_base) {
-            std::cout << "Loading " << lib_name << "\n";
-            void* handle = dlopen(lib_name, RTLD_LOCAL | RTLD_NOW);
-            if (handle == nullptr) {
-                m_last_error = dlerror();
-                return nullptr;
+        int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            return -1;
+        }
+
+        struct stat st;
+        int out = -1;
+        if (fstat(in, &st) == 0) {
+            out = memfd_create("qbox_lib", MFD_CLOEXEC);
+        }
+
+        off_t off = 0;
+        while (out >= 0 && off < st.st_size) {
+            if (sendfile(out, in, &off, st.st_size - off) <= 0) {
+                close(out);
+                out = -1;
             }
-            m_base = dlpath(handle);
-            return std::make_shared<Library>(handle);
         }
-        std::cout << "RE Loading " << m_base << "\n";
+
+        close(in);
+        return out;
+    }
+
+    /*
+     * The dynamic loader identifies libraries by inode, hence each extra
+     * instance needs a copy of its own. Memory files give exactly this,
+     * without touching the disk.
+     */
+    void* load_memfd_copy(const std::string& base)
+    {
+        int fd = memfd_copy(base);
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        std::string path = "/proc/self/fd/" + std::to_string(fd);
+        void* handle = dlopen(path.c_str(), RTLD_LOCAL | RTLD_NOW);
+        if (handle == nullptr) {
+            m_last_error = dlerror();
+            close(fd);
+            return nullptr;
+        }
+
+        /*
+         * Keep the descriptor open: the loader also matches libraries by
+         * path, and a reused descriptor number would alias the next copy.
+         */
+        m_memfds.push_back(fd);
+        return handle;
+    }
+#endif
+
+    void* load_tmp_copy(const std::string& base)
+    {
         char tmp[] = "/tmp/qbox_lib.XXXXXX";
-        if (mkstemp(tmp) < 0) {
+        int fd = mkstemp(tmp);
+        if (fd < 0) {
             m_last_error = "Unable to create temp file";
             return nullptr;
         }
-        copy_file(m_base, tmp);
+        close(fd);
+        copy_file(base.c_str(), tmp);
 
         void* handle = dlopen(tmp, RTLD_LOCAL | RTLD_NOW);
         if (handle == nullptr) {
             m_last_error = dlerror();
-            return nullptr;
         }
 
 #ifndef DEBUG_TMP_LIBRARIES
@@ -219,6 +277,45 @@ public:
 #else
         std::cout << "WARNING : leaving " << tmp << "in place\n";
 #endif
+        return handle;
+    }
+
+public:
+    ~DefaultLibraryLoader()
+    {
+        for (int fd : m_memfds) {
+            close(fd);
+        }
+    }
+
+    qemu::LibraryLoaderIface::LibraryIfacePtr load_library(const char* lib_name)
+    {
+        auto base = m_bases.find(lib_name);
+
+        if (base == m_bases.end()) {
+            std::cout << "Loading " << lib_name << "\n";
+            void* handle = dlopen(lib_name, RTLD_LOCAL | RTLD_NOW);
+            if (handle == nullptr) {
+                m_last_error = dlerror();
+                return nullptr;
+            }
+            const char* path = dlpath(handle);
+            m_bases[lib_name] = path ? path : lib_name;
+            return std::make_shared<Library>(handle);
+        }
+
+        std::cout << "RE Loading " << base->second << "\n";
+        void* handle = nullptr;
+#if defined(__linux__) && defined(MFD_CLOEXEC) && !defined(DEBUG_TMP_LIBRARIES)
+        handle = load_memfd_copy(base->second);
+#endif
+        if (handle == nullptr) {
+            handle = load_tmp_copy(base->second);
+        }
+        if (handle == nullptr) {
+            return nullptr;
+        }
+
         return std::make_shared<Library>(handle);
     }
 
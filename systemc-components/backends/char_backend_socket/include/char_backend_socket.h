@@ -26,10 +26,12 @@
 #include <sys/ioctl.h>
 #include <signal.h>
 #include <netdb.h>
+#include <atomic>
 
 #include <scp/report.h>
 
 #include <async_event.h>
+#include <io_reactor.h>
 #include <uutils.h>
 #include <ports/biflow-socket.h>
 #include <module_factory_registery.h>
@@ -41,6 +43,9 @@ protected:
     cci::cci_param<bool> p_server;
     cci::cci_param<bool> p_nowait;
     cci::cci_param<bool> p_sigquit;
+    cci::cci_param<std::string> p_flush_policy;
+    cci::cci_param<uint32_t> p_flush_threshold;
+    cci::cci_param<uint32_t> p_flush_delay_us;
 
 private:
     SCP_LOGGER();
@@ -54,20 +59,20 @@ public:
 #pragma message("char_backend_socket not yet implemented for WIN32")
 #endif
 
-    int m_srv_socket;
-    int m_socket = -1;
-    uint8_t m_buf[256];
+    int m_srv_socket = -1;
+    std::atomic<int> m_socket{ -1 };
+    gs::IoWriter m_out;
 
-    void sock_setup()
+    void sock_setup(int fd)
     {
-        int flags = fcntl(m_socket, F_GETFL, 0);
+        int flags = fcntl(fd, F_GETFL, 0);
         flags |= O_NONBLOCK;
-        if (::fcntl(m_socket, F_SETFL, flags) != 0) {
+        if (::fcntl(fd, F_SETFL, flags) != 0) {
             SCP_ERR(()) << "setting socket in non-blocking mode failed: " << std::strerror(errno);
         }
 
         flags = 1;
-        if (::setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &flags, sizeof(flags))) {
+        if (::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flags, sizeof(flags))) {
             SCP_WARN(()) << "setting up TCP_NODELAY option failed: " << std::strerror(errno);
         }
     }
@@ -86,13 +91,22 @@ public:
 
         SCP_DEBUG(()) << "IP: " << ip << ", PORT: " << port;
 
+        gs::IoWriter::FlushPolicy policy;
+        if (!gs::IoWriter::policy_from_string(p_flush_policy, policy)) {
+            SCP_ERR(()) << "unknown flush policy '" << p_flush_policy.get_value()
+                        << "', expecting immediate, line or deferred";
+            policy = gs::IoWriter::FlushPolicy::IMMEDIATE;
+        }
+        m_out.set_policy(policy, p_flush_threshold, std::chrono::microseconds(p_flush_delay_us));
+
         if (p_server) {
             setup_tcp_server(ip, port);
+            if (m_srv_socket >= 0) {
+                gs::IoReactor::get().watch(m_srv_socket, [this]() { accept_connection(); });
+            }
         } else {
-            setup_tcp_client(ip, port);
+            connect_client();
         }
-
-        new std::thread(&char_backend_socket::rcv_thread, this);
     }
 
     char_backend_socket(sc_core::sc_module_name name)
@@ -101,6 +115,9 @@ public:
         , p_server("server", true, "type of socket: true if server - false if client")
         , p_nowait("nowait", true, "setting socket in non-blocking mode")
         , p_sigquit("sigquit", false, "Interpret 0x1c in the data stream as a sigquit")
+        , p_flush_policy("flush_policy", "immediate", "When to write out data: immediate, line or deferred")
+        , p_flush_threshold("flush_threshold", 4096, "Write out once this many bytes are pending (line, deferred)")
+        , p_flush_delay_us("flush_delay_us", 1000, "Write out pending data after this delay (line, deferred)")
         , socket("biflow_socket")
     {
         SCP_TRACE(()) << "char_backend_socket constructor";
@@ -109,59 +126,68 @@ public:
 
     void end_of_elaboration() { socket.can_receive_any(); }
 
-    void* rcv_thread()
+    /* Called by the reactor when a client connects to the server socket */
+    void accept_connection()
     {
-        for (;;) {
-            if (p_server && m_socket < 0) {
-                socklen_t addr_len = sizeof(struct sockaddr_in);
-                struct sockaddr_in client_addr;
-                int flag;
-
-                m_socket = ::accept(m_srv_socket, (struct sockaddr*)&client_addr, &addr_len);
-                if (m_socket < 0) {
-                    continue;
-                }
-                sock_setup();
-
-                char str[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &(client_addr.sin_addr), str, INET_ADDRSTRLEN);
-                int cport = ntohs(client_addr.sin_port);
-
-                SCP_DEBUG(()) << "incoming connection from  " << str << ":" << cport;
-            } else if (!p_server && m_socket < 0) {
-                SCP_DEBUG(())("Waiting for connection");
-                sleep(1);
-                setup_tcp_client(ip, port);
-                continue;
-            }
+        socklen_t addr_len = sizeof(struct sockaddr_in);
+        struct sockaddr_in client_addr;
 
-            struct pollfd fd;
-            int ret;
-            fd.fd = m_socket;
-            fd.events = POLLIN;
-            if (poll(&fd, 1, 1000) == 0) {
-                continue;
-            }
-            if (fd.revents > 0x4) {
-                close(m_socket);
-                m_socket = -1;
-                if (!p_nowait) {
-                    SCP_FATAL(())("Non waiting Socket closed");
-                } else {
-                    SCP_WARN(())("Socket closed, will wait for new connection");
-                }
-                continue;
-            }
-            ret = ::read(m_socket, m_buf, 1); // We can only guarantee 1 read will work
-            if (ret > 0) {
-                for (int i = 0; i < ret; i++) {
-                    unsigned char c = m_buf[i];
-                    if (p_sigquit && c == 0x1c) {
-                        sc_core::sc_stop();
-                    }
-                    socket.enqueue(c);
-                }
-            }
+        int fd = ::accept(m_srv_socket, (struct sockaddr*)&client_addr, &addr_len);
+        if (fd < 0) {
+            return;
+        }
+
+        char str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(client_addr.sin_addr), str, INET_ADDRSTRLEN);
+        int cport = ntohs(client_addr.sin_port);
+
+        SCP_DEBUG(()) << "incoming connection from  " << str << ":" << cport;
+
+        /* Only one connection at a time, further clients wait in the backlog */
+        gs::IoReactor::get().remove(m_srv_socket);
+        attach(fd);
+    }
+
+    void connect_client()
+    {
+        if (!setup_tcp_client(ip, port)) {
+            SCP_DEBUG(())("Waiting for connection");
+            gs::IoReactor::get().call_after(std::chrono::seconds(1), [this]() { connect_client(); });
+        }
+    }
+
+    void attach(int fd)
+    {
+        sock_setup(fd);
+        m_out.set_fd(fd);
+        m_socket = fd;
+        gs::IoReactor::get().add_reader(
+            fd, [this](const uint8_t* data, size_t len) { receive(data, len); }, [this]() { connection_closed(); });
+    }
+
+    void receive(const uint8_t* data, size_t len)
+    {
+        if (p_sigquit && memchr(data, 0x1c, len)) {
+            sc_core::sc_stop();
+        }
+        socket.enqueue(data, len);
+    }
+
+    /* Called by the reactor when the other end went away */
+    void connection_closed()
+    {
+        m_out.set_fd(-1);
+        close_sock();
+        if (!p_nowait) {
+            SCP_FATAL(())("Non waiting Socket closed");
+        } else {
+            SCP_WARN(())("Socket closed, will wait for new connection");
+        }
+
+        if (p_server) {
+            gs::IoReactor::get().watch(m_srv_socket, [this]() { accept_connection(); });
+        } else {
+            gs::IoReactor::get().call_after(std::chrono::seconds(1), [this]() { connect_client(); });
         }
     }
 
@@ -175,26 +201,7 @@ public:
             sleep(1);
         }
 
-        uint8_t* data = txn.get_data_ptr();
-        for (int i = 0; i < txn.get_streaming_width(); i++) {
-            do {
-                if ((::write(m_socket, &data[i], 1)) != 1) {
-                    if (errno == EAGAIN) {
-                        SCP_WARN(())("(Blocking) write did not complete (EAGAIN)");
-                        sleep(1);
-                    } else {
-                        if (p_nowait) {
-                            SCP_WARN(())("(Non blocking) socket closed");
-                            return;
-                        } else {
-                            SCP_FATAL(())("(Blocking) socket closed.");
-                        }
-                    }
-                } else {
-                    break; // Write completed normally
-                }
-            } while (true);
-        }
+        m_out.write(txn.get_data_ptr(), txn.get_streaming_width());
     }
 
     void setup_tcp_server(std::string ip, std::string port)
@@ -239,23 +246,22 @@ public:
             SCP_ERR(()) << "listen failed: " << std::strerror(errno);
             return;
         }
-        // the connection will be done in the rcv_thread
+        // the connection will be done in accept_connection
     }
 
-    void setup_tcp_client(std::string ip, std::string port)
+    bool setup_tcp_client(std::string ip, std::string port)
     {
-        int flag = 1;
         int status;
         struct addrinfo hints;
         struct addrinfo* servinfo;
 
         SCP_INFO(()) << "setting up TCP client connection to " << ip << ":" << port;
 
-        m_socket = ::socket(AF_INET, SOCK_STREAM, 0);
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
 
-        if (m_socket == -1) {
+        if (fd == -1) {
             SCP_ERR(()) << "socket failed: " << std::strerror(errno);
-            return;
+            return false;
         }
 
         memset(&hints, 0, sizeof(hints));
@@ -263,28 +269,42 @@ public:
         hints.ai_socktype = SOCK_STREAM;
 
         status = getaddrinfo(ip.c_str(), port.c_str(), &hints, &servinfo);
-        if (status == -1) {
-            SCP_ERR(()) << "getaddrinfo failed: " << std::strerror(errno);
-            close_sock();
+        if (status != 0) {
+            SCP_ERR(()) << "getaddrinfo failed: " << gai_strerror(status);
+            ::close(fd);
+            return false;
         }
 
-        if (::connect(m_socket, servinfo->ai_addr, servinfo->ai_addrlen) == -1) {
+        if (::connect(fd, servinfo->ai_addr, servinfo->ai_addrlen) == -1) {
             SCP_ERR(()) << "connect failed: " << std::strerror(errno);
             freeaddrinfo(servinfo);
-            close_sock();
+            ::close(fd);
+            return false;
         }
         freeaddrinfo(servinfo);
 
-        sock_setup();
-
-        return;
+        attach(fd);
+        return true;
     }
 
     void close_sock()
     {
+        gs::IoReactor::get().remove(m_socket);
         ::close(m_socket);
         m_socket = -1;
     }
+
+    ~char_backend_socket()
+    {
+        if (m_srv_socket >= 0) {
+            gs::IoReactor::get().remove(m_srv_socket);
+            ::close(m_srv_socket);
+        }
+        if (m_socket >= 0) {
+            m_out.set_fd(-1);
+            close_sock();
+        }
+    }
 };
 extern "C" void module_register();
 #endif
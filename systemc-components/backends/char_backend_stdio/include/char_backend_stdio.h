@@ -14,17 +14,14 @@
 #include <unistd.h>
 
 #include <async_event.h>
+#include <io_reactor.h>
 #include <uutils.h>
 #include <ports/biflow-socket.h>
 #include <module_factory_registery.h>
 #include <queue>
 #include <signal.h>
 #include <termios.h>
-#include <poll.h>
 #include <regex>
-#include <atomic>
-
-#define RCV_POLL_TIMEOUT_MS 300
 
 class char_backend_stdio : public sc_core::sc_module
 {
@@ -34,10 +31,8 @@ protected:
     cci::cci_param<std::string> p_highlight;
 
 private:
-    std::atomic_bool m_running;
-    std::thread rcv_thread_id;
-    pthread_t rcv_pthread_id = 0;
-    std::atomic<bool> c_flag;
+    bool m_reading = false;
+    cci::cci_broker_handle m_broker;
     SCP_LOGGER();
     std::string line;
     std::string ecmd;
@@ -77,6 +72,25 @@ public:
     {
         return ecmd.substr(cmd.length(), ecmd.find_first_of("\n") - cmd.length());
     }
+    /* The value is parsed as JSON, or taken as a string if it is not valid JSON */
+    void set_param(const std::string& arg)
+    {
+        size_t sep = arg.find(' ');
+        std::string name = arg.substr(0, sep);
+        std::string value = (sep == std::string::npos) ? "" : arg.substr(sep + 1);
+
+        auto h = m_broker.get_param_handle(name);
+        if (!h.is_valid()) {
+            SCP_WARN(())("Expect can't set {}, no such parameter", name);
+            return;
+        }
+        cci::cci_value v;
+        if (!v.json_deserialize(value)) {
+            v = cci::cci_value(value);
+        }
+        SCP_WARN(())("Expect setting {} to {}", name, value);
+        h.set_cci_value(v);
+    }
     void process()
     {
         processing = true;
@@ -89,6 +103,7 @@ public:
         const std::string sendstr = "send ";
         const std::string waitstr = "wait ";
         const std::string exitstr = "exit";
+        const std::string setstr = "set ";
         do {
             if (ecmd.substr(0, expectstr.length()) == expectstr) {
                 std::string str = getecmdstr(expectstr);
@@ -111,6 +126,12 @@ public:
                 if (ecmd != "") ecmd.erase(0, 1);
                 continue;
             }
+            if (ecmd.substr(0, setstr.length()) == setstr) {
+                set_param(getecmdstr(setstr));
+                ecmd.erase(0, ecmd.find_first_of("\n"));
+                if (ecmd != "") ecmd.erase(0, 1);
+                continue;
+            }
             if (ecmd.substr(0, waitstr.length()) == waitstr) {
                 SCP_WARN(())("Expect waiting {}s", getecmdstr(waitstr));
                 processing = false;
@@ -136,6 +157,8 @@ public:
      *      expect [string] : dont process any more commands until the "string" is seen on the output (STDIO)
      *      send [string]   : send "string" to the input buffer (NB this will happen whether of not read_write is set)
      *      wait [float]    : Wait for "float" (simulated) seconds, until processing continues.
+     *      set [param] [value] : Set the CCI parameter "param" (full name) to "value", for instance to
+     *                        change a sync_policy once the guest has booted.
      *      exit            : Cause the simulation to terminate normally.
      */
     SC_HAS_PROCESS(char_backend_stdio);
@@ -144,9 +167,8 @@ public:
         , p_read_write("read_write", true, "read_write if true start rcv_thread")
         , p_expect("expect", "", "string of expect commands")
         , p_highlight("ansi_highlight", "", "ANSI highlight code to use for output, default bold")
+        , m_broker(cci::cci_get_broker())
         , socket("biflow_socket")
-        , m_running(true)
-        , c_flag(false)
     {
         SCP_TRACE(()) << "CharBackendStdio constructor";
 
@@ -159,14 +181,21 @@ public:
             SCP_WARN(())("Processing expect string {}", ecmd);
         }
 
+        if (p_read_write) {
+            m_reading = true;
+            gs::IoReactor::get().add_reader(
+                STDIN_FILENO, [this](const uint8_t* data, size_t len) { socket.enqueue(data, len); },
+                [this]() { SCP_DEBUG(()) << "end of input"; });
+        }
+
         gs::SigHandler::get().register_on_exit_cb(tty_reset);
         gs::SigHandler::get().add_sig_handler(SIGINT, gs::SigHandler::Handler_CB::PASS);
         gs::SigHandler::get().register_handler([&](int signo) {
-            if (signo == SIGINT) {
-                c_flag = true;
+            /* Handlers run on the signal handler thread, enqueue is thread safe */
+            if (signo == SIGINT && m_reading) {
+                enqueue('\x03');
             }
         });
-        if (p_read_write) rcv_thread_id = std::thread(&char_backend_stdio::rcv_thread, this);
 
         socket.register_b_transport(this, &char_backend_stdio::writefn);
     }
@@ -174,47 +203,17 @@ public:
     void end_of_elaboration() { socket.can_receive_any(); }
 
     void enqueue(char c) { socket.enqueue(c); }
-    void rcv_thread()
-    {
-        int fd = STDIN_FILENO;
-        struct pollfd rcv_monitor;
-        rcv_monitor.fd = fd;
-        rcv_monitor.events = POLLIN;
-
-        while (m_running) {
-            int ret = poll(&rcv_monitor, 1, RCV_POLL_TIMEOUT_MS);
-            if ((ret == -1 && errno == EINTR) || (ret == 0) /*timeout*/) {
-                if (c_flag) {
-                    c_flag = false;
-                    enqueue('\x03');
-                }
-                continue;
-            } else if (rcv_monitor.revents & POLLIN) {
-                char c;
-                int r = read(fd, &c, 1);
-                if (r == 1) {
-                    enqueue(c);
-                }
-                if (r == 0) {
-                    break;
-                }
-            } else {
-                break;
-            }
-        }
-    }
-
     void writefn(tlm::tlm_generic_payload& txn, sc_core::sc_time& t)
     {
         uint8_t* data = txn.get_data_ptr();
         if (!p_highlight.get_value().empty()) std::cout << p_highlight.get_value();
+        fwrite(data, 1, txn.get_streaming_width(), stdout);
         for (int i = 0; i < txn.get_streaming_width(); i++) {
-            putchar(data[i]);
             if ((char)data[i] == '\n') {
                 expect_process();
                 line = "";
             } else {
-                line = line + (char)data[i];
+                line += (char)data[i];
             }
         }
         if (!p_highlight.get_value().empty()) std::cout << "\x1B[0m"; // ANSI color reset.
@@ -238,8 +237,7 @@ public:
 
     ~char_backend_stdio()
     {
-        m_running = false;
-        if (rcv_thread_id.joinable()) rcv_thread_id.join();
+        if (m_reading) gs::IoReactor::get().remove(STDIN_FILENO);
         tty_reset();
     }
 };
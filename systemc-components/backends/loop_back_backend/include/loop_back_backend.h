@@ -44,9 +44,9 @@ public:
         uint8_t* data = txn.get_data_ptr();
         sc_assert(data != NULL);
         for (unsigned int i = 0; i < txn.get_streaming_width(); i++) {
-            socket.enqueue(static_cast<unsigned char>(data[i]));
             SCP_DEBUG(())("loop_back_backend: sending {}", static_cast<char>(data[i]));
         }
+        socket.enqueue(data, txn.get_streaming_width());
     }
 
     ~loop_back_backend() {}
@@ -25,9 +25,7 @@ public:
     static void recieve(void* opaque, const uint8_t* buf, int size)
     {
         LegacyCharBackend* t = (LegacyCharBackend*)opaque;
-        for (int i = 0; i < size; i++) {
-            t->socket.enqueue(buf[i]);
-        }
+        t->socket.enqueue(buf, size);
     }
 
     void b_transport(tlm::tlm_generic_payload& txn, sc_core::sc_time& t)
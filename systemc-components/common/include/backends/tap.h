@@ -23,7 +23,7 @@ private:
     int m_fd;
 
     void open(std::string& tun);
-    void* rcv_thread();
+    void receive(const uint8_t* data, size_t len);
     void rcv();
     void close();
 
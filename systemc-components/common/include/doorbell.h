@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2022-2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _GREENSOCS_BASE_COMPONENTS_DOORBELL_H
+#define _GREENSOCS_BASE_COMPONENTS_DOORBELL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace gs {
+
+/*
+ * Sleep while word holds expected, until woken up or timeout_ms elapsed (may return spuriously).
+ * Elsewhere than on Linux, this is a short sleep.
+ */
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected, int timeout_ms)
+{
+#ifdef __linux__
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+    if (word.load() == expected) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+#endif
+}
+
+/* Wake up all the threads sleeping on word */
+inline void futex_wake(std::atomic<uint32_t>& word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+/**
+ * @brief Wake-up signal between threads, or processes when placed in shared memory
+ *
+ * @details A sequence number bumped on every ring. On Linux waiters sleep on it
+ * with a (shared) futex, elsewhere they poll. It only holds plain atomics, so it
+ * has no constructor: call init() before use.
+ */
+class Doorbell
+{
+    static constexpr int SPIN_COUNT = 2000;
+    static constexpr int WAIT_TIMEOUT_MS = 500;
+
+    std::atomic<uint32_t> m_seq;
+    std::atomic<uint32_t> m_waiters;
+
+public:
+    void init()
+    {
+        m_seq.store(0);
+        m_waiters.store(0);
+    }
+
+    uint32_t value() const { return m_seq.load(); }
+
+    void ring()
+    {
+        m_seq.fetch_add(1);
+        if (m_waiters.load()) {
+            futex_wake(m_seq);
+        }
+    }
+
+    /* Block until the doorbell rang since `seen` was read, or a timeout */
+    void wait(uint32_t seen)
+    {
+        m_waiters.fetch_add(1);
+        if (m_seq.load() == seen) {
+            futex_wait(m_seq, seen, WAIT_TIMEOUT_MS);
+        }
+        m_waiters.fetch_sub(1);
+    }
+
+    template <typename Pred>
+    void wait_until(Pred ready)
+    {
+        for (int i = 0; i < SPIN_COUNT; i++) {
+            if (ready()) return;
+        }
+        for (;;) {
+            uint32_t seen = value();
+            if (ready()) return;
+            wait(seen);
+        }
+    }
+};
+
+} // namespace gs
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _GREENSOCS_BASE_COMPONENTS_HOST_AFFINITY_H
+#define _GREENSOCS_BASE_COMPONENTS_HOST_AFFINITY_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gs {
+
+/**
+ * @brief Parse a list of host cores, such as "0-3,8,10-11"
+ * @return false if the list is malformed. An empty list is valid.
+ */
+bool parse_host_cpus(const std::string& list, std::vector<int>& cpus);
+
+/* Format cores the way parse_host_cpus reads them */
+std::string format_host_cpus(const std::vector<int>& cpus);
+
+/**
+ * @brief Placement of the simulation threads on host cores
+ *
+ * @details Threads place themselves: place() restricts the calling thread to the given cores, or
+ * when none are given, to the cores that are not reserved. Reserved cores are kept for the threads
+ * explicitly placed on them. The placement of each thread is recorded, report() gives the affinity
+ * and the core each of them last ran on, as seen by the host.
+ *
+ * Threads that never place themselves inherit the affinity of the thread that started them, which
+ * may be pinned: place_unplaced() moves them back to the cores that are not reserved.
+ *
+ * Placement is only supported on Linux, elsewhere threads are recorded but not moved.
+ */
+class HostPlacement
+{
+public:
+    static HostPlacement& get();
+
+    /* Keep threads that are not explicitly placed off these cores */
+    void reserve(const std::vector<int>& cpus);
+
+    /**
+     * @brief Restrict the calling thread to cpus, and record it as name
+     * @return 0, or an errno value if the thread could not be moved
+     */
+    int place(const std::string& name, const std::vector<int>& cpus);
+
+    /**
+     * @brief Move the threads of the process that were never placed off the reserved cores
+     *
+     * @details Threads inherit the affinity of the thread that starts them, so threads started
+     * after their parent was pinned (e.g. QEMU helper threads started lazily from the SystemC
+     * thread) share its cores. This gives them the cores that are not reserved back, and records
+     * them as name. Does nothing when no core is reserved.
+     * @return the number of threads moved
+     */
+    int place_unplaced(const std::string& name);
+
+    std::string report();
+
+private:
+    struct entry {
+        std::string name;
+        long tid;
+        /* To tell a reused tid apart */
+        long long start_time;
+        std::string requested;
+        int error;
+        /* Recorded by place_unplaced(), forgotten once the thread is gone */
+        bool unplaced = false;
+    };
+
+    std::mutex m_mutex;
+    std::vector<int> m_reserved;
+    /* Cores of the process when reserve() was called, but the reserved ones */
+    std::vector<int> m_unreserved;
+    std::vector<entry> m_entries;
+
+    HostPlacement() = default;
+    HostPlacement(const HostPlacement&) = delete;
+    HostPlacement& operator=(const HostPlacement&) = delete;
+};
+
+} // namespace gs
+
+#endif
@@ -21,7 +21,11 @@ namespace gs {
 class inlinesync : public sc_core::sc_module
 {
     runonsysc onSystemC;
-    void run_on_sysc(std::function<void()> job) { onSystemC.run_on_sysc(job, true); }
+    template <typename Fn>
+    void run_on_sysc(Fn&& job)
+    {
+        onSystemC.run_on_sysc(std::forward<Fn>(job), true);
+    }
 
 public:
     tlm_utils::simple_target_socket<inlinesync, DEFAULT_TLM_BUSWIDTH> target_socket;
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _GREENSOCS_BASE_COMPONENTS_IO_REACTOR_H
+#define _GREENSOCS_BASE_COMPONENTS_IO_REACTOR_H
+
+#ifndef WIN32
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gs {
+
+/**
+ * @brief Process wide I/O reactor
+ *
+ * @details A single thread waits (with epoll on Linux, poll elsewhere) on the file descriptors
+ * of all the backends, and runs their callbacks. Callbacks run on the reactor thread, without any
+ * reactor lock held, so they may register or remove file descriptors. They must not block.
+ *
+ * File descriptors are owned by the caller, and must be removed before being closed.
+ */
+class IoReactor
+{
+public:
+    using read_cb = std::function<void(const uint8_t* data, size_t len)>;
+    using event_cb = std::function<void()>;
+
+    static constexpr size_t DEFAULT_READ_SIZE = 4096;
+
+    static IoReactor& get();
+
+    /**
+     * @brief Watch fd for input, on_readable is called whenever it is readable
+     */
+    void watch(int fd, event_cb on_readable);
+
+    /**
+     * @brief Watch fd for input, on_read is called with the data of each read() (up to buf_size
+     * bytes). on_close is called once the fd reached end of file or an error, at which point it is
+     * no longer watched.
+     *
+     * Non-blocking fds are drained on each wake up, blocking ones are read once.
+     */
+    void add_reader(int fd, read_cb on_read, event_cb on_close = nullptr, size_t buf_size = DEFAULT_READ_SIZE);
+
+    /**
+     * @brief Stop watching fd. Once this returns, none of its callbacks are running, or will run.
+     */
+    void remove(int fd);
+
+    /**
+     * @brief Call on_writable once fd becomes writable (used to complete partial writes)
+     */
+    void watch_writable(int fd, event_cb on_writable);
+    void unwatch_writable(int fd);
+
+    /**
+     * @brief Run fn on the reactor thread after delay
+     */
+    void call_after(std::chrono::microseconds delay, event_cb fn);
+
+    bool in_reactor_thread() const { return std::this_thread::get_id() == m_thread.get_id(); }
+
+    ~IoReactor();
+
+private:
+    enum { READABLE = 1, WRITABLE = 2 };
+
+    /* Callbacks are shared, so that the reactor thread can hold on to them without copying */
+    using shared_cb = std::shared_ptr<const event_cb>;
+
+    struct entry {
+        shared_cb on_readable;
+        shared_cb on_writable;
+        /* Regular files and such can't be waited for, they are always ready */
+        bool always_ready = false;
+        bool registered = false;
+    };
+    using clock = std::chrono::steady_clock;
+
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    std::map<int, std::shared_ptr<entry>> m_entries;
+    std::multimap<clock::time_point, event_cb> m_timers;
+    int m_busy_fd = -1;
+    bool m_stop = false;
+    int m_wake[2] = { -1, -1 };
+    int m_epfd = -1;
+    std::thread m_thread;
+
+    IoReactor();
+    IoReactor(const IoReactor&) = delete;
+    IoReactor& operator=(const IoReactor&) = delete;
+
+    void wake();
+    void update(int fd, entry& e);
+    int next_timeout();
+    void wait(int timeout_ms, std::vector<std::pair<int, int>>& ready);
+    void dispatch(int fd, int what);
+    void run_timers();
+    void run();
+};
+
+/**
+ * @brief Buffered output to a file descriptor, flushed according to a policy
+ *
+ * @details Data is appended to a list of chunks, written with a single writev() per flush. If the
+ * fd is not ready (EAGAIN), the rest is written by the reactor once it is. Writers are blocked
+ * once more than max_pending bytes are waiting.
+ *
+ * Flush policies:
+ * - IMMEDIATE: on every write (data only accumulates while the fd is not ready)
+ * - LINE: on a new line, once threshold bytes are pending, or delay after the first pending byte
+ * - DEFERRED: once threshold bytes are pending, or delay after the first pending byte
+ */
+class IoWriter
+{
+public:
+    enum class FlushPolicy { IMMEDIATE, LINE, DEFERRED };
+
+    static constexpr size_t DEFAULT_THRESHOLD = 4096;
+    static constexpr size_t DEFAULT_MAX_PENDING = 1024 * 1024;
+
+    /* Parse "immediate", "line" or "deferred", returns false if str is none of these */
+    static bool policy_from_string(const std::string& str, FlushPolicy& policy);
+
+    IoWriter(FlushPolicy policy = FlushPolicy::IMMEDIATE, size_t threshold = DEFAULT_THRESHOLD,
+             std::chrono::microseconds delay = std::chrono::milliseconds(1),
+             size_t max_pending = DEFAULT_MAX_PENDING);
+    ~IoWriter();
+
+    void set_policy(FlushPolicy policy, size_t threshold, std::chrono::microseconds delay);
+
+    /* Write to fd from now on (-1 to stop writing), pending data is dropped */
+    void set_fd(int fd);
+
+    /* Thread safe */
+    void write(const uint8_t* data, size_t len);
+    void flush();
+
+    size_t pending();
+    /* errno of the last failed write, 0 if none */
+    int error();
+
+private:
+    static constexpr size_t CHUNK_SIZE = 4096;
+
+    /* Shared with the reactor callbacks, which may outlive the writer */
+    struct state {
+        std::mutex mutex;
+        std::condition_variable drained;
+        int fd = -1;
+        bool is_socket = false;
+        FlushPolicy policy;
+        size_t threshold;
+        std::chrono::microseconds delay;
+        size_t max_pending;
+
+        std::deque<std::vector<uint8_t>> chunks;
+        size_t head_off = 0; /* bytes of the first chunk already written */
+        size_t pending = 0;
+        bool wait_writable = false;
+        bool timer_armed = false;
+        int error = 0;
+
+        void drop();
+        void flush_locked(const std::shared_ptr<state>& self);
+        void arm_timer(const std::shared_ptr<state>& self);
+    };
+    std::shared_ptr<state> m_state;
+};
+
+} // namespace gs
+
+#endif
+
+#endif
@@ -13,5 +13,6 @@
 #include "qkmulti-adaptive.h"
 #include "qkmulti-unconstrained.h"
 #include "qkmulti-freerunning.h"
+#include "qk_controller.h"
 #include "inlinesync.h"
 #include "runonsysc.h"
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _MACS_OFFLOAD_H_
+#define _MACS_OFFLOAD_H_
+
+#include <cstddef>
+#include <functional>
+#include <inttypes.h>
+
+#include <macs/payload.h>
+
+/*
+ * Checksum and segmentation offload, shared by the MAC models.
+ *
+ * Sums are computed on 16-bit words in host byte order and stored back the
+ * same way, which gives the right bytes on the wire whatever the host
+ * endianness (RFC 1071).
+ */
+namespace net_offload {
+
+enum class ChecksumLevel {
+    NONE,
+    /* IPv4 header checksum only */
+    IP_HEADER,
+    /* IPv4 header and TCP/UDP checksums, the driver already put the pseudo-header sum in the checksum field */
+    IP_HEADER_AND_PAYLOAD,
+    /* IPv4 header and TCP/UDP checksums, including the pseudo-header */
+    FULL,
+};
+
+/* Accumulate the one's complement sum of len bytes, starting at an even offset of the packet, into sum */
+uint64_t csum_add(const uint8_t* buf, size_t len, uint64_t sum = 0);
+
+/* Fold a sum to 16 bits and invert it, giving the value to store in a checksum field */
+uint16_t csum_fold(uint64_t sum);
+
+/*
+ * Insert the checksums of an Ethernet frame (optionally VLAN tagged) carrying
+ * IPv4 or IPv6, as a MAC would on transmit. Frames the offload does not apply
+ * to are left untouched. Returns true if a checksum was inserted.
+ */
+bool insert_checksums(uint8_t* frame, size_t len, ChecksumLevel level);
+
+/*
+ * TCP segmentation offload: split a TCP frame into frames carrying at most
+ * mss bytes of payload each, with sequence numbers, lengths, IPv4 IDs, flags
+ * and checksums fixed up. Each segment is built in seg, then passed to emit.
+ * Frames that do not need segmenting are emitted as a single checksummed
+ * copy. Returns the number of segments emitted, 0 if the frame could not be
+ * segmented (not TCP, or seg is too small).
+ */
+size_t tso_segment(const uint8_t* frame, size_t len, size_t mss, Payload& seg,
+                   const std::function<void(Payload&)>& emit);
+
+} // namespace net_offload
+
+#endif
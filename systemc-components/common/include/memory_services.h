@@ -25,6 +25,7 @@
 #include <uutils.h>
 #include <cerrno>
 #include <cstring>
+#include <functional>
 
 namespace gs {
 // Singleton class that handles memory allocation, alignment, file mapping and shared memory
@@ -42,6 +43,8 @@ private:
 
     void die_sys_api(int error, const char* memname, const std::string& die_msg);
 
+    bool for_each_resident_run(uint8_t* ptr, uint64_t size, const std::function<void(uint64_t, uint64_t)>& cb);
+
     struct shmem_info {
         uint8_t* base;
         size_t size;
@@ -96,6 +99,41 @@ public:
     uint8_t* map_mem_join(const char* memname, size_t size);
 
     uint8_t* alloc(uint64_t size);
+
+    /**
+     * Reserve size bytes of address space without committing memory. Pages
+     * are committed by the kernel on first touch and read as zero until then.
+     */
+    uint8_t* map_sparse(uint64_t size);
+
+    /**
+     * Give the pages of a map_sparse() region back to the kernel, they will
+     * read as zero again.
+     */
+    void release_pages(uint8_t* ptr, uint64_t size);
+
+    /**
+     * Number of bytes of a mapped region currently resident in host memory.
+     */
+    uint64_t resident_size(uint8_t* ptr, uint64_t size);
+
+    /**
+     * Copy the resident pages of a map_sparse() region into a new memfd, and
+     * remap the region as a private, copy-on-write, view of it.
+     * Returns the memfd, or -1 if this is not supported on this host.
+     */
+    int snapshot_sparse(uint8_t* ptr, uint64_t size);
+
+    /**
+     * Remap a region as a private view of a snapshot memfd, dropping every
+     * page dirtied since.
+     */
+    void map_snapshot(uint8_t* ptr, uint64_t size, int fd);
+
+    /**
+     * Remap a region as fresh map_sparse() memory, reading as zero.
+     */
+    void remap_sparse(uint8_t* ptr, uint64_t size);
 };
 } // namespace gs
 #endif
\ No newline at end of file
@@ -30,6 +30,10 @@
  *
  * NOTE: Hence, all sockets start DETACHED, and will only be attached if/when a non-zero absolute
  * value is received from the other side.
+ *
+ * Data waiting to be sent is held in a ring buffer of 'queue_size' items, which is only grown (doubled)
+ * if the backlog overflows it. Everything that can be sent is sent in one transaction (two if the data
+ * wraps around the end of the ring), using streaming_width (and data_length) as the number of items.
  */
 
 #ifndef GS_BIFLOW_SOCKET_H
@@ -42,7 +46,11 @@
 #include <tlm_utils/simple_initiator_socket.h>
 #include <tlm_sockets_buswidth.h>
 #include <async_event.h>
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 namespace gs {
 
@@ -75,33 +83,66 @@ class biflow_socket : public sc_core::sc_module, public biflow_bindable
 
     uint32_t m_can_send = 0;
     bool m_infinite = false;
-    std::vector<T> m_queue;
+    /* Ring of queued items, m_head and m_tail only ever increase, the capacity is a power of 2 */
+    std::vector<T> m_ring;
+    uint64_t m_head = 0;
+    uint64_t m_tail = 0;
     gs::async_event m_send_event;
     std::mutex m_mutex;
     std::unique_ptr<tlm::tlm_generic_payload> m_txn;
+    /* Reused for every send, set up from the default transaction when there is one */
+    tlm::tlm_generic_payload m_send_txn;
 
     struct ctrl {
         enum { DELTA_CHANGE, ABSOLUTE_VALUE, INFINITE } cmd;
         uint32_t can_send;
     };
 
+    size_t queued() const { return m_head - m_tail; }
+
+    static size_t round_up_pow2(size_t n)
+    {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    /* Grow the ring so that at least `needed` items fit, keeping the queued items in order */
+    void grow(size_t needed)
+    {
+        std::vector<T> ring(round_up_pow2(needed));
+        size_t n = queued();
+        for (size_t i = 0; i < n; i++) {
+            ring[i] = m_ring[(m_tail + i) & (m_ring.size() - 1)];
+        }
+        SCP_DEBUG(())("Send queue grown to {} items", ring.size());
+        m_ring.swap(ring);
+        m_tail = 0;
+        m_head = n;
+    }
+
+    /* Send `len` contiguous items, starting at the tail of the ring */
+    void send_chunk(size_t len)
+    {
+        m_send_txn.set_data_ptr(reinterpret_cast<unsigned char*>(&m_ring[m_tail & (m_ring.size() - 1)]));
+        m_send_txn.set_data_length(len);
+        m_send_txn.set_streaming_width(len);
+        m_send_txn.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+        sc_core::sc_time delay = sc_core::SC_ZERO_TIME;
+        output_socket->b_transport(m_send_txn, delay);
+        m_tail += len;
+    }
+
     void sendall()
     {
         std::lock_guard<std::mutex> guard(m_mutex);
-        tlm::tlm_generic_payload txn;
 
-        uint64_t sending = (m_infinite || (m_can_send > m_queue.size())) ? m_queue.size() : m_can_send;
+        uint64_t sending = (m_infinite || (m_can_send > queued())) ? queued() : m_can_send;
         if (sending > 0) {
-            if (m_txn)
-                txn.deep_copy_from(*m_txn);
-            else
-                txn.set_data_length(sending);
-            txn.set_streaming_width(sending);
-            txn.set_data_ptr(&(m_queue[0]));
-            sc_core::sc_time delay = sc_core::SC_ZERO_TIME;
-            output_socket->b_transport(txn, delay);
-            m_queue.erase(m_queue.begin(), m_queue.begin() + sending);
-            m_can_send -= sending;
+            size_t first = std::min<size_t>(sending, m_ring.size() - (m_tail & (m_ring.size() - 1)));
+            send_chunk(first);
+            if (sending > first) send_chunk(sending - first);
+            if (!m_infinite) m_can_send -= sending;
         }
     }
     void initiator_ctrl(tlm::tlm_generic_payload& txn, sc_core::sc_time& t)
@@ -150,6 +191,8 @@ class biflow_socket : public sc_core::sc_module, public biflow_bindable
     bool m_bound = false;
 
 public:
+    cci::cci_param<uint32_t> p_queue_size;
+
     void new_bind(biflow_bindable& other)
     {
         if (m_bound) SCP_ERR(())("Socket already bound, may only be bound once");
@@ -177,6 +220,7 @@ public:
      */
     biflow_socket(sc_core::sc_module_name name)
         : sc_core::sc_module(name)
+        , p_queue_size("queue_size", 1024, "Initial size of the send queue, in items, grown if needed")
         , input_socket((std::string(name) + "_input_socket").c_str())
         , output_socket((std::string(name) + "_output_socket").c_str())
         , input_control_socket((std::string(name) + "_input_socket_control").c_str())
@@ -185,6 +229,8 @@ public:
     {
         SCP_TRACE(()) << "constructor";
 
+        m_ring.resize(round_up_pow2(std::max<uint32_t>(p_queue_size, 1)));
+
         SC_METHOD(sendall);
         sensitive << m_send_event;
         dont_initialize();
@@ -278,20 +324,47 @@ public:
     void enqueue(T data)
     {
         SCP_TRACE(())("Sending {}", data);
+        enqueue(&data, 1);
+    }
+
+    /**
+     * @brief enqueue
+     * Enqueue len items to be sent, taking the lock and notifying the sender once for all of them
+     * NOTE: Thread safe.
+     * @param data
+     * @param len
+     */
+    void enqueue(const T* data, size_t len)
+    {
+        if (!len) return;
         std::lock_guard<std::mutex> guard(m_mutex);
-        m_queue.push_back(data);
+        if (queued() + len > m_ring.size()) grow(queued() + len);
+
+        size_t mask = m_ring.size() - 1;
+        size_t off = m_head & mask;
+        size_t first = std::min(len, m_ring.size() - off);
+        memcpy(&m_ring[off], data, first * sizeof(T));
+        memcpy(&m_ring[0], data + first, (len - first) * sizeof(T));
+        m_head += len;
         m_send_event.notify();
     }
 
     /**
      * @brief set_default_txn
-     * set transaction parameters (command, address and data_length)
+     * set transaction parameters (command, address and extensions)
      * @param txn
      */
     void set_default_txn(tlm::tlm_generic_payload& txn)
     {
+        std::lock_guard<std::mutex> guard(m_mutex);
         if (!m_txn) m_txn = std::make_unique<tlm::tlm_generic_payload>();
         m_txn->deep_copy_from(txn);
+
+        /* Don't let deep_copy_from write through the pointers of the previous send */
+        m_send_txn.set_data_ptr(nullptr);
+        m_send_txn.set_byte_enable_ptr(nullptr);
+        m_send_txn.free_all_extensions();
+        m_send_txn.deep_copy_from(*m_txn);
     }
 
     /**
@@ -313,7 +386,7 @@ public:
     void reset()
     {
         std::lock_guard<std::mutex> guard(m_mutex);
-        m_queue.clear();
+        m_tail = m_head;
     }
 };
 
@@ -341,17 +414,13 @@ class biflow_router_socket : public sc_core::sc_module, public biflow_multibinda
 
         void route_data(tlm::tlm_generic_payload& txn, sc_core::sc_time& t)
         {
-            T* ptr = (T*)txn.get_data_ptr();
+            const T* ptr = (const T*)txn.get_data_ptr();
             bool sent = false;
             for (auto& remote : m_remotes) {
                 if (&remote != this && (!m_sendto || m_sendto == &remote)) {
                     sent = true;
                     remote.socket.set_default_txn(txn);
-                    for (int i = 0; i < txn.get_data_length(); i++) {
-                        T data;
-                        memcpy(&data, &(ptr[i]), sizeof(T));
-                        remote.socket.enqueue(data);
-                    }
+                    remote.socket.enqueue(ptr, txn.get_data_length());
                 }
             }
             if (!sent) {
@@ -499,6 +568,7 @@ public:
     void can_receive_any() { main_socket.can_receive_any(); }
 
     void enqueue(T data) { main_socket.enqueue(data); }
+    void enqueue(const T* data, size_t len) { main_socket.enqueue(data, len); }
 
     void set_default_txn(tlm::tlm_generic_payload& txn) { main_socket.set_default_txn(txn); }
 
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef QK_CONTROLLER_H
+#define QK_CONTROLLER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <systemc>
+#include <tlm>
+#include <tlm_utils/tlm_quantumkeeper.h>
+#include <cci_configuration>
+#include <scp/report.h>
+
+#include <async_event.h>
+#include <qkmultithread.h>
+
+namespace gs {
+
+/**
+ * @brief Process wide synchronisation counters
+ *
+ * @details Updated with relaxed atomics by the quantum keepers and the models, from any thread, and
+ * sampled by the QuantumController.
+ */
+struct SyncStats {
+    /* Wall clock time the vCPU threads spent blocked in sync(), waiting for SystemC */
+    std::atomic<uint64_t> stall_ns{ 0 };
+    /* Accesses a vCPU had to hand over to the SystemC thread */
+    std::atomic<uint64_t> cross_thread_accesses{ 0 };
+    /* Interrupts raised towards QEMU */
+    std::atomic<uint64_t> irqs{ 0 };
+    /* Quantum set by the controller, in ns (0 while nothing controls it) */
+    std::atomic<uint64_t> quantum_ns{ 0 };
+    /* Instances running CPUs, and those of them whose CPUs are all halted with idle skipping */
+    std::atomic<int> cpu_instances{ 0 };
+    std::atomic<int> idle_instances{ 0 };
+
+    static SyncStats& get()
+    {
+        static SyncStats stats;
+        return stats;
+    }
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n = 1)
+    {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /* No CPU has work: nothing happens until an interrupt wakes one up */
+    bool all_cpus_halted() const
+    {
+        int n = cpu_instances.load();
+        return n > 0 && idle_instances.load() == n;
+    }
+
+    /* Called from any thread when an instance leaves the idle state */
+    void cpus_woke()
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        if (m_wake_cb) m_wake_cb();
+    }
+
+    void set_wake_cb(std::function<void()> cb)
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        m_wake_cb = cb;
+    }
+
+private:
+    std::mutex m_wake_mutex;
+    std::function<void()> m_wake_cb;
+};
+
+/**
+ * @brief Adjusts the global quantum at runtime
+ *
+ * @details Every p_period quanta, the controller looks at:
+ * - the stall ratio: the fraction of the vCPUs wall clock time spent waiting for SystemC in sync()
+ * - the cross-thread access rate, per quantum
+ * - the interrupt rate per quantum
+ * - the interrupt latency: how far the vCPUs run ahead of SystemC, which is how late they may see an
+ *   interrupt raised by SystemC
+ *
+ * I/O bound phases (many cross-thread accesses or interrupts, or a latency over p_max_irq_latency_ns)
+ * shrink the quantum, to keep the vCPUs and the devices close. Otherwise the quantum grows, faster
+ * while the vCPUs stall, since a larger quantum means fewer syncs. The quantum stays within
+ * [p_min_quantum_ns, p_max_quantum_ns].
+ *
+ * CPUs pick up the new quantum when they rearm their deadline timer.
+ *
+ * While all the CPUs are halted with idle skipping, the controller pauses until one of them wakes
+ * up, so that time keeps jumping to the next event.
+ */
+class QuantumController : public sc_core::sc_module
+{
+    SCP_LOGGER();
+
+    struct sample {
+        std::chrono::steady_clock::time_point wall;
+        uint64_t stall_ns;
+        uint64_t cross_thread_accesses;
+        uint64_t irqs;
+    };
+
+    std::vector<tlm_quantumkeeper_multithread*> m_qks;
+    sample m_last;
+    gs::async_event m_wake{ false };
+    bool m_paused = false;
+
+public:
+    cci::cci_param<uint64_t> p_min_quantum_ns;
+    cci::cci_param<uint64_t> p_max_quantum_ns;
+    cci::cci_param<unsigned int> p_period;
+    cci::cci_param<double> p_stall_high;
+    cci::cci_param<double> p_mmio_high;
+    cci::cci_param<double> p_mmio_low;
+    cci::cci_param<double> p_irq_high;
+    cci::cci_param<uint64_t> p_max_irq_latency_ns;
+
+    SC_HAS_PROCESS(QuantumController);
+    QuantumController(const sc_core::sc_module_name& name)
+        : sc_module(name)
+        , p_min_quantum_ns("min_quantum_ns", 10000, "Smallest quantum the controller may set (ns)")
+        , p_max_quantum_ns("max_quantum_ns", 10000000, "Largest quantum the controller may set (ns)")
+        , p_period("period", 10, "Number of quanta between two adjustments")
+        , p_stall_high("stall_high", 0.2, "Stall ratio over which the quantum grows faster")
+        , p_mmio_high("mmio_high", 100.0, "Cross-thread accesses per quantum over which the quantum shrinks")
+        , p_mmio_low("mmio_low", 10.0, "Cross-thread accesses per quantum under which the quantum may grow")
+        , p_irq_high("irq_high", 4.0, "Interrupts per quantum over which the quantum shrinks")
+        , p_max_irq_latency_ns("max_irq_latency_ns", 1000000,
+                               "Largest interrupt latency tolerated while interrupts are raised (ns)")
+    {
+        SCP_TRACE(())("QuantumController constructor");
+        SyncStats::get().set_wake_cb([this]() { m_wake.notify(); });
+        SC_THREAD(control);
+    }
+
+    ~QuantumController() { SyncStats::get().set_wake_cb(nullptr); }
+
+    /* Waiting for a CPU to wake up */
+    bool paused() const { return m_paused; }
+
+    /**
+     * @brief Next quantum, given the measures of the last period
+     *
+     * @param quantum_ns current quantum
+     * @param stall_ratio fraction of the vCPUs time spent waiting for SystemC
+     * @param mmio_rate cross-thread accesses per quantum
+     * @param irq_rate interrupts per quantum
+     * @param irq_latency_ns interrupt latency
+     */
+    uint64_t next_quantum(uint64_t quantum_ns, double stall_ratio, double mmio_rate, double irq_rate,
+                          uint64_t irq_latency_ns) const
+    {
+        bool irq_bound = irq_rate > 0 && (irq_rate > p_irq_high || irq_latency_ns > p_max_irq_latency_ns);
+
+        uint64_t next = quantum_ns;
+        if (mmio_rate > p_mmio_high || irq_bound) {
+            next = quantum_ns / 2;
+        } else if (mmio_rate < p_mmio_low) {
+            next = (stall_ratio > p_stall_high) ? quantum_ns * 2 : quantum_ns + quantum_ns / 4;
+        }
+        return std::min<uint64_t>(std::max<uint64_t>(next, p_min_quantum_ns), p_max_quantum_ns);
+    }
+
+private:
+    static uint64_t to_ns(const sc_core::sc_time& t) { return uint64_t(t.to_seconds() * 1e9); }
+
+    sample take_sample() const
+    {
+        SyncStats& s = SyncStats::get();
+        return { std::chrono::steady_clock::now(), s.stall_ns.load(std::memory_order_relaxed),
+                 s.cross_thread_accesses.load(std::memory_order_relaxed), s.irqs.load(std::memory_order_relaxed) };
+    }
+
+    /* How far the vCPUs run ahead of SystemC, on average */
+    uint64_t lead_ns() const
+    {
+        if (m_qks.empty()) return 0;
+
+        sc_core::sc_time lead = sc_core::SC_ZERO_TIME;
+        for (auto qk : m_qks) {
+            lead += qk->get_local_time();
+        }
+        return to_ns(lead) / m_qks.size();
+    }
+
+    void adjust(unsigned int quanta)
+    {
+        sample now = take_sample();
+        uint64_t wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now.wall - m_last.wall).count();
+        size_t nb_threads = std::max<size_t>(m_qks.size(), 1);
+
+        double stall_ratio = wall_ns ? double(now.stall_ns - m_last.stall_ns) / (double(wall_ns) * nb_threads) : 0;
+        double mmio_rate = double(now.cross_thread_accesses - m_last.cross_thread_accesses) / quanta;
+        double irq_rate = double(now.irqs - m_last.irqs) / quanta;
+        uint64_t irq_latency_ns = lead_ns();
+
+        uint64_t quantum_ns = to_ns(tlm_utils::tlm_quantumkeeper::get_global_quantum());
+        uint64_t next = next_quantum(quantum_ns, stall_ratio, mmio_rate, irq_rate, irq_latency_ns);
+
+        SCP_DEBUG(())("stall ratio {:.3f}, {:.1f} cross-thread accesses and {:.1f} interrupts per quantum, "
+                      "interrupt latency {}ns: quantum {}ns -> {}ns",
+                      stall_ratio, mmio_rate, irq_rate, irq_latency_ns, quantum_ns, next);
+
+        if (next != quantum_ns) {
+            tlm_utils::tlm_quantumkeeper::set_global_quantum(sc_core::sc_time(double(next), sc_core::SC_NS));
+        }
+        SyncStats::get().quantum_ns.store(next, std::memory_order_relaxed);
+
+        m_last = now;
+    }
+
+    void control()
+    {
+        uint64_t min_ns = p_min_quantum_ns, max_ns = p_max_quantum_ns;
+        if (min_ns == 0 || min_ns > max_ns) {
+            SCP_FATAL(()) << "Invalid quantum bounds [" << min_ns << ", " << max_ns << "]";
+        }
+
+        m_qks = find_all_tlm_quantumkeeper_multithread();
+        m_last = take_sample();
+
+        for (;;) {
+            unsigned int period = std::max(p_period.get_value(), 1u);
+            sc_core::wait(tlm_utils::tlm_quantumkeeper::get_global_quantum() * period);
+
+            if (SyncStats::get().all_cpus_halted()) {
+                /* Nothing to measure, and waking up every period would keep time from jumping */
+                SCP_DEBUG(()) << "All CPUs halted, pausing";
+                m_paused = true;
+                sc_core::wait(m_wake);
+                m_paused = false;
+                m_last = take_sample();
+                continue;
+            }
+            adjust(period);
+        }
+    }
+};
+
+} // namespace gs
+
+#endif // QK_CONTROLLER_H
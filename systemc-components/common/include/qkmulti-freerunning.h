@@ -14,6 +14,7 @@ class tlm_quantumkeeper_freerunning : public tlm_quantumkeeper_multithread
 {
     virtual void sync() override
     {
+        count_sync();
         if (is_sysc_thread()) {
             assert(m_local_time >= sc_core::sc_time_stamp());
             sc_core::sc_time t = m_local_time - sc_core::sc_time_stamp();
@@ -12,6 +12,8 @@
 #define SC_INCLUDE_DYNAMIC_PROCESSES
 #endif
 
+#include <atomic>
+
 #include <systemc>
 
 #include <scp/report.h>
@@ -21,49 +23,76 @@
 #include <libgsutils.h>
 
 namespace gs {
+/*
+ * The budget is bounded by the next pending activity in SystemC. The SystemC side publishes the
+ * time up to which the vCPU may run (the lookahead) whenever it runs for this QK, so that the vCPU
+ * can compute its budget without blocking. Only once the published lookahead is exhausted does the
+ * vCPU ask the SystemC thread for an up to date one.
+ */
 class tlm_quantumkeeper_multi_rolling : public tlm_quantumkeeper_multi_quantum
 {
 private:
     async_event m_time_ev;
-    sc_core::sc_time m_next_time;
     semaphore m_sem;
+    /* absolute time up to which we may run */
+    std::atomic<sc_dt::uint64> m_lookahead{ 0 };
 
-    sc_core::sc_time get_next_time()
+    /*
+     * Must be called from SystemC. With kick, the QK's time handler is woken up when activity is pending
+     * now, so that the lookahead is published again once it is done. The publish_lookahead process is
+     * itself sensitive to m_tick and must not kick, as SystemC ignores immediate self-notifications.
+     */
+    sc_core::sc_time get_lookahead(bool kick)
     {
-        if (status != RUNNING) return sc_core::SC_ZERO_TIME;
+        sc_core::sc_time now = sc_core::sc_time_stamp();
+        if (status != RUNNING) return now;
 
-        sc_core::sc_time quantum = tlm_utils::tlm_quantumkeeper::get_global_quantum();
-        sc_core::sc_time next_event = sc_core::sc_time_to_pending_activity();
-        sc_core::sc_time quantum_boundary = sc_core::sc_time_stamp() + quantum - get_current_time();
+        sc_core::sc_time quantum_boundary = now + tlm_utils::tlm_quantumkeeper::get_global_quantum();
         if (sc_core::sc_pending_activity_at_current_time()) {
-            SCP_INFO("Libgssync") << "Pending activity now returning SC_ZERO_TIME";
-            m_tick.notify();
-            return sc_core::SC_ZERO_TIME;
+            SCP_INFO("Libgssync") << "Pending activity now, no lookahead";
+            if (kick) m_tick.notify();
+            return now;
         } else if (sc_core::sc_pending_activity_at_future_time()) {
-            sc_core::sc_time ret = std::min(next_event, quantum_boundary);
-            SCP_INFO("Libgssync") << "Pending activity returning " << ret.to_string();
+            sc_core::sc_time ret = std::min(now + sc_core::sc_time_to_pending_activity(), quantum_boundary);
+            SCP_INFO("Libgssync") << "Pending activity, lookahead " << ret.to_string();
             return ret;
         } else {
-            SCP_INFO("Libgssync") << "No pending activity returning quantum boundary " << quantum_boundary.to_string();
+            SCP_INFO("Libgssync") << "No pending activity, lookahead to quantum boundary "
+                                  << quantum_boundary.to_string();
             return quantum_boundary;
         }
     }
 
+    void publish_lookahead(bool kick = false) { m_lookahead.store(get_lookahead(kick).value()); }
+
     void get_time_from_systemc()
     {
-        m_next_time = get_next_time();
+        publish_lookahead(true);
         m_sem.notify();
     }
 
+    sc_core::sc_time budget(sc_core::sc_time lookahead)
+    {
+        sc_core::sc_time now = get_current_time();
+        return lookahead > now ? lookahead - now : sc_core::SC_ZERO_TIME;
+    }
+
     virtual sc_core::sc_time time_to_sync() override
     {
-        if (is_sysc_thread())
-            return get_next_time();
-        else {
+        if (is_sysc_thread()) {
+            /* Same as the round trip below, without the round trip */
+            publish_lookahead(true);
+            return budget(sc_core::sc_time::from_value(m_lookahead.load()));
+        }
+
+        sc_core::sc_time ret = budget(sc_core::sc_time::from_value(m_lookahead.load()));
+        if (ret == sc_core::SC_ZERO_TIME) {
+            /* The published lookahead may be stale, ask SystemC */
             m_time_ev.notify();
             m_sem.wait();
-            return m_next_time;
+            ret = budget(sc_core::sc_time::from_value(m_lookahead.load()));
         }
+        return ret;
     }
 
 public:
@@ -75,6 +104,14 @@ public:
         opt.dont_initialize();
         sc_core::sc_spawn(sc_bind(&tlm_quantumkeeper_multi_rolling::get_time_from_systemc, this), "get_time_from_sysc",
                           &opt);
+
+        /* Keep the lookahead up to date as SystemC advances */
+        sc_core::sc_spawn_options lookahead_opt;
+        lookahead_opt.spawn_method();
+        lookahead_opt.set_sensitivity(&m_tick);
+        lookahead_opt.dont_initialize();
+        sc_core::sc_spawn(sc_bind(&tlm_quantumkeeper_multi_rolling::publish_lookahead, this, false),
+                          "publish_lookahead", &lookahead_opt);
     }
 };
 } // namespace gs
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef QKMULTI_SWITCHABLE_H
+#define QKMULTI_SWITCHABLE_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <qk_extendedif.h>
+#include <qk_factory.h>
+
+namespace gs {
+
+/**
+ * @brief Quantum keeper whose sync policy can be changed during the simulation
+ *
+ * @details One quantum keeper is built, at elaboration, for each policy it may switch to, in a child
+ * module named after the policy. Calls are forwarded to the current one. switch_to() may be called
+ * from any thread: the switch is done by the next sync(), on the thread running the model, which
+ * hands its local time over to the new quantum keeper before stopping the old one.
+ *
+ * All the policies must use the same kind of thread (see SyncPolicy), which is fixed at
+ * elaboration.
+ */
+class tlm_quantumkeeper_switchable : public tlm_quantumkeeper_extended
+{
+    SCP_LOGGER();
+
+    /* Gives each policy its own scope, they would all be named "qk" otherwise */
+    struct policy_module : public sc_core::sc_module {
+        std::shared_ptr<tlm_quantumkeeper_extended> qk;
+        policy_module(const sc_core::sc_module_name& n, const std::string& policy)
+            : sc_core::sc_module(n), qk(tlm_quantumkeeper_factory(policy))
+        {
+        }
+    };
+
+    std::map<std::string, std::unique_ptr<policy_module>> m_policies;
+    std::atomic<tlm_quantumkeeper_extended*> m_current{ nullptr };
+    std::string m_current_name;
+
+    std::mutex m_lock;
+    tlm_quantumkeeper_extended* m_pending = nullptr;
+    std::string m_pending_name;
+    std::atomic<bool> m_has_pending{ false };
+    bool m_started = false;
+    std::thread m_worker_thread;
+
+    tlm_quantumkeeper_extended* cur() const { return m_current.load(std::memory_order_acquire); }
+
+    /* Hand the local time over to the pending quantum keeper, on the thread running the model */
+    void apply_pending()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_pending) return;
+
+        tlm_quantumkeeper_extended* old = cur();
+        tlm_quantumkeeper_extended* next = m_pending;
+        m_pending = nullptr;
+        m_has_pending = false;
+
+        sc_core::sc_time now = old->get_current_time();
+        next->reset();
+        if (now > sc_core::sc_time_stamp()) {
+            next->set(now - sc_core::sc_time_stamp());
+        }
+        // Start the new one first, so that SystemC is never left to run ahead of us
+        if (m_started) next->start();
+        m_current.store(next, std::memory_order_release);
+        old->stop();
+
+        SCP_INFO(())("Switched sync policy from {} to {}", m_current_name, m_pending_name);
+        m_current_name = m_pending_name;
+    }
+
+public:
+    /**
+     * @param policy the policy to start with
+     * @param policies the policies it may switch to (the initial one is always allowed)
+     */
+    tlm_quantumkeeper_switchable(const std::string& policy, const std::vector<std::string>& policies)
+    {
+        std::vector<std::string> all(policies);
+        all.insert(all.begin(), policy);
+
+        for (const auto& p : all) {
+            if (m_policies.count(p)) continue;
+            std::unique_ptr<policy_module> m(new policy_module(p.c_str(), p));
+            if (!m->qk) {
+                SCP_FATAL(())("No quantum keeper found with name : {}", p);
+            }
+            if (!m_policies.empty() && m->qk->get_thread_type() != m_policies.at(policy)->qk->get_thread_type()) {
+                SCP_FATAL(())("Sync policy {} does not use the same kind of thread as {}", p, policy);
+            }
+            m_policies[p] = std::move(m);
+        }
+        m_current = m_policies.at(policy)->qk.get();
+        m_current_name = policy;
+    }
+
+    virtual ~tlm_quantumkeeper_switchable() { stop(); }
+
+    /**
+     * @brief Switch to another policy, at the next sync()
+     * @return false if the policy is not one of those given at construction
+     */
+    bool switch_to(const std::string& policy)
+    {
+        auto it = m_policies.find(policy);
+        if (it == m_policies.end()) {
+            SCP_WARN(())("Sync policy {} was not made available for switching", policy);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        tlm_quantumkeeper_extended* qk = it->second->qk.get();
+        m_pending = (qk == cur()) ? nullptr : qk;
+        m_pending_name = policy;
+        m_has_pending = (m_pending != nullptr);
+        return true;
+    }
+
+    std::string get_policy()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_current_name;
+    }
+
+    virtual SyncPolicy::Type get_thread_type() const override { return cur()->get_thread_type(); }
+
+    virtual void start(std::function<void()> job = nullptr) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_started = true;
+            cur()->start();
+        }
+        // Run the job here rather than in a quantum keeper that may be stopped (and join it) on a switch
+        if (job) {
+            if (get_thread_type() == SyncPolicy::OS_THREAD) {
+                m_worker_thread = std::thread(job);
+            } else {
+                sc_core::sc_spawn(job);
+            }
+        }
+    }
+
+    virtual void stop() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_started = false;
+            cur()->stop();
+        }
+        if (m_worker_thread.joinable() && m_worker_thread.get_id() != std::this_thread::get_id()) {
+            m_worker_thread.join();
+        }
+    }
+
+    virtual void sync() override
+    {
+        if (m_has_pending.load(std::memory_order_relaxed)) {
+            apply_pending();
+        }
+        cur()->sync();
+    }
+
+    virtual sc_core::sc_time time_to_sync() override { return cur()->time_to_sync(); }
+    virtual bool need_sync() override { return cur()->need_sync(); }
+    virtual void inc(const sc_core::sc_time& t) override { cur()->inc(t); }
+    virtual void set(const sc_core::sc_time& t) override { cur()->set(t); }
+    virtual void reset() override { cur()->reset(); }
+    virtual sc_core::sc_time get_current_time() const override { return cur()->get_current_time(); }
+    virtual sc_core::sc_time get_local_time() const override { return cur()->get_local_time(); }
+    virtual void run_on_systemc(std::function<void()> job) override { cur()->run_on_systemc(job); }
+};
+
+} // namespace gs
+
+#endif // QKMULTI_SWITCHABLE_H
@@ -9,32 +9,108 @@
 #define QKMULTITHREAD_H
 
 #include <mutex>
-#include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <string>
 #include <systemc>
 #include <tlm>
 #include <scp/report.h>
 #include <tlm_utils/tlm_quantumkeeper.h>
 #include <async_event.h>
 #include <qk_extendedif.h>
+#include <doorbell.h>
 
 namespace gs {
+
+/**
+ * @brief Lock free histogram of durations in ns: bucket i counts [2^i, 2^(i+1)) ns, the first one also
+ * counts 0 and the last one everything longer
+ */
+class qk_histogram
+{
+public:
+    static constexpr int BUCKETS = 32;
+
+    void add(uint64_t ns)
+    {
+        int i = 0;
+        while (i < BUCKETS - 1 && (ns >> (i + 1))) i++;
+        m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+    }
+    uint64_t get(int i) const { return m_buckets[i].load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS] = {};
+};
+
+/**
+ * @brief Snapshot of the sync statistics of a quantum keeper. Plain data, it can be copied as is
+ * into a file, a socket or shared memory.
+ */
+struct qk_stats_snapshot {
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t version;
+    uint32_t buckets;
+    uint64_t syncs;              /* calls to sync() */
+    uint64_t budget_exhaustions; /* syncs that had to wait for SystemC */
+    uint64_t blocked_ns;         /* wall clock time spent waiting in sync() */
+    uint64_t wait_timeouts;      /* waits that lasted more than 1s */
+    uint64_t suspends;           /* SystemC suspended, waiting for this QK */
+    uint64_t unsuspends;
+    uint64_t blocked_hist[qk_histogram::BUCKETS];   /* time blocked in sync() */
+    uint64_t suspended_hist[qk_histogram::BUCKETS]; /* wall clock time SystemC stayed suspended */
+};
+
 // somewhat tuned multiple threaded QK
+// The local time is published atomically, and sync() only blocks (on a futex) once the budget is
+// exhausted: while it is not, neither the running thread nor SystemC take a lock.
 class tlm_quantumkeeper_multithread : public gs::tlm_quantumkeeper_extended
 {
     SCP_LOGGER();
     std::thread::id m_systemc_thread_id;
     std::mutex mutex;
-    std::condition_variable cond;
     std::thread m_worker_thread;
+    /* local time (absolute), as seen from other threads */
+    std::atomic<sc_dt::uint64> m_published_time{ 0 };
+    /* rung whenever the run budget may have changed */
+    Doorbell m_budget_bell;
+
+    /* sync statistics, written by the owner of each counter, read from anywhere */
+    std::atomic<uint64_t> m_syncs{ 0 };
+    std::atomic<uint64_t> m_budget_exhaustions{ 0 };
+    std::atomic<uint64_t> m_blocked_ns{ 0 };
+    std::atomic<uint64_t> m_wait_timeouts{ 0 };
+    std::atomic<uint64_t> m_suspends{ 0 };
+    std::atomic<uint64_t> m_unsuspends{ 0 };
+    qk_histogram m_blocked_hist;
+    qk_histogram m_suspended_hist;
+    /* SystemC thread only */
+    bool m_sc_suspended = false;
+    std::chrono::steady_clock::time_point m_suspended_since;
+
+    void suspend_systemc();
+    void unsuspend_systemc();
 
 protected:
-    bool m_systemc_waiting;
-    bool m_extern_waiting;
+    std::atomic<bool> m_systemc_waiting{ false };
+    std::atomic<bool> m_extern_waiting{ false };
     async_event m_tick;
 
     virtual bool is_sysc_thread() const;
 
+    void publish_local_time() { m_published_time.store(m_local_time.value()); }
+
+    void count_sync() { m_syncs.fetch_add(1, std::memory_order_relaxed); }
+
+    /* Wake SystemC up if it is waiting for us to keep up */
+    void nudge_systemc()
+    {
+        if (m_systemc_waiting) {
+            m_tick.notify(sc_core::SC_ZERO_TIME);
+        }
+    }
+
 private:
     void timehandler();
 
@@ -79,8 +155,50 @@ public:
         if (status & STOPPED) s = s + ",\"state\":\"IDLE\"";
         if (m_systemc_waiting) s = s + ",\"sc_waiting\":true";
         if (m_extern_waiting) s = s + ",\"extern_waiting\":true";
+
+        qk_stats_snapshot st = get_stats();
+        s = s + ",\"syncs\":" + std::to_string(st.syncs);
+        s = s + ",\"budget_exhaustions\":" + std::to_string(st.budget_exhaustions);
+        s = s + ",\"blocked_ns\":" + std::to_string(st.blocked_ns);
+        s = s + ",\"wait_timeouts\":" + std::to_string(st.wait_timeouts);
+        s = s + ",\"suspends\":" + std::to_string(st.suspends);
+        s = s + ",\"unsuspends\":" + std::to_string(st.unsuspends);
+        s = s + ",\"blocked_hist\":" + hist_json(st.blocked_hist);
+        s = s + ",\"suspended_hist\":" + hist_json(st.suspended_hist);
         return "{" + s + "}";
     }
+
+    /* Sync statistics, see qk_stats_snapshot. Safe to call from any thread. */
+    qk_stats_snapshot get_stats() const
+    {
+        qk_stats_snapshot st;
+        st.version = qk_stats_snapshot::VERSION;
+        st.buckets = qk_histogram::BUCKETS;
+        st.syncs = m_syncs.load(std::memory_order_relaxed);
+        st.budget_exhaustions = m_budget_exhaustions.load(std::memory_order_relaxed);
+        st.blocked_ns = m_blocked_ns.load(std::memory_order_relaxed);
+        st.wait_timeouts = m_wait_timeouts.load(std::memory_order_relaxed);
+        st.suspends = m_suspends.load(std::memory_order_relaxed);
+        st.unsuspends = m_unsuspends.load(std::memory_order_relaxed);
+        for (int i = 0; i < qk_histogram::BUCKETS; i++) {
+            st.blocked_hist[i] = m_blocked_hist.get(i);
+            st.suspended_hist[i] = m_suspended_hist.get(i);
+        }
+        return st;
+    }
+
+private:
+    /* Buckets as a list, without the trailing empty ones */
+    static std::string hist_json(const uint64_t (&hist)[qk_histogram::BUCKETS])
+    {
+        int n = qk_histogram::BUCKETS;
+        while (n > 0 && hist[n - 1] == 0) n--;
+        std::string s;
+        for (int i = 0; i < n; i++) {
+            s = s + (i ? "," : "") + std::to_string(hist[i]);
+        }
+        return "[" + s + "]";
+    }
 };
 
 static std::vector<gs::tlm_quantumkeeper_multithread*> find_all_tlm_quantumkeeper_multithread()
@@ -41,6 +41,7 @@
 #include <type_traits>
 #include <chrono>
 #include <memory_services.h>
+#include <shmem_ring.h>
 
 #include <rpc/client.h>
 #include <rpc/rpc_error.h>
@@ -280,6 +281,60 @@ class PassRPC : public sc_core::sc_module, public transaction_forwarder_if<PASS>
         }
     };
 
+    /* Fixed layout header of a transaction sent through the shared memory rings */
+    struct tlm_generic_payload_shmem {
+        uint64_t m_address;
+        int32_t m_command;
+        uint32_t m_length;
+        int32_t m_response_status;
+        uint32_t m_dmi;
+        uint32_t m_byte_enable_length;
+        uint32_t m_streaming_width;
+        int32_t m_gp_option;
+        uint32_t m_pad;
+
+        double m_sc_time;
+        double m_quantum_time;
+
+        void from_tlm(tlm::tlm_generic_payload& other)
+        {
+            m_command = other.get_command();
+            m_address = other.get_address();
+            m_length = other.get_data_ptr() ? other.get_data_length() : 0;
+            m_response_status = other.get_response_status();
+            m_byte_enable_length = other.get_byte_enable_ptr() ? other.get_byte_enable_length() : 0;
+            m_streaming_width = other.get_streaming_width();
+            m_gp_option = other.get_gp_option();
+            m_dmi = other.is_dmi_allowed();
+            m_pad = 0;
+        }
+
+        /* data and byte_enable point to the bytes following the header */
+        void deep_copy_to_tlm(tlm::tlm_generic_payload& other, unsigned char* data, unsigned char* byte_enable)
+        {
+            other.set_command((tlm::tlm_command)(m_command));
+            other.set_address(m_address);
+            other.set_data_length(m_length);
+            other.set_response_status((tlm::tlm_response_status)(m_response_status));
+            other.set_byte_enable_length(m_byte_enable_length);
+            other.set_streaming_width(m_streaming_width);
+            other.set_gp_option((tlm::tlm_gp_option)(m_gp_option));
+            other.set_dmi_allowed(m_dmi);
+            other.set_data_ptr(m_length ? data : nullptr);
+            other.set_byte_enable_ptr(m_byte_enable_length ? byte_enable : nullptr);
+        }
+
+        void update_to_tlm(tlm::tlm_generic_payload& other, unsigned char* data)
+        {
+            tlm::tlm_generic_payload tmp; // make use of TLM's built in update
+            tmp.set_data_ptr(m_length ? data : nullptr);
+            tmp.set_data_length(m_length);
+            tmp.set_response_status((tlm::tlm_response_status)m_response_status);
+            tmp.set_dmi_allowed(m_dmi);
+            other.update_original_from(tmp, other.get_byte_enable_ptr() != nullptr);
+        }
+    };
+
     cci::cci_broker_handle m_broker;
     str_pairs m_cci_db;
     std::mutex m_cci_db_mut;
@@ -344,6 +399,7 @@ public:
     cci::cci_param<uint32_t> p_tlm_target_ports_num;
     cci::cci_param<uint32_t> p_initiator_signals_num;
     cci::cci_param<uint32_t> p_target_signals_num;
+    cci::cci_param<std::string> p_transport;
 
 private:
     rpc::client* client = nullptr;
@@ -448,6 +504,18 @@ private:
 
     std::unique_ptr<trans_waiter> btspt_waiter;
 
+    /*
+     * Shared memory rings (transport "shmem"). We create m_out_rings for our
+     * target sockets, the remote creates m_in_rings for its own, which we serve.
+     */
+    ShmemRingSegment* m_out_rings = nullptr;
+    ShmemRingSegment* m_in_rings = nullptr;
+    std::thread m_out_rings_thread;
+    std::thread m_in_rings_thread;
+    std::vector<std::vector<uint8_t>> m_out_rings_bufs;
+    /* Wake up the server process of each initiator socket, see shmem_in_ring_server */
+    std::vector<std::unique_ptr<gs::async_event>> m_in_rings_events;
+
     template <typename... Args>
     std::future<RPCLIB_MSGPACK::object_handle> do_rpc_async_call(std::string const& func_name, Args... args)
     {
@@ -575,6 +643,12 @@ private:
         }
         btspt_waiter->is_port_busy[id] = true;
 
+        if (m_out_rings && shmem_b_transport(id, trans, delay)) {
+            btspt_waiter->is_port_busy[id] = false;
+            btspt_waiter->port_available_events[id].notify(sc_core::SC_ZERO_TIME);
+            return;
+        }
+
         tlm_generic_payload_rpc t;
         tlm_generic_payload_rpc r;
         double time = sc_core::sc_time_stamp().to_seconds();
@@ -641,6 +715,166 @@ private:
         btspt_waiter->is_port_busy[id] = false;
         btspt_waiter->port_available_events[id].notify(sc_core::SC_ZERO_TIME);
     }
+    /* Send b_transport through the shared memory rings, false if it must go through RPC instead */
+    bool shmem_b_transport(int id, tlm::tlm_generic_payload& trans, sc_core::sc_time& delay)
+    {
+        ShmemRingSegment::channel& ch = m_out_rings->get_channel(id);
+        tlm_generic_payload_shmem t;
+
+        t.from_tlm(trans);
+        t.m_quantum_time = delay.to_seconds();
+        t.m_sc_time = sc_core::sc_time_stamp().to_seconds();
+        if (!ShmemRing::fits(sizeof(t) + t.m_length + t.m_byte_enable_length)) {
+            return false;
+        }
+        if (!m_out_rings->push(ch.req, { { &t, sizeof(t) },
+                                         { trans.get_data_ptr(), t.m_length },
+                                         { trans.get_byte_enable_ptr(), t.m_byte_enable_length } })) {
+            SCP_WARN(()) << name() << " remote does not serve its shared memory rings";
+            stop_and_exit();
+        }
+        m_out_rings->req_bell.ring();
+
+        auto ready = [&]() { return ch.resp.readable() || m_out_rings->is_closed(); };
+        if (std::this_thread::get_id() == sc_tid && sc_core::sc_get_status() >= sc_core::sc_status::SC_RUNNING &&
+            sc_core::sc_get_curr_process_kind() != sc_core::sc_curr_proc_kind::SC_NO_PROC_) {
+            /* Let SystemC run (the remote may call back into us), m_out_rings_thread notifies us */
+            if (sc_core::sc_get_curr_process_kind() == sc_core::sc_curr_proc_kind::SC_METHOD_PROC_) {
+                SCP_FATAL(()) << name() << " b_transport was called from the context of SC_METHOD!";
+            }
+            while (!ready()) {
+                sc_core::wait(btspt_waiter->data_ready_events[id]);
+            }
+        } else {
+            m_out_rings->resp_bell.wait_until(ready);
+        }
+
+        std::vector<uint8_t>& buf = m_out_rings_bufs[id];
+        if (!ch.resp.pop(buf)) {
+            SCP_DEBUG(()) << name() << " shared memory rings closed";
+            stop_and_exit();
+        }
+        tlm_generic_payload_shmem r;
+        memcpy(&r, buf.data(), sizeof(r));
+        r.update_to_tlm(trans, buf.data() + sizeof(r));
+        delay = sc_core::sc_time(r.m_quantum_time, sc_core::SC_SEC);
+        return true;
+    }
+
+    /* Wake up SystemC processes waiting for a response in shmem_b_transport */
+    void shmem_out_rings_notifier()
+    {
+        while (!m_out_rings->is_closed()) {
+            uint32_t seen = m_out_rings->resp_bell.value();
+            for (uint32_t i = 0; i < m_out_rings->nports(); i++) {
+                if (m_out_rings->get_channel(i).resp.readable()) {
+                    btspt_waiter->data_ready_events[i].async_notify();
+                }
+            }
+            m_out_rings->resp_bell.wait(seen);
+        }
+    }
+
+    /*
+     * Wake up the server processes of the ports the remote sent requests to.
+     * Requests to ports we don't have get an error straight away.
+     */
+    void shmem_in_rings_notifier()
+    {
+        std::vector<uint8_t> buf;
+
+        while (!m_in_rings->is_closed()) {
+            uint32_t seen = m_in_rings->req_bell.value();
+            for (uint32_t i = 0; i < m_in_rings->nports(); i++) {
+                ShmemRingSegment::channel& ch = m_in_rings->get_channel(i);
+                if (i < m_in_rings_events.size()) {
+                    if (ch.req.readable()) m_in_rings_events[i]->async_notify();
+                    continue;
+                }
+                while (ch.req.pop(buf)) {
+                    tlm_generic_payload_shmem t;
+                    memcpy(&t, buf.data(), sizeof(t));
+                    t.m_response_status = tlm::TLM_GENERIC_ERROR_RESPONSE;
+                    m_in_rings->push(ch.resp, { { &t, sizeof(t) }, { buf.data() + sizeof(t), t.m_length } });
+                    m_in_rings->resp_bell.ring();
+                }
+            }
+            m_in_rings->req_bell.wait(seen);
+        }
+        /* Let the server processes see the rings closed */
+        for (auto& ev : m_in_rings_events) {
+            ev->async_notify();
+        }
+    }
+
+    /*
+     * Serve the b_transport requests the remote sends to initiator socket id
+     * through its rings. Each socket has its own process, so a b_transport
+     * that waits only holds up its own socket.
+     */
+    void shmem_in_ring_server(uint32_t id)
+    {
+        std::vector<uint8_t> buf;
+
+        for (;;) {
+            sc_core::wait(*m_in_rings_events[id]);
+            if (!m_in_rings || id >= m_in_rings->nports()) continue;
+
+            ShmemRingSegment::channel& ch = m_in_rings->get_channel(id);
+            while (ch.req.pop(buf)) {
+                tlm_generic_payload_shmem t;
+                memcpy(&t, buf.data(), sizeof(t));
+                unsigned char* data = buf.data() + sizeof(t);
+
+                tlm::tlm_generic_payload trans;
+                t.deep_copy_to_tlm(trans, data, data + t.m_length);
+                sc_core::sc_time delay = sc_core::sc_time(t.m_quantum_time, sc_core::SC_SEC);
+
+                sc_core::sc_unsuspendable(); // as for run_on_sysc jobs, a wait in b_transport lets time advance
+                initiator_sockets[id]->b_transport(trans, delay);
+                sc_core::sc_suspendable();
+
+                t.from_tlm(trans);
+                t.m_quantum_time = delay.to_seconds();
+                if (!m_in_rings->push(ch.resp, { { &t, sizeof(t) }, { trans.get_data_ptr(), t.m_length } })) {
+                    return;
+                }
+                m_in_rings->resp_bell.ring();
+            }
+            if (m_in_rings->is_closed()) return;
+        }
+    }
+
+    /* Move our b_transports to shared memory rings, if requested */
+    void shmem_rings_setup()
+    {
+        if (p_transport.get_value() == "rpc" || target_sockets.size() == 0) return;
+        if (p_transport.get_value() != "shmem") {
+            SCP_FATAL(()) << name() << " unknown transport '" << p_transport.get_value() << "'";
+        }
+
+        uint32_t nports = target_sockets.size();
+        std::string memname = "/gs_rings_" + std::to_string(getpid()) + "_" + std::string(name());
+        uint64_t size = ShmemRingSegment::size_for(nports);
+        int fd;
+        uint8_t* mem = MemoryServices::get().map_mem_create(memname.c_str(), size, &fd);
+        close(fd);
+
+        m_out_rings = ShmemRingSegment::init(mem, nports);
+        m_out_rings_bufs.resize(nports);
+        m_out_rings_thread = std::thread(&PassRPC::shmem_out_rings_notifier, this);
+        do_rpc_call("shm_rings", memname, size);
+        SCP_INFO(()) << "b_transport through shared memory rings " << memname;
+    }
+
+    void shmem_rings_stop()
+    {
+        if (m_out_rings) m_out_rings->close();
+        if (m_in_rings) m_in_rings->close();
+        if (m_out_rings_thread.joinable()) m_out_rings_thread.join();
+        if (m_in_rings_thread.joinable()) m_in_rings_thread.join();
+    }
+
     tlm_generic_payload_rpc b_transport_rpc(int id, tlm_generic_payload_rpc t)
     {
         tlm::tlm_generic_payload trans;
@@ -855,6 +1089,8 @@ public:
         , p_tlm_target_ports_num("tlm_target_ports_num", 0, "number of tlm target ports")
         , p_initiator_signals_num("initiator_signals_num", 0, "number of initiator signals")
         , p_target_signals_num("target_signals_num", 0, "number of target signals")
+        , p_transport("transport", "rpc",
+                      "Transport used for b_transport to the remote: 'rpc', or 'shmem' for shared memory rings")
         , cancel_waiting(false)
     {
         SigHandler::get().add_sig_handler(SIGINT, SigHandler::Handler_CB::PASS);
@@ -866,6 +1102,12 @@ public:
             SCP_DEBUG(()) << "Working in LOCAL mode!";
         } else {
             SCP_DEBUG(()) << getpid() << " IS THE RPC PID " << std::this_thread::get_id() << " is the thread ID";
+            /* Ready to serve shared memory rings before the remote can create some (see "shm_rings") */
+            for (int i = 0; i < p_tlm_initiator_ports_num.get_value(); i++) {
+                m_in_rings_events.emplace_back(new gs::async_event(false));
+                sc_core::sc_spawn(std::bind(&PassRPC::shmem_in_ring_server, this, i),
+                                  sc_core::sc_gen_unique_name("shmem_in_ring_server"));
+            }
             // always serve on a new port.
             server = new rpc::server(p_sport);
             server->suppress_exceptions(true);
@@ -966,6 +1208,13 @@ public:
                 return;
             });
 
+            server->bind("shm_rings", [&](std::string memname, uint64_t size) {
+                SCP_INFO(()) << "Serving b_transport from shared memory rings " << memname;
+                m_in_rings = ShmemRingSegment::join(MemoryServices::get().map_mem_join(memname.c_str(), size));
+                m_in_rings_thread = std::thread(&PassRPC::shmem_in_rings_notifier, this);
+                return;
+            });
+
             server->bind("sock_pair", [&](int sock_fd0, int sock_fd1) {
                 pahandler.recv_sockpair_fds_from_remote(sock_fd0, sock_fd1);
                 pahandler.check_parent_conn_nth([&]() {
@@ -1095,6 +1344,7 @@ public:
             is_sc_status_set.notify_one();
         }
         btspt_waiter->stop();
+        shmem_rings_stop();
         if (server) {
             server->close_sessions();
             server->stop();
@@ -1125,6 +1375,7 @@ public:
     void end_of_elaboration() override
     {
         if (is_local_mode()) return;
+        shmem_rings_setup();
         send_status();
     }
 
@@ -54,6 +54,7 @@ public:
         bool use_offset;
         bool is_callback;
         bool chained;
+        bool thread_safe;
         std::string shortname;
     };
 
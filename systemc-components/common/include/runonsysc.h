@@ -8,98 +8,291 @@
 #ifndef RUNONSYSTEMC_H
 #define RUNONSYSTEMC_H
 
-#include <thread>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
 #include <mutex>
-#include <condition_variable>
-#include <queue>
-#include <future>
+#include <thread>
 
 #include <async_event.h>
+#include <doorbell.h>
 #include <uutils.h>
 
 namespace gs {
 class runonsysc : public sc_core::sc_module
 {
 protected:
-    class AsyncJob
+    /**
+     * @brief Completion of a job, owned by the thread waiting for it
+     *
+     * @details Most jobs are short, so the waiter first spins on the job
+     * state, and only then sleeps on it with a futex. The completer's last
+     * access to the waiter is the store of RELEASED, after which the waiter
+     * may return and free it.
+     */
+    class JobWaiter
     {
-    public:
-        using Ptr = std::shared_ptr<AsyncJob>;
+        enum : uint32_t { PENDING, SLEEPING, DONE, RELEASED };
 
-    private:
-        std::packaged_task<void()> m_task;
+        static constexpr int SPIN_COUNT = 2000;
+        static constexpr int WAIT_TIMEOUT_MS = 500;
 
-        bool m_cancelled = false;
+        std::atomic<uint32_t> m_state{ PENDING };
 
-        void run_job() { m_task(); }
+        bool m_cancelled = false;
+        std::exception_ptr m_exception;
 
     public:
-        AsyncJob(std::function<void()>&& job): m_task(job) {}
+        JobWaiter() = default;
+        JobWaiter(const JobWaiter&) = delete;
 
-        AsyncJob(std::function<void()>& job): m_task(job) {}
-
-        AsyncJob() = delete;
-        AsyncJob(const AsyncJob&) = delete;
+        void complete(std::exception_ptr exception = nullptr, bool cancelled = false)
+        {
+            m_exception = exception;
+            m_cancelled = cancelled;
 
-        void operator()() { run_job(); }
+            uint32_t expected = PENDING;
+            if (m_state.compare_exchange_strong(expected, RELEASED, std::memory_order_acq_rel)) {
+                return;
+            }
+            /* The waiter is sleeping, keep it waiting for RELEASED until we are done with the futex */
+            m_state.store(DONE, std::memory_order_release);
+            futex_wake(m_state);
+            m_state.store(RELEASED, std::memory_order_release);
+        }
 
         /**
-         * @brief Cancel a job
+         * @brief Wait for the job completion
+         *
+         * @details Rethrows any exception raised by the job.
          *
-         * @details Cancel a job by setting m_cancelled to true and by
-         * resetting the task. Any waiter will then be unblocked immediately.
+         * @return false if the job has been cancelled
          */
-        void cancel()
+        bool wait()
+        {
+            for (int i = 0; i < SPIN_COUNT; i++) {
+                if (m_state.load(std::memory_order_acquire) == RELEASED) {
+                    return result();
+                }
+            }
+
+            uint32_t state = PENDING;
+            if (m_state.compare_exchange_strong(state, SLEEPING, std::memory_order_acq_rel)) {
+                state = SLEEPING;
+            }
+            while (state != RELEASED) {
+                if (state == SLEEPING) {
+                    futex_wait(m_state, SLEEPING, WAIT_TIMEOUT_MS);
+                } else {
+                    std::this_thread::yield();
+                }
+                state = m_state.load(std::memory_order_acquire);
+            }
+            return result();
+        }
+
+    private:
+        bool result()
         {
-            m_cancelled = true;
-            m_task.reset();
+            if (m_exception) {
+                std::rethrow_exception(m_exception);
+            }
+            return !m_cancelled;
         }
+    };
 
-        void wait()
+    /**
+     * @brief A job, as stored in the queue
+     *
+     * @details A job that is waited for is only referenced, as it lives on the
+     * stack of the waiting thread. A forked job is moved into the queue.
+     */
+    class AsyncJob
+    {
+        void (*m_invoke)(void*) = nullptr;
+        void* m_ctx = nullptr;
+        std::function<void()> m_owned;
+
+    public:
+        JobWaiter* m_waiter = nullptr;
+
+        AsyncJob() = default;
+
+        template <typename Fn>
+        static AsyncJob waited(Fn& fn, JobWaiter& waiter)
         {
-            auto future = m_task.get_future();
+            AsyncJob job;
+            job.m_invoke = [](void* ctx) { (*static_cast<Fn*>(ctx))(); };
+            job.m_ctx = const_cast<void*>(static_cast<const void*>(&fn));
+            job.m_waiter = &waiter;
+            return job;
+        }
 
-            future.wait();
+        static AsyncJob forked(std::function<void()>&& fn)
+        {
+            AsyncJob job;
+            job.m_owned = std::move(fn);
+            return job;
+        }
 
-            if (!m_cancelled) {
-                future.get();
+        void operator()()
+        {
+            if (m_owned) {
+                m_owned();
+            } else {
+                m_invoke(m_ctx);
             }
         }
+    };
 
-        bool is_cancelled() const { return m_cancelled; }
+    /*
+     * Bounded multi-producer single-consumer ring. Each slot carries a sequence
+     * number telling whether it is free for the producer at position `pos`
+     * (seq == pos) or holds the job for the consumer at position `pos`
+     * (seq == pos + 1).
+     *
+     * When the ring is full, jobs spill into a list protected by the consumer
+     * mutex, so that producers never wait for the SystemC thread. While the
+     * list is not empty, new jobs go there too, and it is only drained once
+     * the ring is: each producer's jobs run in order.
+     */
+    struct JobSlot {
+        std::atomic<uint64_t> seq;
+        AsyncJob job;
     };
+    static constexpr size_t QUEUE_SIZE = 256;
+    static_assert((QUEUE_SIZE & (QUEUE_SIZE - 1)) == 0, "QUEUE_SIZE must be a power of 2");
+
+    std::unique_ptr<JobSlot[]> m_slots;
+    std::atomic<uint64_t> m_enqueue_pos{ 0 };
+    uint64_t m_dequeue_pos = 0;
 
     std::thread::id m_thread_id;
 
-    /* Async job queue */
-    std::queue<AsyncJob::Ptr> m_async_jobs;
-    AsyncJob::Ptr m_running_job;
+    /* Consumer side: dequeue position, spilled jobs and the job being run */
     std::mutex m_async_jobs_mutex;
+    std::deque<AsyncJob> m_spilled_jobs;
+    std::atomic<size_t> m_nb_spilled{ 0 };
+    JobWaiter* m_running_waiter = nullptr;
 
     async_event m_jobs_handler_event;
+    std::atomic<bool> m_jobs_handler_notified{ false };
     std::atomic<bool> running = true;
 
+    bool try_push_job(AsyncJob& job)
+    {
+        uint64_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            JobSlot& slot = m_slots[pos & (QUEUE_SIZE - 1)];
+            int64_t diff = static_cast<int64_t>(slot.seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.job = std::move(job);
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void push_job(AsyncJob&& job)
+    {
+        if (m_nb_spilled.load(std::memory_order_acquire) || !try_push_job(job)) {
+            std::lock_guard<std::mutex> lock(m_async_jobs_mutex);
+            m_spilled_jobs.push_back(std::move(job));
+            m_nb_spilled.store(m_spilled_jobs.size(), std::memory_order_release);
+        }
+
+        /* Only wake the handler up once per batch of jobs */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_jobs_handler_notified.exchange(true)) {
+            m_jobs_handler_event.async_notify();
+        }
+    }
+
+    bool pop_job_locked(AsyncJob& job)
+    {
+        JobSlot& slot = m_slots[m_dequeue_pos & (QUEUE_SIZE - 1)];
+        if (slot.seq.load(std::memory_order_acquire) == m_dequeue_pos + 1) {
+            job = std::move(slot.job);
+            slot.job = AsyncJob();
+            slot.seq.store(m_dequeue_pos + QUEUE_SIZE, std::memory_order_release);
+            m_dequeue_pos++;
+            return true;
+        }
+        /*
+         * Spilled jobs were pushed after everything in the ring, wait for the
+         * jobs still being written into it (their producer notifies us).
+         */
+        if (m_spilled_jobs.empty() || m_enqueue_pos.load(std::memory_order_acquire) != m_dequeue_pos) {
+            return false;
+        }
+        job = std::move(m_spilled_jobs.front());
+        m_spilled_jobs.pop_front();
+        m_nb_spilled.store(m_spilled_jobs.size(), std::memory_order_release);
+        return true;
+    }
+
+    bool start_next_job(AsyncJob& job)
+    {
+        std::lock_guard<std::mutex> lock(m_async_jobs_mutex);
+        if (!pop_job_locked(job)) {
+            return false;
+        }
+        m_running_waiter = job.m_waiter;
+        return true;
+    }
+
+    void finish_job(AsyncJob& job, std::exception_ptr exception)
+    {
+        std::lock_guard<std::mutex> lock(m_async_jobs_mutex);
+        /* Unless cancelled while running (see cancel_all) */
+        if (job.m_waiter && m_running_waiter == job.m_waiter) {
+            job.m_waiter->complete(exception);
+        }
+        m_running_waiter = nullptr;
+    }
+
+    bool has_pending_jobs()
+    {
+        std::lock_guard<std::mutex> lock(m_async_jobs_mutex);
+        JobSlot& slot = m_slots[m_dequeue_pos & (QUEUE_SIZE - 1)];
+        return slot.seq.load(std::memory_order_acquire) == m_dequeue_pos + 1 || !m_spilled_jobs.empty();
+    }
+
     // Process inside a thread incase the job calls wait
     void jobs_handler()
     {
-        std::unique_lock<std::mutex> lock(m_async_jobs_mutex);
         running = true;
         for (; running;) {
-            while (!m_async_jobs.empty()) {
-                m_running_job = m_async_jobs.front();
-                m_async_jobs.pop();
+            AsyncJob job;
+            while (start_next_job(job)) {
+                std::exception_ptr exception;
 
-                lock.unlock();
                 sc_core::sc_unsuspendable(); // a wait in the job will cause systemc time to advance
-                (*m_running_job)();
+                try {
+                    job();
+                } catch (...) {
+                    exception = std::current_exception();
+                }
                 sc_core::sc_suspendable();
-                lock.lock();
 
-                m_running_job.reset();
+                finish_job(job, exception);
+                job = AsyncJob();
+            }
+
+            m_jobs_handler_notified.store(false);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (has_pending_jobs()) {
+                continue;
             }
-            lock.unlock();
             wait(m_jobs_handler_event);
-            lock.lock();
         }
         SC_REPORT_WARNING("RunOnSysc", "Stopped");
         sc_core::sc_stop();
@@ -107,18 +300,25 @@ protected:
 
     void cancel_pendings_locked()
     {
-        while (!m_async_jobs.empty()) {
-            m_async_jobs.front()->cancel();
-            m_async_jobs.pop();
+        AsyncJob job;
+        while (pop_job_locked(job)) {
+            if (job.m_waiter) {
+                job.m_waiter->complete(nullptr, true);
+            }
         }
     }
 
 public:
     runonsysc(const sc_core::sc_module_name& n = sc_core::sc_module_name("run-on-sysc"))
         : sc_module(n)
+        , m_slots(new JobSlot[QUEUE_SIZE])
         , m_thread_id(std::this_thread::get_id())
         , m_jobs_handler_event(false) // starve if no more jobs provided
     {
+        for (size_t i = 0; i < QUEUE_SIZE; i++) {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+
         SC_HAS_PROCESS(runonsysc);
         SC_THREAD(jobs_handler);
     }
@@ -151,9 +351,9 @@ public:
 
         cancel_pendings_locked();
 
-        if (m_running_job) {
-            m_running_job->cancel();
-            m_running_job.reset();
+        if (m_running_waiter) {
+            m_running_waiter->complete(nullptr, true);
+            m_running_waiter = nullptr;
         }
     }
     void stop()
@@ -175,60 +375,52 @@ public:
      *         was false, false if it has been cancelled (see
      *         `RunOnSysC::cancel_all`).
      */
-    bool run_on_sysc(std::function<void()> job_entry, bool wait = true)
+    template <typename Fn>
+    bool run_on_sysc(Fn&& job_entry, bool wait = true)
     {
         if (is_on_sysc()) {
             job_entry();
             return true;
+        } else if (!wait) {
+            push_job(AsyncJob::forked(std::function<void()>(std::forward<Fn>(job_entry))));
+            return true;
         } else {
-            AsyncJob::Ptr job(new AsyncJob(job_entry));
-
-            {
-                std::lock_guard<std::mutex> lock(m_async_jobs_mutex);
-                m_async_jobs.push(job);
-            }
-
-            m_jobs_handler_event.async_notify();
-
-            if (wait) {
-                /* Wait for job completion */
-                try {
-                    job->wait();
-                } catch (std::runtime_error const& e) {
-                    /* Report unknown runtime errors, without causing a futher excetion */
+            /* The job stays on our stack until it completes, nothing to copy */
+            JobWaiter waiter;
+            push_job(AsyncJob::waited(job_entry, waiter));
+
+            /* Wait for job completion */
+            try {
+                return waiter.wait();
+            } catch (std::runtime_error const& e) {
+                /* Report unknown runtime errors, without causing a futher excetion */
+                auto old = sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR,
+                                                                   sc_core::SC_LOG | sc_core::SC_DISPLAY);
+                SC_REPORT_ERROR("RunOnSysc",
+                                ("Run on systemc received a runtime error from job: " + std::string(e.what())).c_str());
+                sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR, old);
+                stop();
+                return false;
+            } catch (const std::exception& exc) {
+                if (sc_core::sc_report_handler::get_count(sc_core::SC_ERROR) == 0) {
+                    /* Report exceptions that were not caused by SC_ERRORS (which have already been reported)*/
                     auto old = sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR,
                                                                        sc_core::SC_LOG | sc_core::SC_DISPLAY);
                     SC_REPORT_ERROR(
                         "RunOnSysc",
-                        ("Run on systemc received a runtime error from job: " + std::string(e.what())).c_str());
-                    sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR, old);
-                    stop();
-                    return false;
-                } catch (const std::exception& exc) {
-                    if (sc_core::sc_report_handler::get_count(sc_core::SC_ERROR) == 0) {
-                        /* Report exceptions that were not caused by SC_ERRORS (which have already been reported)*/
-                        auto old = sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR,
-                                                                           sc_core::SC_LOG | sc_core::SC_DISPLAY);
-                        SC_REPORT_ERROR(
-                            "RunOnSysc",
-                            ("Run on systemc received an exception from job: " + std::string(exc.what())).c_str());
-                        sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR, old);
-                    }
-                    stop();
-                    return false;
-                } catch (...) {
-                    auto old = sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR,
-                                                                       sc_core::SC_LOG | sc_core::SC_DISPLAY);
-                    SC_REPORT_ERROR("RunOnSysc", "Run on systemc received an unknown exception from job");
+                        ("Run on systemc received an exception from job: " + std::string(exc.what())).c_str());
                     sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR, old);
-                    stop();
-                    return false;
                 }
-
-                return !job->is_cancelled();
+                stop();
+                return false;
+            } catch (...) {
+                auto old = sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR,
+                                                                   sc_core::SC_LOG | sc_core::SC_DISPLAY);
+                SC_REPORT_ERROR("RunOnSysc", "Run on systemc received an unknown exception from job");
+                sc_core::sc_report_handler::set_actions(sc_core::SC_ERROR, old);
+                stop();
+                return false;
             }
-
-            return true;
         }
     }
 
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2022-2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _GREENSOCS_BASE_COMPONENTS_SHMEM_RING_H
+#define _GREENSOCS_BASE_COMPONENTS_SHMEM_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <doorbell.h>
+
+namespace gs {
+
+/*
+ * The structures below are placed in memory shared between processes, so
+ * they only hold lock free (hence address free) atomics and plain data.
+ */
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "Shared memory rings need lock free atomics");
+
+/**
+ * @brief Single producer single consumer ring of messages
+ *
+ * @details Messages are length prefixed and may wrap around the end of the
+ * buffer. A message that can never fit is refused by push.
+ */
+class ShmemRing
+{
+public:
+    static constexpr size_t SIZE = 64 * 1024;
+
+private:
+    std::atomic<uint64_t> m_head; // written by the producer
+    std::atomic<uint64_t> m_tail; // written by the consumer
+    uint8_t m_data[SIZE];
+
+    void copy_in(uint64_t pos, const uint8_t* src, size_t len)
+    {
+        size_t off = pos % SIZE;
+        size_t first = std::min(len, SIZE - off);
+        memcpy(&m_data[off], src, first);
+        memcpy(&m_data[0], src + first, len - first);
+    }
+
+    void copy_out(uint64_t pos, uint8_t* dst, size_t len) const
+    {
+        size_t off = pos % SIZE;
+        size_t first = std::min(len, SIZE - off);
+        memcpy(dst, &m_data[off], first);
+        memcpy(dst + first, &m_data[0], len - first);
+    }
+
+public:
+    using part = std::pair<const void*, size_t>;
+
+    void init()
+    {
+        m_head.store(0);
+        m_tail.store(0);
+    }
+
+    static bool fits(size_t len) { return len + sizeof(uint32_t) <= SIZE; }
+
+    /*
+     * Push the concatenation of parts as one message. While the ring is full, wait
+     * until give_up() returns true. False if the message can't fit, or we gave up.
+     */
+    template <typename GiveUp>
+    bool push(std::initializer_list<part> parts, GiveUp give_up)
+    {
+        size_t len = 0;
+        for (auto& p : parts) len += p.second;
+        if (!fits(len)) return false;
+
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        while (SIZE - (head - m_tail.load(std::memory_order_acquire)) < len + sizeof(uint32_t)) {
+            if (give_up()) return false;
+            std::this_thread::yield();
+        }
+
+        uint32_t len32 = len;
+        copy_in(head, reinterpret_cast<const uint8_t*>(&len32), sizeof(len32));
+        head += sizeof(len32);
+        for (auto& p : parts) {
+            copy_in(head, static_cast<const uint8_t*>(p.first), p.second);
+            head += p.second;
+        }
+        m_head.store(head, std::memory_order_release);
+        return true;
+    }
+
+    bool readable() const { return m_head.load(std::memory_order_acquire) != m_tail.load(std::memory_order_relaxed); }
+
+    /* Pop the next message into buf, false if there is none */
+    bool pop(std::vector<uint8_t>& buf)
+    {
+        if (!readable()) return false;
+
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        uint32_t len;
+        copy_out(tail, reinterpret_cast<uint8_t*>(&len), sizeof(len));
+        buf.resize(len);
+        copy_out(tail + sizeof(len), buf.data(), len);
+        m_tail.store(tail + sizeof(len) + len, std::memory_order_release);
+        return true;
+    }
+};
+
+/**
+ * @brief Shared memory segment holding a request and a response ring per port
+ */
+class ShmemRingSegment
+{
+public:
+    struct channel {
+        ShmemRing req;
+        ShmemRing resp;
+    };
+
+    static constexpr int PUSH_TIMEOUT_MS = 5000;
+
+    std::atomic<uint32_t> m_closed;
+    uint32_t m_nports;
+    Doorbell req_bell;
+    Doorbell resp_bell;
+
+    static size_t size_for(uint32_t nports) { return sizeof(ShmemRingSegment) + nports * sizeof(channel); }
+
+    /* Construct the segment in freshly created shared memory */
+    static ShmemRingSegment* init(uint8_t* mem, uint32_t nports)
+    {
+        ShmemRingSegment* seg = new (mem) ShmemRingSegment();
+        seg->m_closed.store(0);
+        seg->m_nports = nports;
+        seg->req_bell.init();
+        seg->resp_bell.init();
+        for (uint32_t i = 0; i < nports; i++) {
+            channel* ch = new (&seg->get_channel(i)) channel();
+            ch->req.init();
+            ch->resp.init();
+        }
+        return seg;
+    }
+
+    static ShmemRingSegment* join(uint8_t* mem) { return reinterpret_cast<ShmemRingSegment*>(mem); }
+
+    uint32_t nports() const { return m_nports; }
+
+    channel& get_channel(uint32_t i) { return reinterpret_cast<channel*>(this + 1)[i]; }
+
+    bool is_closed() const { return m_closed.load(); }
+
+    /*
+     * Push a message to ring, a ring of this segment. Gives up if the segment is
+     * closed, or if the peer did not make room within PUSH_TIMEOUT_MS: each port
+     * has a single request in flight, so a full ring means the peer is gone.
+     */
+    bool push(ShmemRing& ring, std::initializer_list<ShmemRing::part> parts)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(PUSH_TIMEOUT_MS);
+        return ring.push(parts, [&]() { return is_closed() || std::chrono::steady_clock::now() > deadline; });
+    }
+
+    void close()
+    {
+        m_closed.store(1);
+        req_bell.ring();
+        resp_bell.ring();
+    }
+};
+
+} // namespace gs
+
+#endif
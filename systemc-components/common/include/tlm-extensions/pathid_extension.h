@@ -8,9 +8,18 @@
 #ifndef _GREENSOCS_PATHID_EXTENSION_H
 #define _GREENSOCS_PATHID_EXTENSION_H
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <stdexcept>
+
 #include <systemc>
 #include <tlm>
 
+#ifndef GS_PATHID_MAX_DEPTH
+#define GS_PATHID_MAX_DEPTH 16
+#endif
+
 namespace gs {
 
 /**
@@ -20,13 +29,34 @@ namespace gs {
  *
  * @details Embeds an  ID field in the txn, which is populated as the network
  * is traversed - see README.
+ *
+ * The path is stored inline, with room for GS_PATHID_MAX_DEPTH hops, so that
+ * stamping a transaction never allocates. push_back() throws std::length_error
+ * past that depth; define GS_PATHID_MAX_DEPTH for deeper networks.
+ *
+ * It is no longer a std::vector<int>: only size, indexing, front/back,
+ * iteration, comparison, push_back, pop_back and clear are kept. Code using
+ * other vector members (at, data, insert...) must use the iterators instead.
  */
 
-class PathIDExtension : public tlm::tlm_extension<PathIDExtension>, public std::vector<int>
+class PathIDExtension : public tlm::tlm_extension<PathIDExtension>
 {
+public:
+    static constexpr size_t MAX_DEPTH = GS_PATHID_MAX_DEPTH;
+
+    using value_type = int;
+    using size_type = size_t;
+    using iterator = int*;
+    using const_iterator = const int*;
+
+private:
+    std::array<int, MAX_DEPTH> m_path;
+    size_type m_size = 0;
+
 public:
     PathIDExtension() = default;
     PathIDExtension(const PathIDExtension&) = default;
+    PathIDExtension& operator=(const PathIDExtension&) = default;
 
 public:
     virtual tlm_extension_base* clone() const override { return new PathIDExtension(*this); }
@@ -36,6 +66,44 @@ public:
         const PathIDExtension& other = static_cast<const PathIDExtension&>(ext);
         *this = other;
     }
+
+    void push_back(int id)
+    {
+        if (m_size == MAX_DEPTH) {
+            throw std::length_error("PathIDExtension: path is deeper than GS_PATHID_MAX_DEPTH");
+        }
+        m_path[m_size++] = id;
+    }
+
+    void pop_back()
+    {
+        assert(m_size);
+        m_size--;
+    }
+
+    void clear() { m_size = 0; }
+
+    size_type size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    int& back() { return m_path[m_size - 1]; }
+    int back() const { return m_path[m_size - 1]; }
+    int& front() { return m_path[0]; }
+    int front() const { return m_path[0]; }
+    int& operator[](size_type i) { return m_path[i]; }
+    int operator[](size_type i) const { return m_path[i]; }
+
+    iterator begin() { return m_path.data(); }
+    iterator end() { return m_path.data() + m_size; }
+    const_iterator begin() const { return m_path.data(); }
+    const_iterator end() const { return m_path.data() + m_size; }
+
+    bool operator==(const PathIDExtension& o) const { return std::equal(begin(), end(), o.begin(), o.end()); }
+    bool operator!=(const PathIDExtension& o) const { return !(*this == o); }
+    bool operator<(const PathIDExtension& o) const
+    {
+        return std::lexicographical_compare(begin(), end(), o.begin(), o.end());
+    }
 };
 } // namespace gs
 #endif
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022-2023 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ * Author: GreenSocs 2022
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _GREENSOCS_THREAD_SAFE_HINT_H
+#define _GREENSOCS_THREAD_SAFE_HINT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include <systemc>
+#include <tlm>
+
+namespace gs {
+
+/**
+ * @class Thread safe hint TLM extension
+ *
+ * @brief Thread safe hint TLM extension
+ *
+ * @details Attached by an initiator that would like to call b_transport from
+ * outside of the SystemC thread. Each router on the path narrows the range to
+ * the target it decodes to if that target is marked thread_safe, and marks the
+ * transaction unsafe otherwise. The range is held as distances below and above
+ * the transaction address, so that it is unaffected by routers translating the
+ * address on the way.
+ */
+class ThreadSafeHintExtension : public tlm::tlm_extension<ThreadSafeHintExtension>
+{
+    enum state { UNKNOWN, SAFE, UNSAFE };
+
+    state m_state = UNKNOWN;
+    uint64_t m_below = std::numeric_limits<uint64_t>::max();
+    uint64_t m_above = std::numeric_limits<uint64_t>::max();
+
+public:
+    ThreadSafeHintExtension() = default;
+    ThreadSafeHintExtension(const ThreadSafeHintExtension&) = default;
+
+    virtual tlm_extension_base* clone() const override { return new ThreadSafeHintExtension(*this); }
+
+    virtual void copy_from(const tlm_extension_base& ext) override
+    {
+        const ThreadSafeHintExtension& other = static_cast<const ThreadSafeHintExtension&>(ext);
+        *this = other;
+    }
+
+    void reset()
+    {
+        m_state = UNKNOWN;
+        m_below = std::numeric_limits<uint64_t>::max();
+        m_above = std::numeric_limits<uint64_t>::max();
+    }
+
+    /* [start, end] (inclusive) around addr decodes to a thread safe target */
+    void narrow(uint64_t addr, uint64_t start, uint64_t end)
+    {
+        if (m_state == UNSAFE) return;
+        m_state = SAFE;
+        m_below = std::min(m_below, addr - start);
+        m_above = std::min(m_above, end - addr);
+    }
+
+    void set_unsafe() { m_state = UNSAFE; }
+
+    bool is_safe() const { return m_state == SAFE; }
+
+    /* Bounds of the safe range, relative to the address the initiator issued */
+    uint64_t get_start(uint64_t addr) const { return addr - std::min(m_below, addr); }
+    uint64_t get_end(uint64_t addr) const
+    {
+        return addr + std::min(m_above, std::numeric_limits<uint64_t>::max() - addr);
+    }
+};
+} // namespace gs
+#endif
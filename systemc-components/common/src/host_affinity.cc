@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <host_affinity.h>
+
+bool gs::parse_host_cpus(const std::string& list, std::vector<int>& cpus)
+{
+    std::vector<int> out;
+    std::stringstream ss(list);
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        item.erase(std::remove(item.begin(), item.end(), ' '), item.end());
+        if (item.empty()) continue;
+
+        size_t dash = item.find('-');
+        try {
+            size_t end;
+            int first = std::stoi(item.substr(0, dash), &end);
+            if (end != item.substr(0, dash).size()) return false;
+            int last = first;
+            if (dash != std::string::npos) {
+                std::string l = item.substr(dash + 1);
+                last = std::stoi(l, &end);
+                if (end != l.size()) return false;
+            }
+            if (first < 0 || last < first) return false;
+            for (int c = first; c <= last; c++) out.push_back(c);
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    cpus = out;
+    return true;
+}
+
+std::string gs::format_host_cpus(const std::vector<int>& cpus)
+{
+    std::stringstream ss;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+        if (i) ss << ",";
+        ss << cpus[i];
+        if (j > i) ss << "-" << cpus[j];
+        i = j + 1;
+    }
+    return ss.str();
+}
+
+#ifdef __linux__
+static std::vector<int> cpus_of(const cpu_set_t& set)
+{
+    std::vector<int> cpus;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &set)) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+/* Field n of the stat of a thread, as numbered in proc(5), or -1 */
+static long long stat_field_of(long tid, int n)
+{
+    std::ifstream f("/proc/self/task/" + std::to_string(tid) + "/stat");
+    std::string stat;
+    if (!std::getline(f, stat)) return -1;
+
+    /* The command name may hold spaces, count the fields after it */
+    size_t pos = stat.rfind(')');
+    if (pos == std::string::npos) return -1;
+    std::stringstream ss(stat.substr(pos + 2));
+    std::string field;
+    for (int i = 3; i <= n && ss >> field; i++) {
+        if (i == n) return std::stoll(field);
+    }
+    return -1;
+}
+
+/* The core a thread last ran on */
+static int last_cpu_of(long tid) { return int(stat_field_of(tid, 39)); }
+
+/* When a thread started, which tells it apart from an earlier thread with the same tid */
+static long long start_time_of(long tid) { return stat_field_of(tid, 22); }
+
+static void set_of(const std::vector<int>& cpus, cpu_set_t& set)
+{
+    CPU_ZERO(&set);
+    for (int c : cpus) {
+        if (c < CPU_SETSIZE) CPU_SET(c, &set);
+    }
+}
+#endif
+
+gs::HostPlacement& gs::HostPlacement::get()
+{
+    static HostPlacement placement;
+    return placement;
+}
+
+void gs::HostPlacement::reserve(const std::vector<int>& cpus)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reserved = cpus;
+    m_unreserved.clear();
+
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int c : cpus_of(set)) {
+            if (std::find(cpus.begin(), cpus.end(), c) == cpus.end()) m_unreserved.push_back(c);
+        }
+    }
+#endif
+}
+
+int gs::HostPlacement::place(const std::string& name, const std::vector<int>& cpus)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    entry e{ name, 0, -1, cpus.empty() ? "any" : format_host_cpus(cpus), 0 };
+
+#ifdef __linux__
+    e.tid = syscall(SYS_gettid);
+    e.start_time = start_time_of(e.tid);
+    /* The thread may have been moved by place_unplaced() before placing itself */
+    m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+                                   [&e](const entry& o) { return o.tid == e.tid; }),
+                    m_entries.end());
+
+    cpu_set_t set;
+    if (!cpus.empty()) {
+        set_of(cpus, set);
+    } else if (!m_reserved.empty()) {
+        /* Everything the process may use, but the reserved cores, whatever the caller was pinned to */
+        set_of(m_unreserved, set);
+        e.requested = "any but " + format_host_cpus(m_reserved);
+    }
+    if ((!cpus.empty() || !m_reserved.empty()) && sched_setaffinity(0, sizeof(set), &set) != 0) {
+        e.error = errno;
+    }
+#else
+    if (!cpus.empty() || !m_reserved.empty()) {
+        e.error = ENOTSUP;
+    }
+#endif
+
+    m_entries.push_back(e);
+    return e.error;
+}
+
+int gs::HostPlacement::place_unplaced(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int moved = 0;
+
+    /* Without reserved cores, unplaced threads are left wherever they are */
+    if (m_reserved.empty()) return 0;
+
+#ifdef __linux__
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir) return 0;
+
+    std::vector<std::pair<long, long long>> live;
+    while (struct dirent* d = readdir(dir)) {
+        if (d->d_name[0] == '.') continue;
+        long tid = std::strtol(d->d_name, nullptr, 10);
+        live.emplace_back(tid, start_time_of(tid));
+    }
+    closedir(dir);
+
+    /*
+     * Forget the threads that are gone: those found here, so that the list does not grow, and those
+     * whose tid was reused. Explicitly placed threads are kept, to be reported as exited.
+     */
+    m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+                                   [&](const entry& e) {
+                                       auto it = std::find_if(live.begin(), live.end(),
+                                                              [&e](const std::pair<long, long long>& t) {
+                                                                  return t.first == e.tid;
+                                                              });
+                                       if (it == live.end()) return e.unplaced;
+                                       return it->second != e.start_time;
+                                   }),
+                    m_entries.end());
+
+    cpu_set_t set;
+    set_of(m_unreserved, set);
+
+    for (const auto& t : live) {
+        if (std::any_of(m_entries.begin(), m_entries.end(), [&t](const entry& e) { return e.tid == t.first; })) {
+            continue;
+        }
+
+        entry e{ name, t.first, t.second, "any but " + format_host_cpus(m_reserved), 0 };
+        e.unplaced = true;
+        if (sched_setaffinity(t.first, sizeof(set), &set) != 0) {
+            /* The thread may have exited meanwhile */
+            if (errno == ESRCH) continue;
+            e.error = errno;
+        } else {
+            moved++;
+        }
+        m_entries.push_back(e);
+    }
+#endif
+
+    return moved;
+}
+
+std::string gs::HostPlacement::report()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::stringstream ss;
+
+    ss << "Host placement of the simulation threads";
+    if (!m_reserved.empty()) ss << " (reserved cores " << format_host_cpus(m_reserved) << ")";
+    ss << ":";
+    for (const auto& e : m_entries) {
+        ss << "\n  " << e.name << " (tid " << e.tid << "): requested " << e.requested;
+        if (e.error) {
+            ss << ", failed: " << std::strerror(e.error);
+            continue;
+        }
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(e.tid, sizeof(set), &set) == 0) {
+            ss << ", affinity " << format_host_cpus(cpus_of(set)) << ", last ran on " << last_cpu_of(e.tid);
+        } else {
+            ss << ", exited";
+        }
+#endif
+    }
+    return ss.str();
+}
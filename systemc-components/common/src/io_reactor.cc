@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include <io_reactor.h>
+
+/* Read at most this many times per wake up, so that a busy fd can't starve the others */
+#define IO_REACTOR_MAX_READS 16
+#define IO_REACTOR_MAX_EVENTS 64
+#define IO_WRITER_MAX_IOV 64
+
+gs::IoReactor& gs::IoReactor::get()
+{
+    static IoReactor reactor;
+    return reactor;
+}
+
+gs::IoReactor::IoReactor()
+{
+    if (::pipe(m_wake) < 0) {
+        perror("IoReactor pipe");
+        _Exit(EXIT_FAILURE);
+    }
+    for (int fd : m_wake) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#ifdef __linux__
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epfd < 0) {
+        perror("IoReactor epoll_create1");
+        _Exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_wake[0];
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wake[0], &ev);
+#endif
+    m_thread = std::thread(&IoReactor::run, this);
+}
+
+gs::IoReactor::~IoReactor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    wake();
+    if (m_thread.joinable()) m_thread.join();
+#ifdef __linux__
+    ::close(m_epfd);
+#endif
+    ::close(m_wake[0]);
+    ::close(m_wake[1]);
+}
+
+void gs::IoReactor::wake()
+{
+    char c = 0;
+    if (!in_reactor_thread() && ::write(m_wake[1], &c, 1) < 0 && errno != EAGAIN) {
+        perror("IoReactor wake");
+    }
+}
+
+/* Must be called with m_mutex held */
+void gs::IoReactor::update(int fd, entry& e)
+{
+#ifdef __linux__
+    if (e.always_ready) return;
+
+    struct epoll_event ev = {};
+    ev.events = (e.on_readable ? uint32_t(EPOLLIN) : 0u) | (e.on_writable ? uint32_t(EPOLLOUT) : 0u);
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epfd, e.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) == 0) {
+        e.registered = true;
+    } else if (errno == EPERM) {
+        e.always_ready = true;
+    } else {
+        perror("IoReactor epoll_ctl");
+    }
+#endif
+}
+
+void gs::IoReactor::watch(int fd, event_cb on_readable)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& e = m_entries[fd];
+    if (!e) e = std::make_shared<entry>();
+    e->on_readable = std::make_shared<const event_cb>(std::move(on_readable));
+    update(fd, *e);
+    wake();
+}
+
+void gs::IoReactor::add_reader(int fd, read_cb on_read, event_cb on_close, size_t buf_size)
+{
+    bool nonblock = fcntl(fd, F_GETFL) & O_NONBLOCK;
+    auto buf = std::make_shared<std::vector<uint8_t>>(buf_size);
+
+    watch(fd, [this, fd, nonblock, buf, on_read, on_close]() {
+        for (int i = 0; i < IO_REACTOR_MAX_READS; i++) {
+            ssize_t r = ::read(fd, buf->data(), buf->size());
+            if (r > 0) {
+                on_read(buf->data(), r);
+                if (!nonblock) return;
+                continue;
+            }
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+
+            /* End of file, or an error */
+            remove(fd);
+            if (on_close) on_close();
+            return;
+        }
+    });
+}
+
+void gs::IoReactor::remove(int fd)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(fd);
+    if (it == m_entries.end()) return;
+#ifdef __linux__
+    if (it->second->registered) epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+    m_entries.erase(it);
+    wake();
+    if (!in_reactor_thread()) {
+        m_idle.wait(lock, [&]() { return m_busy_fd != fd; });
+    }
+}
+
+void gs::IoReactor::watch_writable(int fd, event_cb on_writable)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& e = m_entries[fd];
+    if (!e) e = std::make_shared<entry>();
+    e->on_writable = std::make_shared<const event_cb>(std::move(on_writable));
+    update(fd, *e);
+    wake();
+}
+
+void gs::IoReactor::unwatch_writable(int fd)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(fd);
+    if (it == m_entries.end()) return;
+    it->second->on_writable = nullptr;
+    if (!it->second->on_readable) {
+#ifdef __linux__
+        if (it->second->registered) epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+        m_entries.erase(it);
+    } else {
+        update(fd, *it->second);
+    }
+}
+
+void gs::IoReactor::call_after(std::chrono::microseconds delay, event_cb fn)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_timers.emplace(clock::now() + delay, std::move(fn));
+    wake();
+}
+
+/* Must be called with m_mutex held */
+int gs::IoReactor::next_timeout()
+{
+    for (auto& e : m_entries) {
+        if (e.second->always_ready) return 0;
+    }
+    if (m_timers.empty()) return -1;
+
+    auto wait = m_timers.begin()->first - clock::now();
+    if (wait <= clock::duration::zero()) return 0;
+    /* Round up, so that timers are not polled for until they are due */
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(wait + std::chrono::milliseconds(1) -
+                                                                    clock::duration(1));
+    return std::min<int64_t>(ms.count(), INT_MAX);
+}
+
+void gs::IoReactor::wait(int timeout_ms, std::vector<std::pair<int, int>>& ready)
+{
+#ifdef __linux__
+    struct epoll_event events[IO_REACTOR_MAX_EVENTS];
+    int n = epoll_wait(m_epfd, events, IO_REACTOR_MAX_EVENTS, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        int what = 0;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) what |= READABLE;
+        if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) what |= WRITABLE;
+        ready.emplace_back(int(events[i].data.fd), what);
+    }
+#else
+    std::vector<struct pollfd> fds;
+    fds.push_back({ m_wake[0], POLLIN, 0 });
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& e : m_entries) {
+            short events = (e.second->on_readable ? POLLIN : 0) | (e.second->on_writable ? POLLOUT : 0);
+            fds.push_back({ e.first, events, 0 });
+        }
+    }
+    if (poll(fds.data(), fds.size(), timeout_ms) <= 0) return;
+    for (auto& p : fds) {
+        int what = 0;
+        if (p.revents & (POLLIN | POLLHUP | POLLERR)) what |= READABLE;
+        if (p.revents & (POLLOUT | POLLERR | POLLHUP)) what |= WRITABLE;
+        if (what) ready.emplace_back(p.fd, what);
+    }
+#endif
+}
+
+void gs::IoReactor::dispatch(int fd, int what)
+{
+    /* Keeps the callback alive, even if it removes or replaces itself */
+    shared_cb cb;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(fd);
+        if (it == m_entries.end()) return;
+        cb = (what == READABLE) ? it->second->on_readable : it->second->on_writable;
+        if (!cb) return;
+        m_busy_fd = fd;
+    }
+
+    (*cb)();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_busy_fd = -1;
+    m_idle.notify_all();
+}
+
+void gs::IoReactor::run_timers()
+{
+    for (;;) {
+        event_cb fn;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_timers.empty() || m_timers.begin()->first > clock::now()) return;
+            fn = std::move(m_timers.begin()->second);
+            m_timers.erase(m_timers.begin());
+        }
+        fn();
+    }
+}
+
+void gs::IoReactor::run()
+{
+    std::vector<std::pair<int, int>> ready;
+    std::vector<int> always_ready;
+
+    for (;;) {
+        int timeout;
+        always_ready.clear();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) return;
+            timeout = next_timeout();
+            for (auto& e : m_entries) {
+                if (e.second->always_ready) always_ready.push_back(e.first);
+            }
+        }
+
+        ready.clear();
+        wait(timeout, ready);
+
+        for (auto& r : ready) {
+            if (r.first == m_wake[0]) {
+                char buf[64];
+                while (::read(m_wake[0], buf, sizeof(buf)) > 0) {
+                }
+                continue;
+            }
+            if (r.second & READABLE) dispatch(r.first, READABLE);
+            if (r.second & WRITABLE) dispatch(r.first, WRITABLE);
+        }
+        for (int fd : always_ready) {
+            dispatch(fd, READABLE);
+            dispatch(fd, WRITABLE);
+        }
+        run_timers();
+    }
+}
+
+bool gs::IoWriter::policy_from_string(const std::string& str, FlushPolicy& policy)
+{
+    if (str == "immediate") {
+        policy = FlushPolicy::IMMEDIATE;
+    } else if (str == "line") {
+        policy = FlushPolicy::LINE;
+    } else if (str == "deferred") {
+        policy = FlushPolicy::DEFERRED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+gs::IoWriter::IoWriter(FlushPolicy policy, size_t threshold, std::chrono::microseconds delay, size_t max_pending)
+    : m_state(std::make_shared<state>())
+{
+    m_state->policy = policy;
+    m_state->threshold = threshold;
+    m_state->delay = delay;
+    m_state->max_pending = max_pending;
+}
+
+gs::IoWriter::~IoWriter() { set_fd(-1); }
+
+void gs::IoWriter::set_policy(FlushPolicy policy, size_t threshold, std::chrono::microseconds delay)
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    m_state->policy = policy;
+    m_state->threshold = threshold;
+    m_state->delay = delay;
+}
+
+void gs::IoWriter::set_fd(int fd)
+{
+    int old_fd;
+    bool was_waiting;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        old_fd = m_state->fd;
+        was_waiting = m_state->wait_writable;
+        m_state->drop();
+        m_state->fd = fd;
+        m_state->wait_writable = false;
+        m_state->error = 0;
+
+        struct stat st;
+        m_state->is_socket = fd >= 0 && fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+    }
+    /* Outside of the lock, as the reactor may be waiting for it to run our callback */
+    if (was_waiting && old_fd >= 0) IoReactor::get().unwatch_writable(old_fd);
+}
+
+void gs::IoWriter::state::drop()
+{
+    chunks.clear();
+    head_off = 0;
+    pending = 0;
+    drained.notify_all();
+}
+
+void gs::IoWriter::state::arm_timer(const std::shared_ptr<state>& self)
+{
+    if (timer_armed) return;
+    timer_armed = true;
+
+    std::weak_ptr<state> weak = self;
+    IoReactor::get().call_after(delay, [weak]() {
+        auto s = weak.lock();
+        if (!s) return;
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->timer_armed = false;
+        s->flush_locked(s);
+    });
+}
+
+/* Must be called with mutex held */
+void gs::IoWriter::state::flush_locked(const std::shared_ptr<state>& self)
+{
+    while (pending && !wait_writable && fd >= 0) {
+        struct iovec iov[IO_WRITER_MAX_IOV];
+        int n = 0;
+        for (auto it = chunks.begin(); it != chunks.end() && n < IO_WRITER_MAX_IOV; ++it, ++n) {
+            size_t off = (n == 0) ? head_off : 0;
+            iov[n].iov_base = it->data() + off;
+            iov[n].iov_len = it->size() - off;
+        }
+
+        ssize_t r;
+        if (is_socket) {
+            /* Don't get killed by a SIGPIPE if the other end went away */
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+            r = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        } else {
+            r = ::writev(fd, iov, n);
+        }
+
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* Let the reactor finish the job once fd is writable */
+                wait_writable = true;
+                std::weak_ptr<state> weak = self;
+                int wfd = fd;
+                IoReactor::get().watch_writable(fd, [weak, wfd]() {
+                    auto s = weak.lock();
+                    if (!s) {
+                        IoReactor::get().unwatch_writable(wfd);
+                        return;
+                    }
+                    std::lock_guard<std::mutex> lock(s->mutex);
+                    if (s->fd != wfd) return;
+                    IoReactor::get().unwatch_writable(wfd);
+                    s->wait_writable = false;
+                    s->flush_locked(s);
+                });
+                return;
+            }
+            error = errno;
+            drop();
+            return;
+        }
+
+        pending -= r;
+        size_t left = r;
+        while (left) {
+            size_t avail = chunks.front().size() - head_off;
+            if (left < avail) {
+                head_off += left;
+                break;
+            }
+            left -= avail;
+            head_off = 0;
+            chunks.pop_front();
+        }
+    }
+    if (!pending) drained.notify_all();
+}
+
+void gs::IoWriter::write(const uint8_t* data, size_t len)
+{
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    state& s = *m_state;
+
+    if (s.fd < 0 || !len) return;
+
+    if (s.max_pending && !IoReactor::get().in_reactor_thread()) {
+        s.drained.wait(lock, [&]() { return s.pending < s.max_pending || s.fd < 0; });
+        if (s.fd < 0) return;
+    }
+
+    /* Fill the last chunk up before starting a new one, to keep the number of iovecs down */
+    size_t off = 0;
+    if (!s.chunks.empty()) {
+        auto& last = s.chunks.back();
+        size_t room = (last.capacity() > last.size()) ? last.capacity() - last.size() : 0;
+        size_t n = std::min(room, len);
+        last.insert(last.end(), data, data + n);
+        off = n;
+    }
+    if (off < len) {
+        s.chunks.emplace_back();
+        s.chunks.back().reserve(std::max(size_t(CHUNK_SIZE), len - off));
+        s.chunks.back().insert(s.chunks.back().end(), data + off, data + len);
+    }
+    s.pending += len;
+
+    switch (s.policy) {
+    case FlushPolicy::IMMEDIATE:
+        s.flush_locked(m_state);
+        break;
+    case FlushPolicy::LINE:
+        if (s.pending >= s.threshold || memchr(data, '\n', len)) {
+            s.flush_locked(m_state);
+        } else {
+            s.arm_timer(m_state);
+        }
+        break;
+    case FlushPolicy::DEFERRED:
+        if (s.pending >= s.threshold) {
+            s.flush_locked(m_state);
+        } else {
+            s.arm_timer(m_state);
+        }
+        break;
+    }
+}
+
+void gs::IoWriter::flush()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    m_state->flush_locked(m_state);
+}
+
+size_t gs::IoWriter::pending()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->pending;
+}
+
+int gs::IoWriter::error()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->error;
+}
+
+#endif
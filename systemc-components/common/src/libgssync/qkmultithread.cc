@@ -5,8 +5,8 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 
+#include <chrono>
 #include <mutex>
-#include <condition_variable>
 #include <functional>
 #ifndef SC_INCLUDE_DYNAMIC_PROCESSES
 #define SC_INCLUDE_DYNAMIC_PROCESSES
@@ -18,43 +18,68 @@
 #include <async_event.h>
 #include <qk_extendedif.h>
 #include <qkmultithread.h>
+#include <qk_controller.h>
 #include <libgsutils.h>
 #include <uutils.h>
 
 namespace gs {
+void tlm_quantumkeeper_multithread::suspend_systemc()
+{
+    if (!m_sc_suspended) {
+        m_sc_suspended = true;
+        m_suspended_since = std::chrono::steady_clock::now();
+        m_suspends.fetch_add(1, std::memory_order_relaxed);
+    }
+    sc_core::sc_suspend_all();
+}
+
+void tlm_quantumkeeper_multithread::unsuspend_systemc()
+{
+    if (m_sc_suspended) {
+        m_sc_suspended = false;
+        m_suspended_hist.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                                   m_suspended_since)
+                                 .count());
+        m_unsuspends.fetch_add(1, std::memory_order_relaxed);
+    }
+    sc_core::sc_unsuspend_all();
+}
+
 /* constantly monitor SystemC and dont let it get ahead of the
    local_time - this is the tlm2.0 rule (h) */
 void tlm_quantumkeeper_multithread::timehandler()
 {
-    std::unique_lock<std::mutex> lock(mutex);
-
     if (status != RUNNING) {
         // NB must be handled from within timehandler SC_METHOD process
         // Otherwise the sc_unsuspend wont be in the right process
         m_systemc_waiting = false;
         SCP_TRACE(())("Unsuspending (stopped)");
-        sc_core::sc_unsuspend_all();
+        unsuspend_systemc();
+        m_budget_bell.ring();
         return;
     }
+
+    // Say we are waiting before looking at the local time: either the running thread publishes
+    // its time after this, and sees it (and nudges us), or we see its time.
+    m_systemc_waiting = true;
     if ((get_current_time() > sc_core::sc_time_stamp())) {
         // UnSuspend SystemC if local time is ahead of systemc time
         m_systemc_waiting = false;
         SCP_TRACE(())("Unsuspending");
-        sc_core::sc_unsuspend_all();
+        unsuspend_systemc();
         sc_core::sc_time m_quantum = tlm_utils::tlm_quantumkeeper::get_global_quantum();
         m_tick.notify(std::min(get_current_time() - sc_core::sc_time_stamp(), m_quantum));
     } else {
         // Suspend SystemC if SystemC has caught up with our
         // local_time
-        m_systemc_waiting = true;
         SCP_TRACE(())("Suspending");
-        sc_core::sc_suspend_all();
+        suspend_systemc();
     }
 
-    cond.notify_all(); // nudge the sync thread, in case it's waiting for us
+    m_budget_bell.ring(); // nudge the sync thread, in case it's waiting for us
 }
 
-tlm_quantumkeeper_multithread::~tlm_quantumkeeper_multithread() { cond.notify_all(); }
+tlm_quantumkeeper_multithread::~tlm_quantumkeeper_multithread() { m_budget_bell.ring(); }
 
 // The quantum keeper should be instanced in SystemC
 // but it's functions may be called from other threads
@@ -63,6 +88,7 @@ tlm_quantumkeeper_multithread::tlm_quantumkeeper_multithread()
     : m_systemc_thread_id(std::this_thread::get_id()), status(NONE), m_tick(false) /* handle attach manually */
 {
     SCP_TRACE(())("Constructor");
+    m_budget_bell.init();
     sc_core::sc_spawn_options opt;
     opt.spawn_method();
     opt.set_sensitivity(&m_tick);
@@ -87,8 +113,11 @@ bool tlm_quantumkeeper_multithread::is_sysc_thread() const
 
 void tlm_quantumkeeper_multithread::start(std::function<void()> job)
 {
+    // CPUs (re)start the QK after every run, only the first one matters
+    if (status.exchange(RUNNING) == RUNNING && !job) {
+        return;
+    }
     SCP_TRACE(())("Start");
-    status = RUNNING;
     m_tick.async_attach_suspending();
     m_tick.notify(sc_core::SC_ZERO_TIME);
     if (job) {
@@ -105,7 +134,7 @@ void tlm_quantumkeeper_multithread::stop()
             std::unique_lock<std::mutex> lock(mutex);
             status = STOPPED;
             m_tick.notify(sc_core::SC_ZERO_TIME);
-            cond.notify_all();
+            m_budget_bell.ring();
             m_tick.async_detach_suspending();
         }
 
@@ -132,7 +161,11 @@ sc_core::sc_time tlm_quantumkeeper_multithread::time_to_sync()
  * Overloaded Functions
  */
 
-void tlm_quantumkeeper_multithread::inc(const sc_core::sc_time& t) { m_local_time += t; }
+void tlm_quantumkeeper_multithread::inc(const sc_core::sc_time& t)
+{
+    m_local_time += t;
+    publish_local_time();
+}
 
 /* NB, if used outside SystemC, SystemC time may vary */
 void tlm_quantumkeeper_multithread::set(const sc_core::sc_time& t)
@@ -141,12 +174,18 @@ void tlm_quantumkeeper_multithread::set(const sc_core::sc_time& t)
     // quietly refuse to move time backwards
     if (t + sc_core::sc_time_stamp() >= m_local_time) {
         m_local_time = t + sc_core::sc_time_stamp(); // NB, we store the absolute time.
+        publish_local_time();
+    }
+    if (is_sysc_thread()) {
+        m_tick.notify(sc_core::SC_ZERO_TIME);
+    } else {
+        nudge_systemc();
     }
-    m_tick.notify(sc_core::SC_ZERO_TIME);
 }
 
 void tlm_quantumkeeper_multithread::sync()
 {
+    count_sync();
     if (is_sysc_thread()) {
         assert(m_local_time >= sc_core::sc_time_stamp());
         sc_core::sc_time t = m_local_time - sc_core::sc_time_stamp();
@@ -155,18 +194,38 @@ void tlm_quantumkeeper_multithread::sync()
             sc_core::wait(t);
         }
     } else {
-        std::unique_lock<std::mutex> lock(mutex);
         /* Wake up the SystemC thread if it's waiting for us to keep up */
-        m_tick.notify(sc_core::SC_ZERO_TIME);
+        nudge_systemc();
+        if (status != RUNNING || time_to_sync() != sc_core::SC_ZERO_TIME) {
+            return;
+        }
+
         /* Wait for some run budget */
+        m_budget_exhaustions.fetch_add(1, std::memory_order_relaxed);
         m_extern_waiting = true;
-        while (status == RUNNING && time_to_sync() == sc_core::SC_ZERO_TIME) {
-            if (cond.wait_for(lock, std::chrono::seconds(1)) == std::cv_status::timeout) {
+        auto start = std::chrono::steady_clock::now();
+        auto last = start;
+        for (;;) {
+            uint32_t seen = m_budget_bell.value();
+            if (status != RUNNING || time_to_sync() != sc_core::SC_ZERO_TIME) {
+                break;
+            }
+            m_budget_bell.wait(seen);
+            if (std::chrono::steady_clock::now() - last >= std::chrono::seconds(1)) {
                 SCP_WARN(())("wait_for timeout");
+                m_wait_timeouts.fetch_add(1, std::memory_order_relaxed);
                 m_tick.notify(sc_core::SC_ZERO_TIME);
+                last = std::chrono::steady_clock::now();
             }
         }
         m_extern_waiting = false;
+
+        uint64_t blocked = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                                start)
+                               .count();
+        m_blocked_ns.fetch_add(blocked, std::memory_order_relaxed);
+        m_blocked_hist.add(blocked);
+        SyncStats::add(SyncStats::get().stall_ns, blocked);
     }
 }
 
@@ -174,18 +233,23 @@ void tlm_quantumkeeper_multithread::reset()
 {
     // As we use absolute time, we reset to the current sc_time
     m_local_time = sc_core::sc_time_stamp();
+    publish_local_time();
     m_tick.notify(sc_core::SC_ZERO_TIME);
 }
 
-sc_core::sc_time tlm_quantumkeeper_multithread::get_current_time() const { return m_local_time; }
+sc_core::sc_time tlm_quantumkeeper_multithread::get_current_time() const
+{
+    return sc_core::sc_time::from_value(m_published_time.load());
+}
 
 /* NB not thread safe, you're time may vary, you should really be
  * calling this from SystemC */
 sc_core::sc_time tlm_quantumkeeper_multithread::get_local_time() const
 {
     sc_core::sc_time sc_t = sc_core::sc_time_stamp();
-    if (m_local_time >= sc_t)
-        return m_local_time - sc_t;
+    sc_core::sc_time local_time = get_current_time();
+    if (local_time >= sc_t)
+        return local_time - sc_t;
     else
         return sc_core::SC_ZERO_TIME;
 }
@@ -8,6 +8,7 @@
 #define SC_ALLOW_DEPRECATED_IEEE_API
 #include <systemc>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
@@ -29,6 +30,8 @@
 
 #include <scp/report.h>
 
+#include <io_reactor.h>
+
 #include "backends/tap.h"
 
 using namespace sc_core;
@@ -67,7 +70,11 @@ void NetworkBackendTap::open(std::string& tun)
 #endif
     SCP_DEBUG(SCMOD) << "TAP opened";
 
-    new std::thread(&NetworkBackendTap::rcv_thread, this);
+    /* Each read returns a single frame, the reactor drains all the pending ones on each wake up */
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+    gs::IoReactor::get().add_reader(
+        m_fd, [this](const uint8_t* data, size_t len) { receive(data, len); },
+        [this]() { SCP_WARN(SCMOD) << "TAP closed"; }, 9000);
 }
 
 void NetworkBackendTap::close()
@@ -75,41 +82,31 @@ void NetworkBackendTap::close()
     if (m_fd < 0) {
         return;
     }
+    gs::IoReactor::get().remove(m_fd);
     ::close(m_fd);
     m_fd = -1;
 }
 
-void* NetworkBackendTap::rcv_thread()
+/* Called by the reactor for each frame read */
+void NetworkBackendTap::receive(const uint8_t* data, size_t len)
 {
-    for (;;) {
-        Payload* frame = new Payload(9000);
-
-        int r = ::read(m_fd, frame->data(), (int)frame->capacity());
-        if (r > 0) {
-            if (r < 60) {
-                /*
-                 * Pad with zeroes as the minimal payload size is 60 bytes
-                 * (60 bytes of data + 4 bytes of crc -> 64bytes)
-                 */
-                std::memset(frame->data() + r, 0, 60 - r);
-                r = 60;
-            }
-            frame->resize(r);
-        } else {
-            /* error */
-            delete frame;
-        }
+    /*
+     * Pad with zeroes as the minimal payload size is 60 bytes
+     * (60 bytes of data + 4 bytes of crc -> 64bytes)
+     */
+    Payload* frame = new Payload(std::max<size_t>(len, 60));
+    std::memcpy(frame->data(), data, len);
+    if (len < 60) {
+        std::memset(frame->data() + len, 0, 60 - len);
+        len = 60;
+    }
+    frame->resize(len);
 
-        std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-        if (r > 0) {
-            SCP_TRACE(SCMOD) << "frame of size " << r << " EXT -> VP";
-            m_queue.push(frame);
-        }
-        if (!m_queue.empty()) {
-            m_event.async_notify();
-        }
-    }
+    SCP_TRACE(SCMOD) << "frame of size " << len << " EXT -> VP";
+    m_queue.push(frame);
+    m_event.async_notify();
 }
 
 void NetworkBackendTap::rcv()
@@ -138,9 +135,7 @@ void NetworkBackendTap::send(Payload& frame)
         return;
     }
     SCP_TRACE(SCMOD) << "frame of size " << frame.size() << " VP -> EXT";
-    // ::write(m_fd, frame.data(), (int)frame.size());
-
-    if (::write(m_fd, frame.data(), (int)frame.size()) != 1) {
+    if (::write(m_fd, frame.data(), frame.size()) != (ssize_t)frame.size()) {
         SCP_WARN(SCMOD) << "Write did not complete: " << strerror(errno);
     }
 }
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include <macs/offload.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define OFFLOAD_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace net_offload {
+
+static constexpr uint16_t ETH_P_IPV4 = 0x0800;
+static constexpr uint16_t ETH_P_IPV6 = 0x86dd;
+static constexpr uint16_t ETH_P_VLAN = 0x8100;
+static constexpr uint8_t PROTO_TCP = 6;
+static constexpr uint8_t PROTO_UDP = 17;
+
+static constexpr uint8_t TCP_FIN = 0x01;
+static constexpr uint8_t TCP_PSH = 0x08;
+static constexpr uint8_t TCP_CWR = 0x80;
+
+static inline uint16_t load16(const uint8_t* p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store16(uint8_t* p, uint16_t v) { memcpy(p, &v, sizeof(v)); }
+
+static inline uint32_t load32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store32(uint8_t* p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+
+/*
+ * Summing 32-bit words into a 64-bit accumulator and folding at the end gives
+ * the same result as summing 16-bit words, since 2^16 = 1 modulo 0xffff.
+ */
+static uint64_t csum_add_scalar(const uint8_t* buf, size_t len, uint64_t sum)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4) {
+        sum += load32(buf + i);
+    }
+    for (; i + 2 <= len; i += 2) {
+        sum += load16(buf + i);
+    }
+    if (i < len) {
+        /* The odd byte is padded with a zero, in the position it has on the wire */
+        uint8_t last[2] = { buf[i], 0 };
+        sum += load16(last);
+    }
+    return sum;
+}
+
+#ifdef OFFLOAD_X86_SIMD
+/*
+ * The vector versions sum the low and high bytes of each 16-bit word
+ * separately with psadbw, into 64-bit lanes that cannot overflow. The word
+ * sum is then low + (high << 8).
+ */
+static uint64_t csum_add_sse2(const uint8_t* buf, size_t len, uint64_t sum)
+{
+    const __m128i low_mask = _mm_set1_epi16(0x00ff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc_lo = zero;
+    __m128i acc_hi = zero;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+        acc_lo = _mm_add_epi64(acc_lo, _mm_sad_epu8(_mm_and_si128(v, low_mask), zero));
+        acc_hi = _mm_add_epi64(acc_hi, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+    }
+
+    uint64_t lo[2], hi[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lo), acc_lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hi), acc_hi);
+    sum += lo[0] + lo[1] + ((hi[0] + hi[1]) << 8);
+
+    return csum_add_scalar(buf + i, len - i, sum);
+}
+
+__attribute__((target("avx2"))) static uint64_t csum_add_avx2(const uint8_t* buf, size_t len, uint64_t sum)
+{
+    const __m256i low_mask = _mm256_set1_epi16(0x00ff);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc_lo = zero;
+    __m256i acc_hi = zero;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i));
+        acc_lo = _mm256_add_epi64(acc_lo, _mm256_sad_epu8(_mm256_and_si256(v, low_mask), zero));
+        acc_hi = _mm256_add_epi64(acc_hi, _mm256_sad_epu8(_mm256_srli_epi16(v, 8), zero));
+    }
+
+    uint64_t lo[4], hi[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lo), acc_lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(hi), acc_hi);
+    sum += lo[0] + lo[1] + lo[2] + lo[3] + ((hi[0] + hi[1] + hi[2] + hi[3]) << 8);
+
+    return csum_add_sse2(buf + i, len - i, sum);
+}
+
+using csum_add_fn = uint64_t (*)(const uint8_t*, size_t, uint64_t);
+
+static csum_add_fn select_csum_add()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return csum_add_avx2;
+    }
+    return csum_add_sse2;
+}
+
+static const csum_add_fn csum_add_impl = select_csum_add();
+#endif
+
+uint64_t csum_add(const uint8_t* buf, size_t len, uint64_t sum)
+{
+#ifdef OFFLOAD_X86_SIMD
+    /* Headers are too short for the vector versions to pay off */
+    if (len >= 64) {
+        return csum_add_impl(buf, len, sum);
+    }
+#endif
+    return csum_add_scalar(buf, len, sum);
+}
+
+uint16_t csum_fold(uint64_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+namespace {
+/* Offsets and lengths of the layers of a frame */
+struct frame_layout {
+    size_t l3;
+    size_t l4;
+    size_t l4_len;
+    uint8_t proto;
+    bool ipv6;
+    bool l4_valid; /* a complete, unfragmented TCP or UDP segment */
+};
+} // namespace
+
+static bool parse_frame(const uint8_t* frame, size_t len, frame_layout& f)
+{
+    size_t l3 = 14;
+
+    if (len < l3) return false;
+    uint16_t type = ntohs(load16(frame + 12));
+    if (type == ETH_P_VLAN) {
+        l3 += 4;
+        if (len < l3) return false;
+        type = ntohs(load16(frame + 16));
+    }
+
+    const uint8_t* ip = frame + l3;
+    f.l3 = l3;
+    f.l4_valid = false;
+
+    if (type == ETH_P_IPV4) {
+        if (len < l3 + 20) return false;
+        size_t ihl = 4 * (ip[0] & 0x0f);
+        size_t total = ntohs(load16(ip + 2));
+        if (ihl < 20 || len < l3 + ihl) return false;
+
+        f.ipv6 = false;
+        f.proto = ip[9];
+        f.l4 = l3 + ihl;
+        f.l4_len = total > ihl ? total - ihl : 0;
+        /* More fragments, or a fragment offset */
+        bool fragment = (ntohs(load16(ip + 6)) & 0x3fff) != 0;
+        f.l4_valid = !fragment && total >= ihl && l3 + total <= len;
+    } else if (type == ETH_P_IPV6) {
+        if (len < l3 + 40) return false;
+
+        f.ipv6 = true;
+        f.proto = ip[6];
+        f.l4 = l3 + 40;
+        f.l4_len = ntohs(load16(ip + 4));
+        /* Extension headers are not supported */
+        f.l4_valid = f.l4 + f.l4_len <= len;
+    } else {
+        return false;
+    }
+
+    if (f.proto == PROTO_TCP) {
+        f.l4_valid = f.l4_valid && f.l4_len >= 20;
+    } else if (f.proto == PROTO_UDP) {
+        f.l4_valid = f.l4_valid && f.l4_len >= 8;
+    } else {
+        f.l4_valid = false;
+    }
+    return true;
+}
+
+static void insert_ipv4_header_checksum(uint8_t* frame, const frame_layout& f)
+{
+    uint8_t* ip = frame + f.l3;
+    size_t ihl = f.l4 - f.l3;
+
+    store16(ip + 10, 0);
+    store16(ip + 10, csum_fold(csum_add(ip, ihl)));
+}
+
+static uint64_t pseudo_header_sum(const uint8_t* frame, const frame_layout& f)
+{
+    const uint8_t* ip = frame + f.l3;
+    uint64_t sum;
+
+    if (f.ipv6) {
+        sum = csum_add(ip + 8, 32);
+        sum += htonl(f.l4_len);
+    } else {
+        sum = csum_add(ip + 12, 8);
+        sum += htons(f.l4_len);
+    }
+    sum += htons(f.proto);
+    return sum;
+}
+
+static void insert_l4_checksum(uint8_t* frame, const frame_layout& f, bool pseudo_header)
+{
+    uint8_t* l4 = frame + f.l4;
+    size_t csum_offset = (f.proto == PROTO_TCP) ? 16 : 6;
+    uint64_t sum = 0;
+
+    if (pseudo_header) {
+        store16(l4 + csum_offset, 0);
+        sum = pseudo_header_sum(frame, f);
+    }
+
+    uint16_t csum = csum_fold(csum_add(l4, f.l4_len, sum));
+    if (f.proto == PROTO_UDP && csum == 0) {
+        /* Zero means "no checksum" for UDP */
+        csum = 0xffff;
+    }
+    store16(l4 + csum_offset, csum);
+}
+
+bool insert_checksums(uint8_t* frame, size_t len, ChecksumLevel level)
+{
+    frame_layout f;
+
+    if (level == ChecksumLevel::NONE || !parse_frame(frame, len, f)) {
+        return false;
+    }
+
+    if (!f.ipv6) {
+        insert_ipv4_header_checksum(frame, f);
+    }
+
+    if (level == ChecksumLevel::IP_HEADER || !f.l4_valid) {
+        return !f.ipv6;
+    }
+
+    insert_l4_checksum(frame, f, level == ChecksumLevel::FULL);
+    return true;
+}
+
+size_t tso_segment(const uint8_t* frame, size_t len, size_t mss, Payload& seg,
+                   const std::function<void(Payload&)>& emit)
+{
+    frame_layout f;
+
+    if (!parse_frame(frame, len, f) || !f.l4_valid || f.proto != PROTO_TCP || mss == 0) {
+        return 0;
+    }
+
+    size_t tcp_hdr_len = 4 * (frame[f.l4 + 12] >> 4);
+    if (tcp_hdr_len < 20 || tcp_hdr_len > f.l4_len) {
+        return 0;
+    }
+
+    size_t hdr_len = f.l4 + tcp_hdr_len;
+    size_t data_len = f.l4_len - tcp_hdr_len;
+    size_t chunk = std::min(mss, data_len);
+    if (seg.capacity() < hdr_len + chunk) {
+        return 0;
+    }
+
+    const uint8_t* data = frame + hdr_len;
+    uint32_t seq = ntohl(load32(frame + f.l4 + 4));
+    uint16_t ip_id = f.ipv6 ? 0 : ntohs(load16(frame + f.l3 + 4));
+    uint8_t flags = frame[f.l4 + 13];
+    size_t count = 0;
+    size_t off = 0;
+
+    do {
+        chunk = std::min(mss, data_len - off);
+        bool first = (off == 0);
+        bool last = (off + chunk == data_len);
+
+        seg.resize(hdr_len + chunk);
+        uint8_t* out = seg.data();
+        memcpy(out, frame, hdr_len);
+        memcpy(out + hdr_len, data + off, chunk);
+
+        frame_layout sf = f;
+        sf.l4_len = tcp_hdr_len + chunk;
+        if (f.ipv6) {
+            store16(out + f.l3 + 4, htons(sf.l4_len));
+        } else {
+            store16(out + f.l3 + 2, htons((f.l4 - f.l3) + sf.l4_len));
+            store16(out + f.l3 + 4, htons(uint16_t(ip_id + count)));
+            insert_ipv4_header_checksum(out, sf);
+        }
+
+        uint8_t* tcp = out + f.l4;
+        store32(tcp + 4, htonl(seq + off));
+        tcp[13] = flags;
+        if (!last) tcp[13] &= ~(TCP_FIN | TCP_PSH);
+        if (!first) tcp[13] &= ~TCP_CWR;
+        insert_l4_checksum(out, sf, true);
+
+        emit(seg);
+        count++;
+        off += chunk;
+    } while (off < data_len);
+
+    return count;
+}
+
+} // namespace net_offload
@@ -6,6 +6,9 @@
 
 #include "memory_services.h"
 
+#include <algorithm>
+#include <vector>
+
 gs::MemoryServices::MemoryServices(): m_name("MemoryServices")
 {
     SCP_DEBUG(()) << "MemoryServices constructor";
@@ -190,3 +193,120 @@ uint8_t* gs::MemoryServices::alloc(uint64_t size)
     }
     return nullptr;
 }
+
+uint8_t* gs::MemoryServices::map_sparse(uint64_t size)
+{
+    uint8_t* ptr = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1,
+                                  0);
+    if (ptr == MAP_FAILED) {
+        SCP_INFO(()) << "Sparse mapping of 0x" << std::hex << size << " bytes failed [Error: " << strerror(errno) << "]";
+        return nullptr;
+    }
+    SCP_DEBUG(()) << "Sparse mapping created, length " << size;
+    return ptr;
+}
+
+void gs::MemoryServices::release_pages(uint8_t* ptr, uint64_t size)
+{
+    if (madvise(ptr, size, MADV_DONTNEED) == -1) {
+        SCP_FATAL(()) << "Unable to release pages at 0x" << std::hex << (uintptr_t)ptr << " [Error: " << strerror(errno)
+                      << "]";
+    }
+}
+
+/* Call cb(offset, len) for every run of resident pages of a mapped region */
+bool gs::MemoryServices::for_each_resident_run(uint8_t* ptr, uint64_t size,
+                                               const std::function<void(uint64_t, uint64_t)>& cb)
+{
+    static constexpr uint64_t CHUNK_PAGES = 0x10000;
+    const uint64_t page_size = sysconf(_SC_PAGE_SIZE);
+#if defined(__APPLE__)
+    /* macOS mincore() takes a char vector, its residency bit is MINCORE_INCORE (1) all the same */
+    std::vector<char> vec(CHUNK_PAGES);
+#else
+    std::vector<unsigned char> vec(CHUNK_PAGES);
+#endif
+    uint64_t pages = (size + page_size - 1) / page_size;
+    uint64_t run_start = 0;
+    uint64_t run_len = 0;
+
+    for (uint64_t first = 0; first < pages; first += CHUNK_PAGES) {
+        uint64_t n = std::min(CHUNK_PAGES, pages - first);
+        if (mincore(reinterpret_cast<char*>(ptr + first * page_size), n * page_size, vec.data()) == -1) {
+            SCP_WARN(()) << "Unable to query resident pages [Error: " << strerror(errno) << "]";
+            return false;
+        }
+        for (uint64_t i = 0; i < n; i++) {
+            if (vec[i] & 1) {
+                if (!run_len) run_start = (first + i) * page_size;
+                run_len += page_size;
+            } else if (run_len) {
+                cb(run_start, run_len);
+                run_len = 0;
+            }
+        }
+    }
+    if (run_len) cb(run_start, std::min(run_len, size - run_start));
+    return true;
+}
+
+uint64_t gs::MemoryServices::resident_size(uint8_t* ptr, uint64_t size)
+{
+    uint64_t resident = 0;
+    if (!for_each_resident_run(ptr, size, [&](uint64_t offset, uint64_t len) { resident += len; })) {
+        return size;
+    }
+    return std::min(resident, size);
+}
+
+int gs::MemoryServices::snapshot_sparse(uint8_t* ptr, uint64_t size)
+{
+#if defined(__linux__)
+    int fd = memfd_create("gs_memory_snapshot", MFD_CLOEXEC);
+    if (fd == -1) {
+        SCP_WARN(()) << "Unable to create snapshot memfd [Error: " << strerror(errno) << "]";
+        return -1;
+    }
+    if (ftruncate(fd, size) == -1) {
+        SCP_WARN(()) << "Unable to size snapshot memfd [Error: " << strerror(errno) << "]";
+        close(fd);
+        return -1;
+    }
+    /* Pages that are not resident read as zero, leave them as holes in the memfd */
+    bool ok = for_each_resident_run(ptr, size, [&](uint64_t offset, uint64_t len) {
+        while (len) {
+            ssize_t w = pwrite(fd, ptr + offset, len, offset);
+            if (w <= 0) {
+                SCP_FATAL(()) << "Unable to write snapshot [Error: " << strerror(errno) << "]";
+            }
+            offset += w;
+            len -= w;
+        }
+    });
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    map_snapshot(ptr, size, fd);
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+void gs::MemoryServices::map_snapshot(uint8_t* ptr, uint64_t size, int fd)
+{
+    if (mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, fd, 0) == MAP_FAILED) {
+        SCP_FATAL(()) << "Unable to map snapshot at 0x" << std::hex << (uintptr_t)ptr << " [Error: " << strerror(errno)
+                      << "]";
+    }
+}
+
+void gs::MemoryServices::remap_sparse(uint8_t* ptr, uint64_t size)
+{
+    if (mmap(ptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) ==
+        MAP_FAILED) {
+        SCP_FATAL(()) << "Unable to remap sparse memory at 0x" << std::hex << (uintptr_t)ptr
+                      << " [Error: " << strerror(errno) << "]";
+    }
+}
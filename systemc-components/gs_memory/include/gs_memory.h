@@ -10,6 +10,9 @@
 
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <cci_configuration>
 #include <systemc>
@@ -20,6 +23,7 @@
 
 #include <loader.h>
 #include <memory_services.h>
+#include <async_event.h>
 
 #include <tlm-extensions/shmem_extension.h>
 #include <module_factory_registery.h>
@@ -46,8 +50,11 @@ namespace gs {
  *    - It does not manage exclusive accesses
  *    - You can manage the size of the memory during the initialization of the component
  *    - gs_memory does not allocate individual "pages" but a single large block
+ *    - In sparse mode the block is only reserved, host pages are committed when first touched and
+ *      dropped again on reset
  *    - It supports DMI requests with the method `get_direct_mem_ptr`
- *    - DMI invalidates are not issued.
+ *    - DMI invalidates are only issued when a snapshot is restored.
+ *    - The contents can be snapshotted and restored (see snapshot()), sparse memories do so copy-on-write
  */
 #define ALIGNEDBITS 12
 
@@ -58,6 +65,17 @@ class gs_memory : public sc_core::sc_module
     uint64_t m_address;
     bool m_address_valid = false;
     bool m_relative_addresses;
+    bool m_has_snapshot = false;
+
+    /*
+     * Snapshots are taken and restored on the SystemC thread, whoever writes the
+     * parameters: requests from other threads are queued for run_requests().
+     */
+    enum class snapshot_request { snapshot, restore };
+    std::thread::id m_sysc_thread = std::this_thread::get_id();
+    std::mutex m_requests_mutex;
+    std::vector<snapshot_request> m_requests;
+    gs::async_event m_requests_ev{ false };
 
     SCP_LOGGER(());
 
@@ -76,8 +94,14 @@ class gs_memory : public sc_core::sc_module
         bool m_use_sub_blocks = false;
 
         bool m_mapped = false;
+        bool m_sparse = false;
         ShmemIDExtension m_shmemID;
 
+        /* Snapshot: a memfd the block is mapped copy-on-write from (sparse), or a plain copy */
+        int m_snapshot_fd = -1;
+        bool m_snapshot_mapped = false;
+        std::vector<uint8_t> m_snapshot_copy;
+
     public:
         SubBlock(uint64_t address, uint64_t len, gs_memory& mem): m_len(len), m_address(address), m_mem(mem)
         {
@@ -91,9 +115,72 @@ class gs_memory : public sc_core::sc_module
                 if (m_sub_blocks[i]) m_sub_blocks[i]->doreset();
             }
             if (m_mem.p_init_mem && m_ptr) {
+                if (m_sparse) {
+                    /* Only the pages touched since the last reset are resident */
+                    if (m_snapshot_mapped) {
+                        MemoryServices::get().remap_sparse(m_ptr, m_len);
+                        m_snapshot_mapped = false;
+                    } else {
+                        MemoryServices::get().release_pages(m_ptr, m_len);
+                    }
+                    if (m_mem.p_init_mem_val) memset(m_ptr, m_mem.p_init_mem_val, m_len);
+                } else {
+                    memset(m_ptr, m_mem.p_init_mem_val, m_len);
+                }
+            }
+        }
+
+        void snapshot()
+        {
+            for (auto& sb : m_sub_blocks) {
+                if (sb) sb->snapshot();
+            }
+            if (!m_ptr) return;
+
+            if (m_sparse) {
+                int fd = MemoryServices::get().snapshot_sparse(m_ptr, m_len);
+                if (fd >= 0) {
+                    if (m_snapshot_fd >= 0) close(m_snapshot_fd);
+                    m_snapshot_fd = fd;
+                    m_snapshot_mapped = true;
+                    return;
+                }
+            }
+            m_snapshot_copy.assign(m_ptr, m_ptr + m_len);
+        }
+
+        void restore()
+        {
+            for (auto& sb : m_sub_blocks) {
+                if (sb) sb->restore();
+            }
+            if (!m_ptr) return;
+
+            if (m_snapshot_fd >= 0) {
+                /* Only the pages dirtied since the snapshot are dropped */
+                MemoryServices::get().map_snapshot(m_ptr, m_len, m_snapshot_fd);
+                m_snapshot_mapped = true;
+            } else if (!m_snapshot_copy.empty()) {
+                memcpy(m_ptr, m_snapshot_copy.data(), m_len);
+            } else if (m_sparse) {
+                /* This block was not populated when the snapshot was taken */
+                MemoryServices::get().release_pages(m_ptr, m_len);
+            } else {
                 memset(m_ptr, m_mem.p_init_mem_val, m_len);
             }
         }
+
+        uint64_t resident_size()
+        {
+            uint64_t resident = 0;
+            for (auto& sb : m_sub_blocks) {
+                if (sb) resident += sb->resident_size();
+            }
+            if (m_ptr) {
+                resident += m_mapped ? MemoryServices::get().resident_size(m_ptr, m_len) : m_len;
+            }
+            return resident;
+        }
         SubBlock& access(uint64_t address)
         {
             // address is the address of where we want to write/read
@@ -103,7 +190,7 @@ class gs_memory : public sc_core::sc_module
                 assert(address >= m_address);
                 return *this;
             }
-            if (m_len > m_mem.p_max_block_size) {
+            if (m_len > m_mem.p_max_block_size && !m_mem.p_sparse) {
                 m_use_sub_blocks = true;
             }
 
@@ -136,7 +223,14 @@ class gs_memory : public sc_core::sc_module
                         return *this;
                     }
                 }
-                if ((m_ptr = MemoryServices::get().alloc(m_len)) != nullptr) {
+                if (m_mem.p_sparse) {
+                    if ((m_ptr = MemoryServices::get().map_sparse(m_len)) != nullptr) {
+                        m_mapped = true;
+                        m_sparse = true;
+                        if (m_mem.p_init_mem && m_mem.p_init_mem_val) memset(m_ptr, m_mem.p_init_mem_val, m_len);
+                        return *this;
+                    }
+                } else if ((m_ptr = MemoryServices::get().alloc(m_len)) != nullptr) {
                     if (m_mem.p_init_mem) memset(m_ptr, m_mem.p_init_mem_val, m_len);
                     return *this;
                 }
@@ -196,6 +290,7 @@ class gs_memory : public sc_core::sc_module
 
         ~SubBlock()
         {
+            if (m_snapshot_fd >= 0) close(m_snapshot_fd);
             if (m_mapped) {
                 munmap(m_ptr, m_len);
             } else {
@@ -423,6 +518,9 @@ public:
     cci::cci_param<std::string> p_shmem_prefix;
     cci::cci_param<bool> p_init_mem;
     cci::cci_param<int> p_init_mem_val; // to match the signature of memset
+    cci::cci_param<bool> p_sparse;
+    cci::cci_param<bool> p_snapshot;
+    cci::cci_param<bool> p_restore;
 
     gs::loader<> load;
 
@@ -446,6 +544,11 @@ public:
         , p_shmem_prefix("shared_memory_prefix", "", "(optional) prefix_for shared memory file")
         , p_init_mem("init_mem", false, "Initialize allocated memory")
         , p_init_mem_val("init_mem_val", 0, "Value to initialize memory to")
+        , p_sparse("sparse", false,
+                   "Only reserve the memory, host pages are committed on first touch and released on reset "
+                   "(default false)")
+        , p_snapshot("snapshot", false, "Write true to take a snapshot of the memory contents")
+        , p_restore("restore", false, "Write true to restore the memory contents to the last snapshot")
         , load("load", [&](const uint8_t* data, uint64_t offset, uint64_t len) -> void {
             if (!write(data, offset, len)) {
                 SCP_WARN(()) << " Offset : 0x" << std::hex << offset << " of the out of range";
@@ -465,6 +568,19 @@ public:
         socket.register_transport_dbg(this, &gs_memory::transport_dbg);
         socket.register_get_direct_mem_ptr(this, &gs_memory::get_direct_mem_ptr);
 
+        p_snapshot.register_post_write_callback([this](auto ev) {
+            if (p_snapshot) request(snapshot_request::snapshot);
+        });
+        p_restore.register_post_write_callback([this](auto ev) {
+            if (p_restore) request(snapshot_request::restore);
+        });
+
+        sc_core::sc_spawn_options opt;
+        opt.spawn_method();
+        opt.set_sensitivity(&m_requests_ev);
+        opt.dont_initialize();
+        sc_core::sc_spawn(sc_bind(&gs_memory::run_requests, this), "run_requests", &opt);
+
         reset.register_value_changed_cb([&](bool value) {
             if (value) {
                 SCP_WARN(()) << "Reset";
@@ -494,6 +610,17 @@ public:
         if (gs::cci_get<bool>(m_broker, ts_name + ".relative_addresses", m_relative_addresses)) {
             m_broker.lock_preset_value(ts_name + ".relative_addresses");
         }
+
+        if (p_sparse && p_init_mem && p_init_mem_val) {
+            SCP_WARN(()) << "init_mem_val is not 0, the sparse memory will be fully committed";
+        }
+    }
+
+    void end_of_simulation()
+    {
+        if (p_sparse && m_sub_block) {
+            SCP_INFO(()) << "Resident size: 0x" << std::hex << resident_size() << " of 0x" << std::hex << m_size;
+        }
     }
 
     gs_memory() = delete;
@@ -501,6 +628,91 @@ public:
 
     ~gs_memory() {}
 
+private:
+    void run(snapshot_request r)
+    {
+        if (r == snapshot_request::snapshot) {
+            snapshot();
+        } else {
+            restore();
+        }
+    }
+
+    /* Run at once on the SystemC thread, later from any other thread */
+    void request(snapshot_request r)
+    {
+        if (std::this_thread::get_id() == m_sysc_thread) {
+            run(r);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_requests_mutex);
+            m_requests.push_back(r);
+        }
+        m_requests_ev.async_notify();
+    }
+
+    void run_requests()
+    {
+        std::vector<snapshot_request> requests;
+        {
+            std::lock_guard<std::mutex> lock(m_requests_mutex);
+            requests.swap(m_requests);
+        }
+        for (auto r : requests) {
+            run(r);
+        }
+    }
+
+public:
+    /**
+     * @brief take a snapshot of the memory contents, replacing any previous one
+     *
+     * @details Sparse memories are remapped copy-on-write from the snapshot, so taking it only copies the
+     * resident pages, and restoring it only drops the pages dirtied since. Other memories keep a full copy.
+     * The platform should be quiescent (eg. no CPU running) while a snapshot is taken or restored.
+     * Must be called from the SystemC thread. Writing p_snapshot or p_restore is safe from any thread, from
+     * another thread than the SystemC one the request runs once SystemC gets to it.
+     */
+    void snapshot()
+    {
+        if (!m_sub_block) before_end_of_elaboration();
+        SCP_INFO(()) << "Taking snapshot";
+        m_sub_block->snapshot();
+        m_has_snapshot = true;
+    }
+
+    /**
+     * @brief restore the memory contents to the last snapshot
+     *
+     * @details The whole memory is DMI invalidated so that initiators drop anything cached from it.
+     */
+    void restore()
+    {
+        if (!m_has_snapshot) {
+            SCP_WARN(()) << "No snapshot to restore";
+            return;
+        }
+        SCP_INFO(()) << "Restoring snapshot";
+        m_sub_block->restore();
+
+        uint64_t start = m_relative_addresses ? 0 : m_address;
+        for (int i = 0; i < socket.size(); i++) {
+            socket[i]->invalidate_direct_mem_ptr(start, start + m_size - 1);
+        }
+    }
+
+    /**
+     * @brief this function returns how much host memory currently backs this memory
+     *
+     * @return the resident size in bytes, page granular for mapped memories
+     */
+    uint64_t resident_size()
+    {
+        if (!m_sub_block) return 0;
+        return m_sub_block->resident_size();
+    }
+
     /**
      * @brief this function returns the size of the memory
      *
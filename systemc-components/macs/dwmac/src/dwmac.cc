@@ -12,6 +12,7 @@
 #include <scp/report.h>
 
 #include <dwmac.h>
+#include <macs/offload.h>
 
 using namespace sc_core;
 using namespace std;
@@ -504,27 +505,6 @@ void dwmac::move_to_next_tx_desc(dma_desc& desc)
     }
 }
 
-static uint16_t checksum(const uint8_t* buf, int size, uint32_t sum)
-{
-    int i;
-
-    /* Accumulate checksum */
-    for (i = 0; i < size - 1; i += 2) {
-        sum += *(uint16_t*)&buf[i];
-    }
-
-    /* Handle odd-sized case */
-    if (size & 1) {
-        sum += buf[i];
-    }
-
-    /* Fold to get the ones-complement result */
-    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
-
-    /* Invert to get the negative in ones-complement arithmetic */
-    return ~sum;
-}
-
 bool dwmac::tx()
 {
     dma_desc desc;
@@ -579,71 +559,10 @@ bool dwmac::tx()
         return false;
     }
 
-    /* Checksum offloading */
+    /* Checksum offloading, the CIC field encoding matches ChecksumLevel */
     if ((m_configuration & (1 << 10)) && desc.des01.etx.checksum_insertion) {
-        uint8_t* buffer = m_tx_frame.data();
-        uint32_t len = m_tx_frame.size();
-
-        if (len >= 14 && buffer[12] == 0x08 && buffer[13] == 0x00) {
-            // IPv4 packet
-            uint8_t* ipv4_pkt = &buffer[14];
-            uint32_t ipv4_header_len = 4 * (ipv4_pkt[0] & 0x0f);
-
-            /* IPv4 checksum */
-            if (len >= (14 + ipv4_header_len)) {
-                *(uint16_t*)(ipv4_pkt + 10) = 0;
-                uint32_t csum = checksum(ipv4_pkt, ipv4_header_len, 0);
-                // printf("Calculated checksum: %02x%02x\n", (csum >> 8) & 0xff, csum &
-                // 0xff);
-                *(uint16_t*)(ipv4_pkt + 10) = csum;
-            }
-
-            const uint8_t ip_prot = ipv4_pkt[9];
-
-            /* TCP/UDP checksum */
-            if ((desc.des01.etx.checksum_insertion == 3) && len >= 24 && (ip_prot == 0x06 || ip_prot == 0x11)) {
-                int csum_offset;
-
-                switch (ip_prot) {
-                case 0x06:
-                    /* TCP */
-                    csum_offset = 16;
-                    break;
-
-                case 0x11:
-                    /* UDP */
-                    csum_offset = 6;
-                    break;
-
-                default:
-                    assert(false);
-                }
-
-                uint8_t* tcp_seg = &ipv4_pkt[ipv4_header_len];
-                // printf("Old checksum: %02X%02x\n", tcp_seg[16], tcp_seg[17]);
-
-                /* Erase old checksum */
-                *(uint16_t*)(tcp_seg + csum_offset) = 0x0000;
-
-                uint32_t csum = 0;
-
-                /* Pseudo header */
-                csum += *(uint16_t*)(ipv4_pkt + 12);
-                csum += *(uint16_t*)(ipv4_pkt + 14);
-                csum += *(uint16_t*)(ipv4_pkt + 16);
-                csum += *(uint16_t*)(ipv4_pkt + 18);
-                csum += htons(ip_prot);
-                csum += htons(len - 14 - ipv4_header_len);
-
-                /* TCP/UDP segment */
-                int size = len - 14 - ipv4_header_len;
-                csum = checksum(tcp_seg, size, csum);
-                // printf("Calculated checksum: %02x%02x\n", (csum >> 8) & 0xff, csum &
-                // 0xff);
-
-                *(uint16_t*)(tcp_seg + csum_offset) = csum;
-            }
-        }
+        net_offload::insert_checksums(m_tx_frame.data(), m_tx_frame.size(),
+                                      static_cast<net_offload::ChecksumLevel>(desc.des01.etx.checksum_insertion));
     }
 
     SCP_TRACE(SCMOD) << "sending frame of length " << (unsigned)m_tx_frame.size();
@@ -11,6 +11,7 @@
 #include <arpa/inet.h>
 
 #include <xgmac.h>
+#include <macs/offload.h>
 
 #include <scp/report.h>
 
@@ -90,6 +91,14 @@ using namespace std;
 #define DMA_STATUS_TPS         0x00000002 /* Transmit Process Stopped */
 #define DMA_STATUS_TI          0x00000001 /* Transmit Interrupt */
 
+/* DMA HW feature register defines */
+#define DMA_HW_FEAT_TXCOESEL 0x00010000 /* TX Checksum offload */
+
+/* TX descriptor defines */
+#define TXDESC_CSUM_SHIFT 22         /* Checksum insertion control, same encoding as ChecksumLevel */
+#define TXDESC_CSUM_MASK  0x00c00000
+#define TXDESC_FIRST_SEG  0x10000000
+
 /* DMA Control register defines */
 #define DMA_CONTROL_ST  0x00002000 /* Start/Stop Transmission */
 #define DMA_CONTROL_SR  0x00000002 /* Start/Stop Receive */
@@ -211,6 +220,7 @@ void xgmac::xgmac_enet_send()
     int len;
     uint8_t frame[8192];
     uint8_t* ptr;
+    net_offload::ChecksumLevel csum_level = net_offload::ChecksumLevel::NONE;
 
     ptr = frame;
     frame_size = 0;
@@ -220,6 +230,10 @@ void xgmac::xgmac_enet_send()
             /* Run out of descriptors to transmit.  */
             break;
         }
+        if (bd.ctl_stat & TXDESC_FIRST_SEG) {
+            csum_level = static_cast<net_offload::ChecksumLevel>((bd.ctl_stat & TXDESC_CSUM_MASK) >>
+                                                                 TXDESC_CSUM_SHIFT);
+        }
         len = (bd.buffer1_size & 0xfff) + (bd.buffer2_size & 0xfff);
 
         if ((bd.buffer1_size & 0xfff) > 2048) {
@@ -243,6 +257,7 @@ void xgmac::xgmac_enet_send()
             SCP_TRACE(SCMOD) << "Last buffer in frame, sending. Size: " << frame_size;
             m_tx_frame.resize(frame_size);
             memcpy(m_tx_frame.data(), frame, frame_size);
+            net_offload::insert_checksums(m_tx_frame.data(), m_tx_frame.size(), csum_level);
             m_backend->send(m_tx_frame);
 
             ptr = frame;
@@ -273,6 +288,9 @@ uint64_t xgmac::enet_read(uint64_t addr, unsigned size)
     case XGMAC_VERSION:
         r = 0x1012;
         break;
+    case DMA_HW_FEATURE:
+        r = DMA_HW_FEAT_TXCOESEL;
+        break;
     default:
         if (addr < ARRAY_SIZE(m_regs)) {
             r = m_regs[addr];
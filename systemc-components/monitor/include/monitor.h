@@ -72,9 +72,7 @@ class monitor : public sc_core::sc_module
         }
         void enqueue(std::string data)
         {
-            for (auto c : data) {
-                socket.enqueue(c);
-            }
+            socket.enqueue(reinterpret_cast<const uint8_t*>(data.data()), data.size());
         }
         biflow_ws(gs::biflow_multibindable& o, const char* n)
             : socket(sc_core::sc_gen_unique_name("monitor_biflow_backend")), name(n)
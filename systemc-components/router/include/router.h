@@ -8,7 +8,14 @@
 #ifndef _GREENSOCS_BASE_COMPONENTS_ROUTER_H
 #define _GREENSOCS_BASE_COMPONENTS_ROUTER_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cinttypes>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
 #include <vector>
 
 #define THREAD_SAFE true
@@ -30,6 +37,7 @@
 #include <tlm_utils/multi_passthrough_target_socket.h>
 
 #include <tlm-extensions/pathid_extension.h>
+#include <tlm-extensions/thread-safe-hint.h>
 #include <tlm-extensions/underlying-dmi.h>
 #include <cciutils.h>
 #include <router_if.h>
@@ -55,38 +63,140 @@ class router : public sc_core::sc_module, public gs::router_if<BUSWIDTH>
     using gs::router_if<BUSWIDTH>::bound_targets;
 
 private:
-    std::mutex m_dmi_mutex;
-    struct dmi_info {
+    /*
+     * DMI bookkeeping: which initiators have been granted DMI over which
+     * address ranges, so that an invalidation only reaches the initiators
+     * concerned. Regions never overlap; a grant or an invalidation partially
+     * covering a region splits it.
+     * The registry is published as an immutable snapshot, so lookups take no
+     * router lock (std::atomic_load on a shared_ptr may still use a lock
+     * internal to the standard library). Updates copy it under m_dmi_mutex,
+     * which is only held while calling out of the router by the fallback grant
+     * path, see get_direct_mem_ptr.
+     */
+    struct dmi_region {
+        uint64_t end; // inclusive
         std::set<int> initiators;
-        tlm::tlm_dmi dmi;
-        dmi_info(tlm::tlm_dmi& _dmi) { dmi = _dmi; }
     };
-    std::map<uint64_t, dmi_info> m_dmi_info_map;
-    dmi_info* in_dmi_cache(tlm::tlm_dmi& dmi)
+    using dmi_registry = std::map<uint64_t, dmi_region>;
+    std::shared_ptr<const dmi_registry> m_dmi_registry = std::make_shared<const dmi_registry>();
+    /* Recursive, as a target may invalidate DMI from within the fallback grant */
+    std::recursive_mutex m_dmi_mutex;
+
+    /*
+     * The last invalidations, so that a DMI grant can tell whether one that
+     * overlaps it ran while the target was being asked. Updated under
+     * m_dmi_mutex, m_dmi_generation counts them.
+     */
+    struct dmi_invalidation {
+        uint64_t start;
+        uint64_t end;
+    };
+    static constexpr size_t DMI_INVALIDATION_HISTORY = 16;
+    std::array<dmi_invalidation, DMI_INVALIDATION_HISTORY> m_dmi_invalidations;
+    std::atomic<uint64_t> m_dmi_generation{ 0 };
+    static constexpr int DMI_GRANT_RETRIES = 8;
+
+    static void dmi_split_at(dmi_registry& r, uint64_t addr)
     {
-        auto it = m_dmi_info_map.find(dmi.get_start_address());
-        if (it != m_dmi_info_map.end()) {
-            if (it->second.dmi.get_end_address() != dmi.get_end_address()) {
-                SCP_FATAL((DMI)) << "Can't handle that";
-            }
-            return &(it->second);
+        auto it = r.upper_bound(addr);
+        if (it == r.begin()) return;
+        --it;
+        if (it->first < addr && it->second.end >= addr) {
+            dmi_region tail = it->second;
+            it->second.end = addr - 1;
+            r.emplace(addr, std::move(tail));
         }
-        auto insit = m_dmi_info_map.insert({ dmi.get_start_address(), dmi_info(dmi) });
-        return &(insit.first->second);
     }
-    void record_dmi(int id, tlm::tlm_dmi& dmi)
+
+    static void dmi_split_range(dmi_registry& r, uint64_t start, uint64_t end)
+    {
+        dmi_split_at(r, start);
+        if (end != std::numeric_limits<uint64_t>::max()) dmi_split_at(r, end + 1);
+    }
+
+    static bool dmi_overlaps(const dmi_registry& r, uint64_t start, uint64_t end)
     {
-        auto it = m_dmi_info_map.find(dmi.get_start_address());
-        if (it != m_dmi_info_map.end()) {
-            if (it->second.dmi.get_end_address() != dmi.get_end_address()) {
-                SCP_WARN((DMI)) << "A new DMI overlaps with an old one, invalidating the old one";
-                invalidate_direct_mem_ptr_ts(0, dmi.get_start_address(),
-                                             dmi.get_end_address()); // id will be ignored
+        auto it = r.upper_bound(end);
+        if (it == r.begin()) return false;
+        --it;
+        return it->second.end >= start;
+    }
+
+    /* Is [start, end] already entirely recorded for initiator id */
+    static bool dmi_covered(const dmi_registry& r, int id, uint64_t start, uint64_t end)
+    {
+        auto it = r.upper_bound(start);
+        if (it == r.begin()) return false;
+        --it;
+        for (uint64_t cur = start; it != r.end() && it->first <= cur; ++it) {
+            if (it->second.end < cur || !it->second.initiators.count(id)) return false;
+            if (it->second.end >= end) return true;
+            cur = it->second.end + 1;
+        }
+        return false;
+    }
+
+    /* Did an invalidation overlapping [start, end] run after generation. Called with m_dmi_mutex held. */
+    bool dmi_invalidated_since(uint64_t generation, uint64_t start, uint64_t end)
+    {
+        uint64_t cur = m_dmi_generation.load();
+        /* The history does not go back that far, assume the worst */
+        if (cur - generation > DMI_INVALIDATION_HISTORY) return true;
+        for (uint64_t g = generation + 1; g <= cur; g++) {
+            const dmi_invalidation& inv = m_dmi_invalidations[g % DMI_INVALIDATION_HISTORY];
+            if (inv.start <= end && start <= inv.end) return true;
+        }
+        return false;
+    }
+
+    /* Called with m_dmi_mutex held */
+    void record_dmi_locked(int id, uint64_t start, uint64_t end)
+    {
+        auto next = std::make_shared<dmi_registry>(*std::atomic_load(&m_dmi_registry));
+        dmi_split_range(*next, start, end);
+
+        auto it = next->lower_bound(start);
+        for (uint64_t cur = start;;) {
+            uint64_t piece_end;
+            if (it != next->end() && it->first == cur) {
+                it->second.initiators.insert(id);
+                piece_end = it->second.end;
+                ++it;
+            } else {
+                /* fill the gap up to the next recorded region */
+                piece_end = (it != next->end() && it->first <= end) ? it->first - 1 : end;
+                next->emplace_hint(it, cur, dmi_region{ piece_end, { id } });
             }
+            if (piece_end >= end) break;
+            cur = piece_end + 1;
+        }
+        std::atomic_store(&m_dmi_registry, std::shared_ptr<const dmi_registry>(std::move(next)));
+    }
+
+    /*
+     * Record the DMI granted to initiator id, obtained from the target after
+     * generation was read. Fails if an invalidation overlapping it ran
+     * meanwhile, as the DMI may then already be stale.
+     */
+    bool record_dmi(int id, const tlm::tlm_dmi& dmi, uint64_t generation)
+    {
+        uint64_t start = dmi.get_start_address();
+        uint64_t end = dmi.get_end_address();
+
+        /*
+         * No invalidation at all since generation, and already recorded: an
+         * invalidation starting now will find the initiator.
+         */
+        if (m_dmi_generation.load() == generation &&
+            dmi_covered(*std::atomic_load(&m_dmi_registry), id, start, end)) {
+            return true;
         }
 
-        dmi_info* dinfo = in_dmi_cache(dmi);
-        dinfo->initiators.insert(id);
+        std::lock_guard<std::recursive_mutex> lock(m_dmi_mutex);
+        if (dmi_invalidated_since(generation, start, end)) return false;
+        record_dmi_locked(id, start, end);
+        return true;
     }
 
     void register_boundto(std::string s)
@@ -154,23 +264,50 @@ private:
     std::vector<target_info*> targets;
     std::vector<target_info*> id_targets;
 
-    std::vector<PathIDExtension*> m_pathIDPool; // at most one per thread!
-#if THREAD_SAFE == true
-    std::mutex m_pool_mutex;
-#endif
+    /*
+     * Flattened view of the address map, built once the targets are known.
+     * Entries are sorted, do not overlap and already have the priority
+     * ordering of `targets` resolved, so a decode is a binary search.
+     */
+    struct decode_entry {
+        uint64_t start;
+        uint64_t end; // inclusive
+        target_info* ti;
+    };
+    std::vector<decode_entry> m_decode_table;
+    static constexpr size_t NO_DECODE_ENTRY = std::numeric_limits<size_t>::max();
+    /* Last decode_entry hit, per initiator (target_socket index) */
+    std::vector<std::atomic<size_t>> m_last_hit;
+
+    /*
+     * Path ID extensions are only borrowed for the duration of a b_transport,
+     * which starts and ends on the same thread, so each thread keeps its own
+     * pool and no locking is needed.
+     */
+    struct pathid_pool {
+        std::vector<PathIDExtension*> free;
+        ~pathid_pool()
+        {
+            for (auto ext : free) delete ext;
+        }
+    };
+    static pathid_pool& local_pathid_pool()
+    {
+        static thread_local pathid_pool pool;
+        return pool;
+    }
+
     void stamp_txn(int id, tlm::tlm_generic_payload& txn)
     {
         PathIDExtension* ext = nullptr;
         txn.get_extension(ext);
         if (ext == nullptr) {
-#if THREAD_SAFE == true
-            std::lock_guard<std::mutex> l(m_pool_mutex);
-#endif
-            if (m_pathIDPool.size() == 0) {
+            auto& pool = local_pathid_pool();
+            if (pool.free.empty()) {
                 ext = new PathIDExtension();
             } else {
-                ext = m_pathIDPool.back();
-                m_pathIDPool.pop_back();
+                ext = pool.free.back();
+                pool.free.pop_back();
             }
             txn.set_extension(ext);
         }
@@ -183,26 +320,24 @@ private:
         assert(ext);
         assert(ext->back() == id);
         ext->pop_back();
-        if (ext->size() == 0) {
-#if THREAD_SAFE == true
-            std::lock_guard<std::mutex> l(m_pool_mutex);
-#endif
+        if (ext->empty()) {
             txn.clear_extension(ext);
-            m_pathIDPool.push_back(ext);
+            local_pathid_pool().free.push_back(ext);
         }
     }
 
     void b_transport(int id, tlm::tlm_generic_payload& trans, sc_core::sc_time& delay)
     {
-        bool found = false;
         sc_dt::uint64 addr = trans.get_address();
-        auto ti = decode_address(trans);
-        if (!ti) {
+        auto entry = decode_entry_for(id, addr);
+        if (!entry) {
             SCP_WARN(())("Attempt to access unknown register at offset 0x{:x}", addr);
             trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
             return;
         }
+        auto ti = entry->ti;
 
+        update_thread_safe_hint(*entry, trans);
         stamp_txn(id, trans);
         if (!ti->chained) SCP_TRACE((D[ti->index]), ti->name) << "calling b_transport : " << txn_tostring(ti, trans);
         if (trans.get_response_status() >= tlm::TLM_INCOMPLETE_RESPONSE) {
@@ -217,7 +352,7 @@ private:
     unsigned int transport_dbg(int id, tlm::tlm_generic_payload& trans)
     {
         sc_dt::uint64 addr = trans.get_address();
-        auto ti = decode_address(trans);
+        auto ti = decode_address(id, trans);
         if (!ti) {
             trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
             return 0;
@@ -230,6 +365,33 @@ private:
         return ret;
     }
 
+    /* Ask the target for DMI, and clip it to the hole of the address map the access is in */
+    bool target_dmi(target_info* ti, sc_dt::uint64 addr, tlm::tlm_generic_payload& trans, tlm::tlm_dmi& dmi_data,
+                    const tlm::tlm_dmi& dmi_data_hole)
+    {
+        if (ti->use_offset) trans.set_address(addr - ti->address);
+        SCP_TRACE((D[ti->index]), ti->name) << "calling get_direct_mem_ptr : " << scp::scp_txn_tostring(trans);
+        bool status = initiator_socket[ti->index]->get_direct_mem_ptr(trans, dmi_data);
+        if (ti->use_offset) trans.set_address(addr);
+        if (!status) return false;
+
+        if (ti->use_offset) {
+            assert(dmi_data.get_start_address() < ti->size);
+            dmi_data.set_start_address(ti->address + dmi_data.get_start_address());
+            dmi_data.set_end_address(ti->address + dmi_data.get_end_address());
+        }
+        /* ensure we dont overspill the 'hole' we have in the address map */
+        if (dmi_data.get_start_address() < dmi_data_hole.get_start_address()) {
+            dmi_data.set_dmi_ptr(dmi_data.get_dmi_ptr() +
+                                 (dmi_data_hole.get_start_address() - dmi_data.get_start_address()));
+            dmi_data.set_start_address(dmi_data_hole.get_start_address());
+        }
+        if (dmi_data.get_end_address() > dmi_data_hole.get_end_address()) {
+            dmi_data.set_end_address(dmi_data_hole.get_end_address());
+        }
+        return true;
+    }
+
     bool get_direct_mem_ptr(int id, tlm::tlm_generic_payload& trans, tlm::tlm_dmi& dmi_data)
     {
         sc_dt::uint64 addr = trans.get_address();
@@ -250,34 +412,30 @@ private:
             return false;
         }
 
-        if (!m_dmi_mutex.try_lock()) { // if we're busy invalidating, dont grant DMI's
-            return false;
-        }
+        bool status = false;
+        bool raced = false;
+        for (int attempt = 0; attempt < DMI_GRANT_RETRIES; attempt++) {
+            uint64_t generation = m_dmi_generation.load();
 
-        if (ti->use_offset) trans.set_address(addr - ti->address);
-        SCP_TRACE((D[ti->index]), ti->name) << "calling get_direct_mem_ptr : " << scp::scp_txn_tostring(trans);
-        bool status = initiator_socket[ti->index]->get_direct_mem_ptr(trans, dmi_data);
-        if (ti->use_offset) trans.set_address(addr);
-        if (status) {
-            if (ti->use_offset) {
-                assert(dmi_data.get_start_address() < ti->size);
-                dmi_data.set_start_address(ti->address + dmi_data.get_start_address());
-                dmi_data.set_end_address(ti->address + dmi_data.get_end_address());
-            }
-            /* ensure we dont overspill the 'hole' we have in the address map */
-            if (dmi_data.get_start_address() < dmi_data_hole.get_start_address()) {
-                dmi_data.set_dmi_ptr(dmi_data.get_dmi_ptr() +
-                                     (dmi_data_hole.get_start_address() - dmi_data.get_start_address()));
-                dmi_data.set_start_address(dmi_data_hole.get_start_address());
-            }
-            if (dmi_data.get_end_address() > dmi_data_hole.get_end_address()) {
-                dmi_data.set_end_address(dmi_data_hole.get_end_address());
-            }
-            record_dmi(id, dmi_data);
+            status = target_dmi(ti, addr, trans, dmi_data, dmi_data_hole);
+            raced = status && !record_dmi(id, dmi_data, generation);
+            if (!raced) break;
+            SCP_DEBUG((DMI)) << "DMI grant raced with an overlapping invalidation, retrying";
+            status = false;
+        }
+        if (raced) {
+            /*
+             * Invalidations of this region keep racing with us. Ask the target
+             * once more with invalidations from other threads held off, so that
+             * none can slip between the answer and its recording. The target
+             * must not wait on another thread invalidating DMI meanwhile.
+             */
+            std::lock_guard<std::recursive_mutex> lock(m_dmi_mutex);
+            status = target_dmi(ti, addr, trans, dmi_data, dmi_data_hole);
+            if (status) record_dmi_locked(id, dmi_data.get_start_address(), dmi_data.get_end_address());
         }
         SCP_DEBUG(())
         ("Providing DMI (status {:x}) {:x} - {:x}", status, dmi_data.get_start_address(), dmi_data.get_end_address());
-        m_dmi_mutex.unlock();
         return status;
     }
 
@@ -287,43 +445,34 @@ private:
             start = id_targets[id]->address + start;
             end = id_targets[id]->address + end;
         }
-        std::lock_guard<std::mutex> lock(m_dmi_mutex);
-        invalidate_direct_mem_ptr_ts(id, start, end);
+        invalidate_direct_mem_ptr_ts(start, end);
     }
 
-    void invalidate_direct_mem_ptr_ts(int id, sc_dt::uint64 start, sc_dt::uint64 end)
+    void invalidate_direct_mem_ptr_ts(sc_dt::uint64 start, sc_dt::uint64 end)
     {
-        auto it = m_dmi_info_map.upper_bound(start);
-
-        if (it != m_dmi_info_map.begin()) {
-            /*
-             * Start with the preceding region, as it may already cross the
-             * range we must invalidate.
-             */
-            it--;
-        }
         std::set<int> initiators;
-
-        while (it != m_dmi_info_map.end()) {
-            tlm::tlm_dmi& r = it->second.dmi;
-
-            if (r.get_start_address() > end) {
-                /* We've got out of the invalidation range */
-                break;
-            }
-
-            if (r.get_end_address() < start) {
-                /* We are not in yet */
-                it++;
-                continue;
-            }
-            for (auto t : it->second.initiators) {
-                SCP_TRACE((DMI)) << "Queueing initiator " << t << " for invalidation, its bounds are [0x" << std::hex
-                                 << it->second.dmi.get_start_address() << " - 0x" << it->second.dmi.get_end_address()
-                                 << "]";
-                initiators.insert(t);
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_dmi_mutex);
+            uint64_t generation = m_dmi_generation.load() + 1;
+            m_dmi_invalidations[generation % DMI_INVALIDATION_HISTORY] = { start, end };
+            m_dmi_generation.store(generation);
+
+            auto cur = std::atomic_load(&m_dmi_registry);
+            if (!dmi_overlaps(*cur, start, end)) return;
+
+            auto next = std::make_shared<dmi_registry>(*cur);
+            dmi_split_range(*next, start, end);
+
+            auto it = next->lower_bound(start);
+            while (it != next->end() && it->first <= end) {
+                for (auto t : it->second.initiators) {
+                    SCP_TRACE((DMI)) << "Queueing initiator " << t << " for invalidation, its bounds are [0x" << std::hex
+                                     << it->first << " - 0x" << it->second.end << "]";
+                    initiators.insert(t);
+                }
+                it = next->erase(it);
             }
-            it = m_dmi_info_map.erase(it);
+            std::atomic_store(&m_dmi_registry, std::shared_ptr<const dmi_registry>(std::move(next)));
         }
         for (auto t : initiators) {
             SCP_INFO((DMI)) << "Invalidating initiator " << t << " [0x" << std::hex << start << " - 0x" << end << "]";
@@ -331,19 +480,104 @@ private:
         }
     }
 
+    size_t find_decode_entry(uint64_t addr) const
+    {
+        auto it = std::upper_bound(m_decode_table.begin(), m_decode_table.end(), addr,
+                                   [](uint64_t a, const decode_entry& e) { return a < e.start; });
+        if (it == m_decode_table.begin()) return NO_DECODE_ENTRY;
+        --it;
+        if (addr > it->end) return NO_DECODE_ENTRY;
+        return it - m_decode_table.begin();
+    }
+
     target_info* decode_address(tlm::tlm_generic_payload& trans)
     {
-        lazy_initialize();
+        if (!initialized) lazy_initialize();
 
-        sc_dt::uint64 addr = trans.get_address();
-        sc_dt::uint64 len = trans.get_data_length();
+        size_t idx = find_decode_entry(trans.get_address());
+        return (idx == NO_DECODE_ENTRY) ? nullptr : m_decode_table[idx].ti;
+    }
+
+    /* Same as above, but first tries the last entry hit by this initiator */
+    const decode_entry* decode_entry_for(int id, sc_dt::uint64 addr)
+    {
+        if (!initialized) lazy_initialize();
+
+        bool cached = id >= 0 && static_cast<size_t>(id) < m_last_hit.size();
+        if (cached) {
+            size_t hit = m_last_hit[id].load(std::memory_order_relaxed);
+            if (hit < m_decode_table.size() && addr >= m_decode_table[hit].start && addr <= m_decode_table[hit].end) {
+                return &m_decode_table[hit];
+            }
+        }
+
+        size_t idx = find_decode_entry(addr);
+        if (idx == NO_DECODE_ENTRY) return nullptr;
+        if (cached) m_last_hit[id].store(idx, std::memory_order_relaxed);
+        return &m_decode_table[idx];
+    }
+
+    target_info* decode_address(int id, tlm::tlm_generic_payload& trans)
+    {
+        auto entry = decode_entry_for(id, trans.get_address());
+        return entry ? entry->ti : nullptr;
+    }
+
+    /*
+     * Tell an initiator asking for it whether the target of this transaction
+     * may be called from any thread, and over which range around the address
+     * that remains true.
+     */
+    void update_thread_safe_hint(const decode_entry& entry, tlm::tlm_generic_payload& trans)
+    {
+        ThreadSafeHintExtension* hint = nullptr;
+        trans.get_extension(hint);
+        if (!hint) return;
+
+        if (entry.ti->thread_safe) {
+            hint->narrow(trans.get_address(), entry.start, entry.end);
+        } else {
+            hint->set_unsafe();
+        }
+    }
 
+    /*
+     * Split the address space at every target boundary, and give each slice
+     * to the first target (in priority order) that covers it. Adjacent slices
+     * decoding to the same target are merged.
+     */
+    void build_decode_table()
+    {
+        std::vector<uint64_t> bounds;
         for (auto ti : targets) {
-            if (addr >= ti->address && (addr - ti->address) < ti->size) {
-                return ti;
+            if (ti->size == 0) continue;
+            bounds.push_back(ti->address);
+            uint64_t last = ti->address + (ti->size - 1);
+            if (last != std::numeric_limits<uint64_t>::max()) bounds.push_back(last + 1);
+        }
+        std::sort(bounds.begin(), bounds.end());
+        bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+        m_decode_table.clear();
+        for (size_t i = 0; i < bounds.size(); i++) {
+            uint64_t start = bounds[i];
+            uint64_t end = (i + 1 < bounds.size()) ? bounds[i + 1] - 1 : std::numeric_limits<uint64_t>::max();
+            auto owner = std::find_if(targets.begin(), targets.end(), [start](const target_info* ti) {
+                return start >= ti->address && (start - ti->address) < ti->size;
+            });
+            if (owner == targets.end()) continue;
+            if (!m_decode_table.empty() && m_decode_table.back().ti == *owner &&
+                m_decode_table.back().end + 1 == start) {
+                m_decode_table.back().end = end;
+            } else {
+                m_decode_table.push_back({ start, end, *owner });
             }
         }
-        return nullptr;
+
+        m_last_hit = std::vector<std::atomic<size_t>>(target_socket.size());
+        for (auto& h : m_last_hit) h.store(NO_DECODE_ENTRY, std::memory_order_relaxed);
+
+        SCP_DEBUG(())("Decode table built with {} entries for {} targets", m_decode_table.size(), targets.size());
     }
 
     target_info* find_hole(uint64_t addr, tlm::tlm_dmi& dmi)
@@ -409,6 +643,7 @@ private:
             ti.use_offset = gs::cci_get_d<bool>(m_broker, name + ".relative_addresses", true);
             ti.chained = gs::cci_get_d<bool>(m_broker, name + ".chained", false);
             ti.priority = gs::cci_get_d<uint32_t>(m_broker, name + ".priority", 0);
+            ti.thread_safe = gs::cci_get_d<bool>(m_broker, name + ".thread_safe", false);
 
             SCP_INFO((D[ti.index]), ti.name)
                 << "Address map " << ti.name << " at address "
@@ -444,6 +679,7 @@ private:
             std::stable_sort(targets.begin(), targets.end(), [](const target_info* first, const target_info* second) {
                 return first->priority < second->priority;
             });
+        build_decode_table();
     }
 
     cci::cci_broker_handle m_broker;
@@ -471,13 +707,7 @@ public:
 
     router(const router&) = delete;
 
-    ~router()
-    {
-        while (m_pathIDPool.size()) {
-            delete (m_pathIDPool.back());
-            m_pathIDPool.pop_back();
-        }
-    }
+    ~router() = default;
 
     void add_target(TargetSocket& t, const uint64_t address, uint64_t size, bool masked = true)
     {
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <systemc>
+#include <cci/utils/broker.h>
+
+#include <ports/biflow-socket.h>
+#include <tests/test-bench.h>
+
+/* One end of a biflow link, recording everything it receives */
+class BiflowEnd : public sc_core::sc_module
+{
+public:
+    gs::biflow_socket<BiflowEnd> socket;
+    std::vector<uint8_t> received;
+    int nb_txns = 0;
+    sc_core::sc_event received_ev;
+
+    void b_transport(tlm::tlm_generic_payload& txn, sc_core::sc_time& t)
+    {
+        uint8_t* data = txn.get_data_ptr();
+        ASSERT_EQ(txn.get_data_length(), txn.get_streaming_width());
+        received.insert(received.end(), data, data + txn.get_streaming_width());
+        nb_txns++;
+        received_ev.notify();
+    }
+
+    BiflowEnd(const sc_core::sc_module_name& n): sc_core::sc_module(n), socket("biflow_socket")
+    {
+        socket.register_b_transport(this, &BiflowEnd::b_transport);
+    }
+
+    void wait_for(size_t len)
+    {
+        while (received.size() < len) {
+            sc_core::wait(received_ev);
+        }
+    }
+};
+
+class BiflowTestBench : public TestBench
+{
+public:
+    static constexpr size_t QUEUE_SIZE = 16;
+
+    BiflowEnd m_a;
+    BiflowEnd m_b;
+
+    BiflowTestBench(const sc_core::sc_module_name& n): TestBench(n), m_a("a"), m_b("b") { m_a.socket.bind(m_b.socket); }
+
+    static std::vector<uint8_t> pattern(size_t len, uint8_t start = 0)
+    {
+        std::vector<uint8_t> v(len);
+        for (size_t i = 0; i < len; i++) v[i] = start + i;
+        return v;
+    }
+};
+
+/* A span is sent in a single transaction */
+TEST_BENCH(BiflowTestBench, BulkEnqueue)
+{
+    auto data = pattern(QUEUE_SIZE);
+
+    m_b.socket.can_receive_any();
+    m_a.socket.enqueue(data.data(), data.size());
+    m_b.wait_for(data.size());
+
+    ASSERT_EQ(m_b.received, data);
+    ASSERT_EQ(m_b.nb_txns, 1);
+}
+
+/* Only as many items as allowed are sent, the rest follow as the receiver makes room */
+TEST_BENCH(BiflowTestBench, FlowControl)
+{
+    auto data = pattern(10);
+
+    m_b.socket.can_receive_set(3);
+    for (auto c : data) m_a.socket.enqueue(c);
+    m_b.wait_for(3);
+    sc_core::wait(sc_core::SC_ZERO_TIME);
+    ASSERT_EQ(m_b.received.size(), 3);
+
+    m_b.socket.can_receive_more(7);
+    m_b.wait_for(data.size());
+    ASSERT_EQ(m_b.received, data);
+
+    /* Stop waiting for more, so that the simulation can end */
+    m_b.socket.can_receive_set(0);
+}
+
+/* Data wrapping around the end of the ring keeps its order */
+TEST_BENCH(BiflowTestBench, Wrap)
+{
+    auto first = pattern(QUEUE_SIZE - 4);
+    auto second = pattern(QUEUE_SIZE / 2, 0x80);
+
+    m_b.socket.can_receive_any();
+    m_a.socket.enqueue(first.data(), first.size());
+    m_b.wait_for(first.size());
+    m_a.socket.enqueue(second.data(), second.size());
+    m_b.wait_for(first.size() + second.size());
+
+    first.insert(first.end(), second.begin(), second.end());
+    ASSERT_EQ(m_b.received, first);
+}
+
+/* A backlog larger than the ring is kept whole */
+TEST_BENCH(BiflowTestBench, Grow)
+{
+    auto data = pattern(QUEUE_SIZE * 5 + 3);
+
+    m_b.socket.can_receive_set(1);
+    m_a.socket.enqueue(data.data(), QUEUE_SIZE);
+    m_b.wait_for(1);
+    m_a.socket.enqueue(data.data() + QUEUE_SIZE, data.size() - QUEUE_SIZE);
+    m_b.socket.can_receive_any();
+    m_b.wait_for(data.size());
+
+    ASSERT_EQ(m_b.received, data);
+    m_b.socket.can_receive_set(0);
+}
+
+/* Queued data is dropped on reset */
+TEST_BENCH(BiflowTestBench, Reset)
+{
+    auto data = pattern(8);
+
+    m_b.socket.can_receive_set(0);
+    m_a.socket.enqueue(data.data(), data.size());
+    sc_core::wait(sc_core::SC_ZERO_TIME);
+    m_a.socket.reset();
+    m_a.socket.enqueue(data.data() + 4, 4);
+    m_b.socket.can_receive_any();
+    m_b.wait_for(4);
+
+    ASSERT_EQ(m_b.received, std::vector<uint8_t>(data.begin() + 4, data.end()));
+}
+
+/* Spans go through the router of a multi socket unchanged */
+class BiflowMultiTestBench : public TestBench
+{
+public:
+    gs::biflow_socket_multi<BiflowMultiTestBench> m_multi;
+    BiflowEnd m_a;
+    BiflowEnd m_b;
+    std::vector<uint8_t> received;
+    sc_core::sc_event received_ev;
+
+    void b_transport(tlm::tlm_generic_payload& txn, sc_core::sc_time& t)
+    {
+        uint8_t* data = txn.get_data_ptr();
+        received.insert(received.end(), data, data + txn.get_streaming_width());
+        received_ev.notify();
+    }
+
+    BiflowMultiTestBench(const sc_core::sc_module_name& n)
+        : TestBench(n), m_multi("multi"), m_a("a"), m_b("b")
+    {
+        m_multi.register_b_transport(this, &BiflowMultiTestBench::b_transport);
+        m_a.socket.bind(m_multi);
+        m_b.socket.bind(m_multi);
+    }
+};
+
+TEST_BENCH(BiflowMultiTestBench, Router)
+{
+    auto data = BiflowTestBench::pattern(100);
+
+    m_multi.can_receive_any();
+    m_a.socket.can_receive_any();
+    m_b.socket.can_receive_any();
+
+    m_multi.enqueue(data.data(), data.size());
+    m_a.wait_for(data.size());
+    m_b.wait_for(data.size());
+    ASSERT_EQ(m_a.received, data);
+    ASSERT_EQ(m_b.received, data);
+
+    m_a.socket.enqueue(data.data(), data.size());
+    while (received.size() < data.size()) sc_core::wait(received_ev);
+    ASSERT_EQ(received, data);
+}
+
+int sc_main(int argc, char* argv[])
+{
+    cci_utils::consuming_broker broker("global_broker");
+    cci_register_broker(broker);
+
+    /* Small rings, so that the tests wrap around and grow them */
+    for (auto test : { "BulkEnqueue", "FlowControl", "Wrap", "Grow", "Reset" }) {
+        broker.set_preset_cci_value(std::string(test) + ".a.biflow_socket.queue_size",
+                                    cci::cci_value(uint32_t(BiflowTestBench::QUEUE_SIZE)));
+    }
+
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
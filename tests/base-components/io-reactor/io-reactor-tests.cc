@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <systemc>
+#include <gtest/gtest.h>
+
+#include <io_reactor.h>
+
+using namespace gs;
+
+/* Collects what a reader receives, and lets the test wait for it */
+struct Sink {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string data;
+    int nb_reads = 0;
+    bool closed = false;
+
+    void on_read(const uint8_t* buf, size_t len)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        data.append(reinterpret_cast<const char*>(buf), len);
+        nb_reads++;
+        cv.notify_all();
+    }
+
+    void on_close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        cv.notify_all();
+    }
+
+    bool wait_for(size_t len)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, std::chrono::seconds(5), [&]() { return data.size() >= len; });
+    }
+
+    bool wait_closed()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, std::chrono::seconds(5), [&]() { return closed; });
+    }
+};
+
+static void set_nonblock(int fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+static void add_sink(int fd, Sink& sink)
+{
+    IoReactor::get().add_reader(
+        fd, [&sink](const uint8_t* buf, size_t len) { sink.on_read(buf, len); }, [&sink]() { sink.on_close(); });
+}
+
+/* Everything available is read at once, not byte by byte */
+TEST(IoReactor, BufferedRead)
+{
+    int p[2];
+    ASSERT_EQ(pipe(p), 0);
+    set_nonblock(p[0]);
+
+    std::string msg(1000, 'x');
+    ASSERT_EQ(write(p[1], msg.data(), msg.size()), msg.size());
+
+    Sink sink;
+    add_sink(p[0], sink);
+    ASSERT_TRUE(sink.wait_for(msg.size()));
+    ASSERT_EQ(sink.data, msg);
+    ASSERT_EQ(sink.nb_reads, 1);
+
+    close(p[1]);
+    ASSERT_TRUE(sink.wait_closed());
+    close(p[0]);
+}
+
+/* Once removed, a reader is not called any more */
+TEST(IoReactor, Remove)
+{
+    int p[2];
+    ASSERT_EQ(pipe(p), 0);
+    set_nonblock(p[0]);
+
+    Sink sink;
+    add_sink(p[0], sink);
+    ASSERT_EQ(write(p[1], "a", 1), 1);
+    ASSERT_TRUE(sink.wait_for(1));
+
+    IoReactor::get().remove(p[0]);
+    ASSERT_EQ(write(p[1], "b", 1), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(sink.data, "a");
+
+    close(p[0]);
+    close(p[1]);
+}
+
+TEST(IoReactor, Timer)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<int> order;
+
+    auto push = [&](int i) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(i);
+        cv.notify_all();
+    };
+    IoReactor::get().call_after(std::chrono::milliseconds(20), [&]() { push(2); });
+    IoReactor::get().call_after(std::chrono::milliseconds(1), [&]() { push(1); });
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return order.size() == 2; }));
+    ASSERT_EQ(order, std::vector<int>({ 1, 2 }));
+}
+
+/* Small writes are sent together, once the threshold is reached */
+TEST(IoWriter, Deferred)
+{
+    int s[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, s), 0);
+    set_nonblock(s[1]);
+
+    IoWriter writer(IoWriter::FlushPolicy::DEFERRED, 16, std::chrono::seconds(10));
+    writer.set_fd(s[0]);
+    for (int i = 0; i < 15; i++) writer.write(reinterpret_cast<const uint8_t*>("a"), 1);
+
+    char buf[64];
+    ASSERT_EQ(read(s[1], buf, sizeof(buf)), -1);
+    ASSERT_EQ(writer.pending(), 15);
+
+    writer.write(reinterpret_cast<const uint8_t*>("b"), 1);
+    ASSERT_EQ(writer.pending(), 0);
+    ASSERT_EQ(read(s[1], buf, sizeof(buf)), 16);
+    ASSERT_EQ(std::string(buf, 16), std::string(15, 'a') + "b");
+
+    writer.set_fd(-1);
+    close(s[0]);
+    close(s[1]);
+}
+
+/* Pending data is written after the flush delay */
+TEST(IoWriter, DeferredDelay)
+{
+    int s[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, s), 0);
+
+    IoWriter writer(IoWriter::FlushPolicy::DEFERRED, 4096, std::chrono::milliseconds(5));
+    writer.set_fd(s[0]);
+    writer.write(reinterpret_cast<const uint8_t*>("hello"), 5);
+
+    Sink sink;
+    set_nonblock(s[1]);
+    add_sink(s[1], sink);
+    ASSERT_TRUE(sink.wait_for(5));
+    ASSERT_EQ(sink.data, "hello");
+
+    IoReactor::get().remove(s[1]);
+    writer.set_fd(-1);
+    close(s[0]);
+    close(s[1]);
+}
+
+TEST(IoWriter, Line)
+{
+    int s[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, s), 0);
+    set_nonblock(s[1]);
+
+    IoWriter writer(IoWriter::FlushPolicy::LINE, 4096, std::chrono::seconds(10));
+    writer.set_fd(s[0]);
+    writer.write(reinterpret_cast<const uint8_t*>("abc"), 3);
+    ASSERT_EQ(writer.pending(), 3);
+    writer.write(reinterpret_cast<const uint8_t*>("d\nef"), 4);
+    ASSERT_EQ(writer.pending(), 0);
+
+    char buf[64];
+    ASSERT_EQ(read(s[1], buf, sizeof(buf)), 7);
+    ASSERT_EQ(std::string(buf, 7), "abcd\nef");
+
+    writer.set_fd(-1);
+    close(s[0]);
+    close(s[1]);
+}
+
+/* Output the fd can't take yet is written by the reactor, in order */
+TEST(IoWriter, Backlog)
+{
+    int s[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, s), 0);
+    set_nonblock(s[0]);
+    int sz = 4096;
+    setsockopt(s[0], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+
+    std::string expected;
+    IoWriter writer;
+    writer.set_fd(s[0]);
+    for (int i = 0; i < 1000; i++) {
+        std::string line = "line " + std::to_string(i) + "\n";
+        expected += line;
+        writer.write(reinterpret_cast<const uint8_t*>(line.data()), line.size());
+    }
+    ASSERT_GT(writer.pending(), 0);
+
+    Sink sink;
+    set_nonblock(s[1]);
+    add_sink(s[1], sink);
+    ASSERT_TRUE(sink.wait_for(expected.size()));
+    ASSERT_EQ(sink.data, expected);
+    ASSERT_EQ(writer.pending(), 0);
+
+    IoReactor::get().remove(s[1]);
+    writer.set_fd(-1);
+    close(s[0]);
+    close(s[1]);
+}
+
+/* Writing to a closed socket fails without raising SIGPIPE */
+TEST(IoWriter, PeerClosed)
+{
+    int s[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, s), 0);
+    close(s[1]);
+
+    IoWriter writer;
+    writer.set_fd(s[0]);
+    writer.write(reinterpret_cast<const uint8_t*>("x"), 1);
+    ASSERT_EQ(writer.error(), EPIPE);
+    ASSERT_EQ(writer.pending(), 0);
+
+    writer.set_fd(-1);
+    close(s[0]);
+}
+
+TEST(IoWriter, PolicyFromString)
+{
+    IoWriter::FlushPolicy policy;
+
+    ASSERT_TRUE(IoWriter::policy_from_string("line", policy));
+    ASSERT_EQ(policy, IoWriter::FlushPolicy::LINE);
+    ASSERT_TRUE(IoWriter::policy_from_string("deferred", policy));
+    ASSERT_EQ(policy, IoWriter::FlushPolicy::DEFERRED);
+    ASSERT_TRUE(IoWriter::policy_from_string("immediate", policy));
+    ASSERT_EQ(policy, IoWriter::FlushPolicy::IMMEDIATE);
+    ASSERT_FALSE(IoWriter::policy_from_string("sometimes", policy));
+}
+
+int sc_main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -79,3 +79,20 @@ public:
 
     virtual ~MemoryTestBench() {}
 };
+
+class SparseMemoryTestBench : public MemoryTestBench
+{
+public:
+    int m_invalidations = 0;
+
+    SparseMemoryTestBench(const sc_core::sc_module_name& n): MemoryTestBench(n)
+    {
+        m_target.p_sparse = true;
+        /* restoring a snapshot invalidates the whole memory */
+        m_initiator.register_invalidate_direct_mem_ptr([this](uint64_t start, uint64_t end) {
+            ASSERT_EQ(start, 0u);
+            ASSERT_EQ(end, MEMORY_SIZE - 1);
+            m_invalidations++;
+        });
+    }
+};
@@ -8,6 +8,8 @@
 #define SC_ALLOW_DEPRECATED_IEEE_API
 #include <systemc>
 
+#include <thread>
+
 #include "memory-bench.h"
 #include <cci/utils/broker.h>
 
@@ -128,6 +130,66 @@ TEST_BENCH(MemoryTestBench, DmiWriteRead)
     ASSERT_EQ(data, data_read);
 }
 
+// Sparse memory reads as zero until written, and only touched pages become resident
+TEST_BENCH(SparseMemoryTestBench, SparseWriteRead)
+{
+    uint8_t data;
+    ASSERT_EQ(m_initiator.do_read(0x10, data), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(data, 0);
+    ASSERT_EQ(m_initiator.do_write(0x10, 0x04), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(m_initiator.do_read(0x10, data), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(data, 0x04);
+    ASSERT_GT(m_target.resident_size(), 0);
+
+    do_good_dmi_request_and_check(0, 0, MEMORY_SIZE - 1);
+}
+
+// Restoring a snapshot reverts the writes done since it was taken
+TEST_BENCH(SparseMemoryTestBench, SparseSnapshotRestore)
+{
+    uint8_t data;
+    ASSERT_EQ(m_initiator.do_write(0x10, 0x04), tlm::TLM_OK_RESPONSE);
+    m_target.snapshot();
+    ASSERT_EQ(m_initiator.do_read(0x10, data), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(data, 0x04);
+
+    ASSERT_EQ(m_initiator.do_write(0x10, 0x05), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(m_initiator.do_write(0x20, 0x06), tlm::TLM_OK_RESPONSE);
+    m_target.restore();
+    ASSERT_EQ(m_invalidations, 1);
+    ASSERT_EQ(m_initiator.do_read(0x10, data), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(data, 0x04);
+    ASSERT_EQ(m_initiator.do_read(0x20, data), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(data, 0);
+
+    /* The snapshot can be restored more than once */
+    ASSERT_EQ(m_initiator.do_write(0x10, 0x07), tlm::TLM_OK_RESPONSE);
+    m_target.restore();
+    ASSERT_EQ(m_initiator.do_read(0x10, data), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(data, 0x04);
+}
+
+// Writing the snapshot parameters from another thread takes and restores the snapshot on the SystemC thread
+TEST_BENCH(SparseMemoryTestBench, SparseRestoreFromOtherThread)
+{
+    uint8_t data;
+    ASSERT_EQ(m_initiator.do_write(0x10, 0x04), tlm::TLM_OK_RESPONSE);
+    m_target.p_snapshot = true;
+    ASSERT_EQ(m_initiator.do_write(0x10, 0x05), tlm::TLM_OK_RESPONSE);
+
+    std::thread writer([&]() { m_target.p_restore = true; });
+    writer.join();
+    /* The restore runs once this thread yields */
+    ASSERT_EQ(m_invalidations, 0);
+    for (int i = 0; i < 1000 && !m_invalidations; i++) {
+        sc_core::wait(1, sc_core::SC_NS);
+    }
+
+    ASSERT_EQ(m_invalidations, 1);
+    ASSERT_EQ(m_initiator.do_read(0x10, data), tlm::TLM_OK_RESPONSE);
+    ASSERT_EQ(data, 0x04);
+}
+
 int sc_main(int argc, char* argv[])
 {
     cci_utils::consuming_broker broker("global_broker");
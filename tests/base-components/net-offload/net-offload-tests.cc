@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <systemc>
+#include <gtest/gtest.h>
+
+#include <macs/offload.h>
+
+using namespace net_offload;
+
+/* Straightforward RFC 1071 checksum on big endian words, used as reference */
+static uint16_t ref_checksum(const uint8_t* buf, size_t len, uint32_t sum = 0)
+{
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (buf[i] << 8) | buf[i + 1];
+    }
+    if (len & 1) {
+        sum += buf[len - 1] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum & 0xffff;
+}
+
+static uint16_t be16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+
+static uint32_t be32(const uint8_t* p) { return (uint32_t(be16(p)) << 16) | be16(p + 2); }
+
+static void set_be16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+/* Ethernet + IPv4 (no options) + TCP (no options) frame with a random payload */
+static std::vector<uint8_t> make_tcp4_frame(size_t payload_len, uint8_t flags)
+{
+    std::vector<uint8_t> f(14 + 20 + 20 + payload_len, 0);
+    set_be16(&f[12], 0x0800);
+
+    uint8_t* ip = &f[14];
+    ip[0] = 0x45;
+    set_be16(ip + 2, 40 + payload_len);
+    set_be16(ip + 4, 0x1234);
+    ip[8] = 64;
+    ip[9] = 6;
+    ip[12] = 10, ip[15] = 1;
+    ip[16] = 10, ip[19] = 2;
+
+    uint8_t* tcp = ip + 20;
+    set_be16(tcp, 1234);
+    set_be16(tcp + 2, 80);
+    tcp[7] = 100;
+    tcp[12] = 5 << 4;
+    tcp[13] = flags;
+    for (size_t i = 0; i < payload_len; i++) {
+        tcp[20 + i] = rand();
+    }
+    return f;
+}
+
+static bool tcp4_checksums_valid(const uint8_t* frame, size_t len)
+{
+    const uint8_t* ip = frame + 14;
+    size_t l4_len = len - 34;
+    uint32_t pseudo = be16(ip + 12) + be16(ip + 14) + be16(ip + 16) + be16(ip + 18) + 6 + l4_len;
+
+    return ref_checksum(ip, 20) == 0 && ref_checksum(ip + 20, l4_len, pseudo) == 0;
+}
+
+TEST(NetOffload, SumMatchesReference)
+{
+    std::vector<uint8_t> buf(4096 + 1);
+
+    for (int i = 0; i < 2000; i++) {
+        size_t len = rand() % 4096;
+        size_t off = rand() % 2;
+        for (auto& b : buf) b = rand();
+
+        uint16_t csum = csum_fold(csum_add(buf.data() + off, len));
+        uint8_t* wire = reinterpret_cast<uint8_t*>(&csum);
+        ASSERT_EQ(be16(wire), ref_checksum(buf.data() + off, len)) << "len " << len;
+    }
+}
+
+TEST(NetOffload, InsertTcp4Checksums)
+{
+    std::vector<uint8_t> f = make_tcp4_frame(1000, 0x18);
+
+    ASSERT_TRUE(insert_checksums(f.data(), f.size(), ChecksumLevel::FULL));
+    ASSERT_TRUE(tcp4_checksums_valid(f.data(), f.size()));
+}
+
+TEST(NetOffload, InsertIpHeaderOnly)
+{
+    std::vector<uint8_t> f = make_tcp4_frame(100, 0x18);
+
+    ASSERT_TRUE(insert_checksums(f.data(), f.size(), ChecksumLevel::IP_HEADER));
+    ASSERT_EQ(ref_checksum(&f[14], 20), 0);
+    ASSERT_EQ(be16(&f[34 + 16]), 0);
+}
+
+TEST(NetOffload, InsertUdp6Checksum)
+{
+    const size_t udp_len = 8 + 33;
+    std::vector<uint8_t> f(14 + 40 + udp_len, 0);
+    set_be16(&f[12], 0x86dd);
+
+    uint8_t* ip = &f[14];
+    ip[0] = 0x60;
+    set_be16(ip + 4, udp_len);
+    ip[6] = 17;
+    for (int i = 8; i < 40; i++) ip[i] = rand();
+
+    uint8_t* udp = ip + 40;
+    set_be16(udp + 4, udp_len);
+    for (size_t i = 8; i < udp_len; i++) udp[i] = rand();
+
+    ASSERT_TRUE(insert_checksums(f.data(), f.size(), ChecksumLevel::FULL));
+
+    uint32_t pseudo = 17 + udp_len;
+    for (int i = 8; i < 40; i += 2) pseudo += be16(ip + i);
+    ASSERT_EQ(ref_checksum(udp, udp_len, pseudo), 0);
+    ASSERT_NE(be16(udp + 6), 0);
+}
+
+TEST(NetOffload, IgnoreNonIpFrames)
+{
+    std::vector<uint8_t> f(60, 0xab);
+    set_be16(&f[12], 0x0806);
+    std::vector<uint8_t> orig = f;
+
+    ASSERT_FALSE(insert_checksums(f.data(), f.size(), ChecksumLevel::FULL));
+    ASSERT_EQ(f, orig);
+}
+
+TEST(NetOffload, TcpSegmentation)
+{
+    const size_t payload = 5000, mss = 1448;
+    std::vector<uint8_t> f = make_tcp4_frame(payload, 0x80 | 0x18 | 0x01); // CWR, ACK, PSH, FIN
+    Payload seg(2048);
+    std::vector<uint8_t> data;
+    size_t n = 0;
+
+    size_t ret = tso_segment(f.data(), f.size(), mss, seg, [&](Payload& p) {
+        const uint8_t* ip = p.data() + 14;
+        const uint8_t* tcp = ip + 20;
+        bool last = (data.size() + p.size() - 54 == payload);
+
+        ASSERT_TRUE(tcp4_checksums_valid(p.data(), p.size()));
+        ASSERT_EQ(be16(ip + 2), p.size() - 14);
+        ASSERT_EQ(be16(ip + 4), 0x1234 + n);
+        ASSERT_EQ(be32(tcp + 4), 100 + data.size());
+        ASSERT_EQ(tcp[13] & 0x80, n == 0 ? 0x80 : 0);
+        ASSERT_EQ(tcp[13] & 0x09, last ? 0x09 : 0);
+        if (!last) {
+            ASSERT_EQ(p.size() - 54, mss);
+        }
+
+        data.insert(data.end(), tcp + 20, tcp + p.size() - 34);
+        n++;
+    });
+
+    ASSERT_EQ(ret, (payload + mss - 1) / mss);
+    ASSERT_EQ(ret, n);
+    ASSERT_TRUE(std::equal(data.begin(), data.end(), f.begin() + 54));
+}
+
+TEST(NetOffload, TcpSegmentationSmallBuffer)
+{
+    std::vector<uint8_t> f = make_tcp4_frame(3000, 0x18);
+    Payload seg(1000);
+
+    ASSERT_EQ(tso_segment(f.data(), f.size(), 1448, seg, [](Payload&) {}), 0);
+}
+
+int sc_main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
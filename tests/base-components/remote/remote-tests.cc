@@ -71,5 +71,11 @@ int sc_main(int argc, char* argv[])
     });
 
     ::testing::InitGoogleTest(&argc, argv);
+
+    /* Send the b_transports through the shared memory rings, both ways */
+    if (argc > 1 && std::string(argv[1]) == "--shmem") {
+        m_broker.set_preset_cci_value("test_bench.pass.transport", cci::cci_value(std::string("shmem")));
+        m_broker.set_preset_cci_value("test_bench.pass.remote_pass.transport", cci::cci_value(std::string("shmem")));
+    }
     return RUN_ALL_TESTS();
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include "router.h"
 #include "pass.h"
+#include <tlm-extensions/thread-safe-hint.h>
 #include <tests/initiator-tester.h>
 #include <tests/target-tester.h>
 #include <tests/test-bench.h>
@@ -42,10 +43,22 @@ private:
 
     uint8_t emptydata[1000] = { 0xDE, 0xAD, 0xBE, 0xEF };
 
+    bool m_expect_invalidation = false;
+    std::vector<std::pair<uint64_t, uint64_t>> m_invalidations;
+
+    /* Invalidation a target raises while granting DMI, if any */
+    int m_grant_invalidate_id = -1;
+    uint64_t m_grant_invalidate_start = 0;
+    uint64_t m_grant_invalidate_end = 0;
+    int m_grants = 0;
+
     /* Initiator callback */
     void invalidate_direct_mem_ptr(uint64_t start_range, uint64_t end_range)
     {
-        ADD_FAILURE(); /* we don't expect any invalidation */
+        if (!m_expect_invalidation) {
+            ADD_FAILURE(); /* we don't expect any invalidation */
+        }
+        m_invalidations.push_back({ start_range, end_range });
     }
 
     /* Target callbacks */
@@ -178,6 +191,12 @@ private:
         if (addr >= target_size[id]) {
             return false;
         } else {
+            m_grants++;
+            if (m_grant_invalidate_id >= 0) {
+                m_target[m_grant_invalidate_id]->socket->invalidate_direct_mem_ptr(m_grant_invalidate_start,
+                                                                                 m_grant_invalidate_end);
+            }
+
             dmi_data.allow_read_write();
             dmi_data.set_dmi_ptr(nullptr);
             dmi_data.set_start_address(0);
@@ -224,6 +243,76 @@ protected:
         }
     }
 
+    /* Access an address mapped by several targets, and check which one decoded it */
+    void do_overlap_decode_and_check(int expected_id, uint64_t addr)
+    {
+        TlmResponseStatus ret = m_initiator.do_read_with_ptr(addr, emptydata, 1, false);
+        ASSERT_EQ(ret, tlm::TLM_OK_RESPONSE);
+        for (int i = 0; i < NB_TARGETS; i++) {
+            ASSERT_EQ(m_target[i]->last_txn_is_valid(), i == expected_id);
+        }
+        const TlmGenericPayload& target_txn = m_target[expected_id]->get_last_txn();
+        ASSERT_EQ((target_txn.get_address() + address[expected_id]), addr);
+    }
+
+    /* Invalidate [start, end] from target id, and check whether the initiator was told about it */
+    void do_target_invalidate_and_check(int id, uint64_t start, uint64_t end, bool expected)
+    {
+        m_invalidations.clear();
+        m_expect_invalidation = true;
+        m_target[id]->socket->invalidate_direct_mem_ptr(start, end);
+        m_expect_invalidation = false;
+
+        if (!expected) {
+            ASSERT_TRUE(m_invalidations.empty());
+            return;
+        }
+        ASSERT_EQ(m_invalidations.size(), 1u);
+        ASSERT_EQ(m_invalidations[0].first, address[id] + start);
+        ASSERT_EQ(m_invalidations[0].second, address[id] + end);
+    }
+
+    /*
+     * Request DMI from target id, which invalidates [start, end] of target inv_id
+     * while granting it, and check how many times the router asked for it.
+     */
+    void do_dmi_request_invalidating_and_check(int id, int inv_id, uint64_t start, uint64_t end, bool many_grants)
+    {
+        m_grants = 0;
+        m_grant_invalidate_id = inv_id;
+        m_grant_invalidate_start = start;
+        m_grant_invalidate_end = end;
+        m_expect_invalidation = true;
+        bool ret = m_initiator.do_dmi_request(address[id]);
+        m_expect_invalidation = false;
+        m_grant_invalidate_id = -1;
+
+        ASSERT_TRUE(ret);
+        if (many_grants) {
+            ASSERT_GT(m_grants, 1);
+        } else {
+            ASSERT_EQ(m_grants, 1);
+        }
+    }
+
+    /* Access addr with a thread safe hint, and check the range the router reports */
+    void do_thread_safe_hint_and_check(uint64_t addr, bool safe, uint64_t exp_start = 0, uint64_t exp_end = 0)
+    {
+        TlmGenericPayload txn;
+        gs::ThreadSafeHintExtension hint;
+
+        txn.set_extension(&hint);
+        TlmResponseStatus ret = m_initiator.do_read_with_txn_and_ptr(txn, addr, emptydata, 1);
+        txn.clear_extension(&hint);
+
+        ASSERT_EQ(ret, tlm::TLM_OK_RESPONSE);
+        ASSERT_EQ(hint.is_safe(), safe);
+        if (safe) {
+            ASSERT_EQ(hint.get_start(addr), exp_start);
+            ASSERT_EQ(hint.get_end(addr), exp_end);
+        }
+    }
+
     void do_bad_dmi_request_and_check(int id, uint64_t addr)
     {
         overlap(id);
@@ -252,6 +341,12 @@ public:
             target_size.push_back(address[i] + size[i]);
         }
 
+        /* Targets 1 and 3 accept calls from any thread */
+        for (int i : { 1, 3 }) {
+            cci::cci_get_broker().set_preset_cci_value(std::string(m_target[i]->socket.name()) + ".thread_safe",
+                                                       cci::cci_value(true));
+        }
+
         m_initiator.register_invalidate_direct_mem_ptr(
             [this](uint64_t start, uint64_t end) { invalidate_direct_mem_ptr(start, end); });
         for (auto& t : m_target) {
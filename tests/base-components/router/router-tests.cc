@@ -51,6 +51,15 @@ TEST_BENCH(RouterTestBenchSimple, SimpleReadWriteOverlap)
     do_store_and_check(3, target_size[3] - 1, 1);
 }
 
+// Accesses in the overlapping region go to the first bound target, whichever initiator cache is warm
+TEST_BENCH(RouterTestBenchSimple, OverlapDecodeOrder)
+{
+    do_overlap_decode_and_check(3, address[3] + size[3] - 1);
+    do_overlap_decode_and_check(2, address[3]);
+    do_overlap_decode_and_check(2, address[2] + size[2] - 1);
+    do_overlap_decode_and_check(3, address[2] + size[2]);
+}
+
 // Simple load and store with the Debug Transport Interface into the Target 1 and 2
 TEST_BENCH(RouterTestBenchSimple, SimpleReadWriteDebug)
 {
@@ -114,6 +123,64 @@ TEST_BENCH(RouterTestBenchSimple, SimpleDmiOverlap)
     do_good_dmi_request_and_check(3, address[3], address[3], target_size[3] - 1);
 }
 
+// Partial invalidations only drop the invalidated part of a DMI region
+TEST_BENCH(RouterTestBenchSimple, DmiPartialInvalidation)
+{
+    do_good_dmi_request_and_check(0, 0, 0, target_size[0] - 1);
+
+    do_target_invalidate_and_check(0, 16, 31, true);
+    /* The rest of the region is still known to be held by the initiator */
+    do_target_invalidate_and_check(0, 100, 110, true);
+    /* ... but not the part already invalidated */
+    do_target_invalidate_and_check(0, 16, 31, false);
+
+    /* A new grant is tracked again */
+    do_good_dmi_request_and_check(0, 0, 0, target_size[0] - 1);
+    do_target_invalidate_and_check(0, 16, 31, true);
+}
+
+// A grant only races with the invalidations overlapping it
+TEST_BENCH(RouterTestBenchSimple, DmiGrantRacingInvalidation)
+{
+    /* Invalidating another target does not make the router ask again */
+    do_dmi_request_invalidating_and_check(0, 1, 0, 15, false);
+    do_target_invalidate_and_check(0, 16, 31, true);
+
+    /* Invalidating the grant itself every time still ends up granted, and tracked */
+    do_dmi_request_invalidating_and_check(0, 0, 0, 15, true);
+    do_target_invalidate_and_check(0, 16, 31, true);
+}
+
+// Routers report the range around an access that only leads to thread safe targets
+TEST_BENCH(RouterTestBenchSimple, ThreadSafeHint)
+{
+    do_thread_safe_hint_and_check(0, false);
+    do_thread_safe_hint_and_check(300, true, address[1], address[1] + size[1] - 1);
+    /* The part of target 3 hidden by target 2 is not thread safe */
+    do_thread_safe_hint_and_check(address[3], false);
+    do_thread_safe_hint_and_check(address[2] + size[2], true, address[2] + size[2], address[3] + size[3] - 1);
+}
+
+// Path IDs are bounded, stamping a path deeper than GS_PATHID_MAX_DEPTH throws
+TEST(PathIDExtension, MaxDepth)
+{
+    const int depth = gs::PathIDExtension::MAX_DEPTH;
+    gs::PathIDExtension ext;
+
+    for (int i = 0; i < depth; i++) {
+        ext.push_back(i);
+    }
+    ASSERT_THROW(ext.push_back(-1), std::length_error);
+
+    /* The path is left untouched */
+    ASSERT_EQ(ext.size(), size_t(depth));
+    ASSERT_EQ(ext.back(), depth - 1);
+
+    ext.pop_back();
+    ext.push_back(-1);
+    ASSERT_EQ(ext.back(), -1);
+}
+
 int sc_main(int argc, char* argv[])
 {
     cci_utils::consuming_broker broker("global_broker");
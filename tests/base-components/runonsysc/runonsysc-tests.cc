@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <systemc>
+#include <gtest/gtest.h>
+
+#include <async_event.h>
+#include <runonsysc.h>
+
+/* Gives the tests a view of the queue */
+class TestRunOnSysc : public gs::runonsysc
+{
+public:
+    using gs::runonsysc::runonsysc;
+
+    static constexpr size_t queue_size() { return QUEUE_SIZE; }
+    size_t nb_spilled() const { return m_nb_spilled.load(); }
+};
+
+static TestRunOnSysc* g_on_sysc;
+
+/* Keeps the SystemC thread busy in a job until release() */
+class SyscBlocker
+{
+    std::atomic<bool> m_blocked{ false };
+    std::atomic<bool> m_release{ false };
+
+public:
+    void block()
+    {
+        g_on_sysc->fork_on_systemc([this]() { run(); });
+        while (!m_blocked) std::this_thread::yield();
+    }
+
+    void run()
+    {
+        m_blocked = true;
+        while (!m_release) std::this_thread::yield();
+    }
+
+    void release() { m_release = true; }
+};
+
+/* Fire-and-forget jobs never wait for the SystemC thread, even with the ring full */
+TEST(RunOnSysc, RingFull)
+{
+    const size_t nb_jobs = 4 * TestRunOnSysc::queue_size();
+    std::vector<size_t> order;
+
+    SyscBlocker blocker;
+    blocker.block();
+    for (size_t i = 0; i < nb_jobs; i++) {
+        g_on_sysc->fork_on_systemc([&order, i]() { order.push_back(i); });
+    }
+    EXPECT_GT(g_on_sysc->nb_spilled(), 0u);
+
+    /* A waited job queued behind the spilled ones runs last */
+    std::thread waiter([&]() { EXPECT_TRUE(g_on_sysc->run_on_sysc([&]() { order.push_back(nb_jobs); })); });
+    blocker.release();
+    waiter.join();
+
+    ASSERT_EQ(order.size(), nb_jobs + 1);
+    for (size_t i = 0; i <= nb_jobs; i++) {
+        EXPECT_EQ(order[i], i);
+    }
+    EXPECT_EQ(g_on_sysc->nb_spilled(), 0u);
+}
+
+/* Jobs of each producer run in order, whether they go through the ring or spill */
+TEST(RunOnSysc, ManyProducers)
+{
+    const int nb_producers = 8;
+    const size_t nb_jobs = 2000;
+    std::vector<std::vector<size_t>> seen(nb_producers);
+
+    SyscBlocker blocker;
+    blocker.block();
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < nb_producers; p++) {
+        producers.emplace_back([&, p]() {
+            for (size_t i = 0; i < nb_jobs; i++) {
+                auto job = [&seen, p, i]() { seen[p].push_back(i); };
+                if (i % 4 == 0) {
+                    EXPECT_TRUE(g_on_sysc->run_on_sysc(job));
+                } else {
+                    g_on_sysc->run_on_sysc(job, false);
+                }
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    blocker.release();
+    for (auto& t : producers) {
+        t.join();
+    }
+    g_on_sysc->run_on_sysc([]() {});
+
+    for (int p = 0; p < nb_producers; p++) {
+        ASSERT_EQ(seen[p].size(), nb_jobs);
+        for (size_t i = 0; i < nb_jobs; i++) {
+            EXPECT_EQ(seen[p][i], i);
+        }
+    }
+}
+
+/* Jobs queued while the handler is busy all run in its next wake-up, within the same delta */
+TEST(RunOnSysc, BatchDrain)
+{
+    const size_t nb_jobs = 100;
+    std::vector<uint64_t> deltas;
+
+    SyscBlocker blocker;
+    blocker.block();
+    for (size_t i = 0; i < nb_jobs; i++) {
+        g_on_sysc->fork_on_systemc([&deltas]() { deltas.push_back(sc_core::sc_delta_count()); });
+    }
+    blocker.release();
+    g_on_sysc->run_on_sysc([]() {});
+
+    ASSERT_EQ(deltas.size(), nb_jobs);
+    for (auto d : deltas) {
+        EXPECT_EQ(d, deltas[0]);
+    }
+}
+
+/* cancel_all unblocks the caller of the running job and drops the pending ones */
+TEST(RunOnSysc, CancelAll)
+{
+    std::atomic<bool> blocked{ false };
+    std::atomic<bool> release{ false };
+    std::atomic<int> result{ -1 };
+    std::atomic<bool> done{ false };
+    std::atomic<int> ran{ 0 };
+
+    std::thread running([&]() {
+        /* The job stays alive on this stack until the SystemC thread left it */
+        auto job = [&]() {
+            blocked = true;
+            while (!release) std::this_thread::yield();
+        };
+        result = g_on_sysc->run_on_sysc(job);
+        while (!done) std::this_thread::yield();
+    });
+    while (!blocked) std::this_thread::yield();
+
+    for (size_t i = 0; i < 2 * TestRunOnSysc::queue_size(); i++) {
+        g_on_sysc->fork_on_systemc([&ran]() { ran++; });
+    }
+    bool pending_result = true;
+    std::thread pending([&]() { pending_result = g_on_sysc->run_on_sysc([&ran]() { ran++; }); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    g_on_sysc->cancel_all();
+    pending.join();
+    while (result == -1) std::this_thread::yield();
+
+    EXPECT_FALSE(pending_result);
+    EXPECT_EQ(result, 0);
+
+    release = true;
+    EXPECT_TRUE(g_on_sysc->run_on_sysc([]() {}));
+    EXPECT_EQ(ran, 0);
+    EXPECT_EQ(g_on_sysc->nb_spilled(), 0u);
+
+    done = true;
+    running.join();
+}
+
+/* Runs the tests from another thread, as run_on_sysc must be called from outside SystemC */
+class TestTop : public sc_core::sc_module
+{
+    gs::async_event m_keep_alive;
+    gs::async_event m_tests_done;
+    int m_status = 0;
+
+    void run()
+    {
+        std::thread tests([this]() {
+            m_status = RUN_ALL_TESTS();
+            m_tests_done.async_notify();
+        });
+        sc_core::wait(m_tests_done);
+        tests.join();
+        sc_core::sc_stop();
+    }
+
+public:
+    SC_HAS_PROCESS(TestTop);
+    TestTop(const sc_core::sc_module_name& n): sc_core::sc_module(n), m_keep_alive(true), m_tests_done(true)
+    {
+        SC_THREAD(run);
+    }
+
+    int status() const { return m_status; }
+};
+
+int sc_main(int argc, char* argv[])
+{
+    testing::InitGoogleTest(&argc, argv);
+
+    TestRunOnSysc on_sysc("on_sysc");
+    g_on_sysc = &on_sysc;
+    TestTop top("top");
+
+    sc_core::sc_start();
+    return top.status();
+}
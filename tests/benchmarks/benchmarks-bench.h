@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _GREENSOCS_TESTS_BENCHMARKS_BENCH_H
+#define _GREENSOCS_TESTS_BENCHMARKS_BENCH_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <systemc>
+#include <tlm>
+#include <tlm_utils/simple_initiator_socket.h>
+#include <tlm_utils/simple_target_socket.h>
+#include <scp/report.h>
+
+#include <async_event.h>
+#include <runonsysc.h>
+#include <tlm-extensions/exclusive-access.h>
+
+#include "dmi_converter.h"
+#include "exclusive-monitor.h"
+#include "gs_memory.h"
+#include "reg_router.h"
+#include "registers.h"
+#include "router.h"
+
+/*
+ * Fixtures for the micro-benchmarks. SystemC can only be elaborated once per
+ * process, so every fixture is built up front (see BenchmarksTop) and the
+ * benchmarks are run from a single SystemC thread once the simulation starts.
+ */
+
+/* A target that does nothing, so that only the interconnect is measured */
+class SinkTarget : public sc_core::sc_module
+{
+    void b_transport(tlm::tlm_generic_payload& txn, sc_core::sc_time& delay)
+    {
+        txn.set_response_status(tlm::TLM_OK_RESPONSE);
+    }
+
+public:
+    tlm_utils::simple_target_socket<SinkTarget, DEFAULT_TLM_BUSWIDTH> socket;
+
+    SinkTarget(const sc_core::sc_module_name& n): sc_core::sc_module(n), socket("socket")
+    {
+        socket.register_b_transport(this, &SinkTarget::b_transport);
+    }
+};
+
+/* Common part of the fixtures: an initiator socket and a reusable payload */
+class BenchInitiator : public sc_core::sc_module
+{
+protected:
+    tlm::tlm_generic_payload m_txn;
+    sc_core::sc_time m_delay;
+    uint8_t m_data[64] = {};
+
+public:
+    tlm_utils::simple_initiator_socket<BenchInitiator, DEFAULT_TLM_BUSWIDTH> initiator_socket;
+
+    BenchInitiator(const sc_core::sc_module_name& n): sc_core::sc_module(n), initiator_socket("initiator_socket")
+    {
+        m_txn.set_data_ptr(m_data);
+        m_txn.set_streaming_width(sizeof(m_data));
+    }
+
+    tlm::tlm_generic_payload& txn() { return m_txn; }
+
+    tlm::tlm_response_status access(tlm::tlm_command cmd, uint64_t addr, size_t len)
+    {
+        m_txn.set_command(cmd);
+        m_txn.set_address(addr);
+        m_txn.set_data_length(len);
+        m_txn.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+        m_txn.set_dmi_allowed(false);
+        m_delay = sc_core::SC_ZERO_TIME;
+        initiator_socket->b_transport(m_txn, m_delay);
+        return m_txn.get_response_status();
+    }
+};
+
+/* initiator -> router -> N sink targets of TARGET_SIZE bytes each */
+class RouterBench : public BenchInitiator
+{
+public:
+    static constexpr uint64_t TARGET_SIZE = 0x1000;
+
+private:
+    gs::router<> m_router;
+    sc_core::sc_vector<SinkTarget> m_targets;
+
+public:
+    RouterBench(const sc_core::sc_module_name& n, size_t nb_targets)
+        : BenchInitiator(n), m_router("router"), m_targets("target", nb_targets)
+    {
+        initiator_socket.bind(m_router.target_socket);
+        for (size_t i = 0; i < nb_targets; i++) {
+            m_router.add_target(m_targets[i].socket, i * TARGET_SIZE, TARGET_SIZE);
+        }
+    }
+
+    size_t nb_targets() const { return m_targets.size(); }
+};
+
+/* initiator -> gs_memory */
+class MemoryBench : public BenchInitiator
+{
+public:
+    static constexpr uint64_t MEMORY_SIZE = 0x10000;
+
+private:
+    gs::gs_memory<> m_memory;
+
+public:
+    MemoryBench(const sc_core::sc_module_name& n): BenchInitiator(n), m_memory("memory", MEMORY_SIZE)
+    {
+        initiator_socket.bind(m_memory.socket);
+    }
+};
+
+/* initiator -> dmi_converter -> gs_memory */
+class DmiConverterBench : public BenchInitiator
+{
+public:
+    static constexpr uint64_t MEMORY_SIZE = 0x10000;
+
+private:
+    gs::dmi_converter<> m_converter;
+    gs::gs_memory<> m_memory;
+
+public:
+    DmiConverterBench(const sc_core::sc_module_name& n)
+        : BenchInitiator(n), m_converter("dmi_converter"), m_memory("memory", MEMORY_SIZE)
+    {
+        initiator_socket.bind(m_converter.target_sockets[0]);
+        m_converter.initiator_sockets[0].bind(m_memory.socket);
+    }
+};
+
+/*
+ * initiator -> router -> exclusive_monitor -> gs_memory
+ * The router stamps the initiator ID the monitor relies on.
+ */
+class ExclusiveMonitorBench : public BenchInitiator
+{
+public:
+    static constexpr uint64_t MEMORY_SIZE = 0x10000;
+
+private:
+    gs::router<> m_router;
+    exclusive_monitor m_monitor;
+    gs::gs_memory<> m_memory;
+    ExclusiveAccessTlmExtension m_excl;
+
+public:
+    ExclusiveMonitorBench(const sc_core::sc_module_name& n)
+        : BenchInitiator(n), m_router("router"), m_monitor("exclusive_monitor"), m_memory("memory", MEMORY_SIZE)
+    {
+        initiator_socket.bind(m_router.target_socket);
+        m_router.add_target(m_monitor.front_socket, 0, MEMORY_SIZE);
+        m_monitor.back_socket.bind(m_memory.socket);
+    }
+
+    /* Exclusive load/store pair, returns true if the store succeeded */
+    bool exclusive_pair(uint64_t addr, size_t len)
+    {
+        m_txn.set_extension(&m_excl);
+        access(tlm::TLM_READ_COMMAND, addr, len);
+        access(tlm::TLM_WRITE_COMMAND, addr, len);
+        m_txn.clear_extension(&m_excl);
+        return m_excl.get_exclusive_store_status() == ExclusiveAccessTlmExtension::EXCLUSIVE_STORE_SUCCESS;
+    }
+};
+
+/*
+ * initiator -> reg_router -> registers, backed by a gs_memory. The memory
+ * placement is configured from sc_main, see REG_MEM_ADDR and REG_MEM_SZ.
+ */
+class RegisterBench : public BenchInitiator
+{
+public:
+    static constexpr uint64_t REG_MEM_ADDR = 0x0;
+    static constexpr uint64_t REG_MEM_SZ = 0x1000;
+    static constexpr uint64_t CTRL_ADDR = 0x0;
+    static constexpr uint64_t FIFO_ADDR = 0x100;
+    static constexpr uint64_t FIFO_LEN = 16;
+
+private:
+    gs::gs_memory<> m_reg_memory;
+    gs::reg_router<> m_reg_router;
+
+public:
+    gs::gs_register<uint32_t> CTRL;
+    gs::gs_field<uint32_t> CTRL_EN;
+    gs::gs_register<uint32_t> FIFO;
+
+    RegisterBench(const sc_core::sc_module_name& n)
+        : BenchInitiator(n)
+        , m_reg_memory("reg_memory")
+        , m_reg_router("reg_router")
+        , CTRL("CTRL", "CTRL", CTRL_ADDR, 1)
+        , CTRL_EN(CTRL, CTRL.get_regname() + ".EN", 0, 1)
+        , FIFO("FIFO", "FIFO", FIFO_ADDR, FIFO_LEN)
+    {
+        initiator_socket.bind(m_reg_router.target_socket);
+        m_reg_router.initiator_socket.bind(m_reg_memory.socket);
+
+        CTRL.initiator_socket.bind(m_reg_memory.socket);
+        m_reg_router.initiator_socket.bind(CTRL);
+        m_reg_router.rename_last(std::string(this->name()) + ".CTRL.target_socket");
+
+        FIFO.initiator_socket.bind(m_reg_memory.socket);
+        m_reg_router.initiator_socket.bind(FIFO);
+        m_reg_router.rename_last(std::string(this->name()) + ".FIFO.target_socket");
+    }
+};
+
+/*
+ * Measures a run_on_sysc hop: a foreign thread posts a job that wakes up the
+ * SystemC thread running the benchmark.
+ */
+class RunOnSyscBench : public sc_core::sc_module
+{
+    enum { IDLE, GO, EXIT };
+
+    gs::runonsysc m_sc;
+    sc_core::sc_event m_hop_done;
+    std::atomic<int> m_go{ IDLE };
+    std::thread m_poster;
+
+public:
+    RunOnSyscBench(const sc_core::sc_module_name& n): sc_core::sc_module(n), m_sc("run_on_sysc") {}
+
+    gs::runonsysc& sc() { return m_sc; }
+
+    void start_poster()
+    {
+        m_go = IDLE;
+        m_poster = std::thread([this]() {
+            for (;;) {
+                int go;
+                while ((go = m_go.exchange(IDLE)) == IDLE) {
+                    std::this_thread::yield();
+                }
+                if (go == EXIT) {
+                    return;
+                }
+                m_sc.run_on_sysc([this]() { m_hop_done.notify(); });
+            }
+        });
+    }
+
+    /* Must be called from a SystemC thread */
+    void hop()
+    {
+        m_go = GO;
+        sc_core::wait(m_hop_done);
+    }
+
+    void stop_poster()
+    {
+        m_go = EXIT;
+        m_poster.join();
+    }
+};
+
+/* Holds every fixture and runs the benchmarks once the simulation starts */
+class BenchmarksTop : public sc_core::sc_module
+{
+    /* Keeps the kernel from starving while waiting for run_on_sysc jobs */
+    gs::async_event m_keep_alive;
+
+    void run();
+
+public:
+    SCP_LOGGER();
+
+    std::vector<std::unique_ptr<RouterBench>> routers;
+    MemoryBench memory;
+    DmiConverterBench dmi_converter;
+    ExclusiveMonitorBench exclusive_monitor;
+    RegisterBench registers;
+    RunOnSyscBench run_on_sysc;
+
+    SC_HAS_PROCESS(BenchmarksTop);
+    BenchmarksTop(const sc_core::sc_module_name& n, const std::vector<size_t>& router_sizes)
+        : sc_core::sc_module(n)
+        , m_keep_alive(true)
+        , memory("memory")
+        , dmi_converter("dmi_converter")
+        , exclusive_monitor("exclusive_monitor")
+        , registers("registers")
+        , run_on_sysc("run_on_sysc")
+    {
+        for (size_t nb : router_sizes) {
+            routers.emplace_back(new RouterBench(("router_" + std::to_string(nb)).c_str(), nb));
+        }
+
+        SC_THREAD(run);
+        /* The benchmark library and reporters need more than the default stack */
+        set_stack_size(16 * 1024 * 1024);
+    }
+};
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Micro-benchmarks of the core TLM components.
+ *
+ * Results can be written in a machine readable format with the usual Google
+ * Benchmark options, e.g.:
+ *   gs-benchmarks --benchmark_out=results.json --benchmark_out_format=json
+ * The run-benchmarks target does exactly this, into the build directory.
+ */
+
+#include <cstdlib>
+
+#include <benchmark/benchmark.h>
+#include <cci/utils/broker.h>
+#include <cciutils.h>
+
+#include "benchmarks-bench.h"
+
+static const std::vector<size_t> ROUTER_SIZES = { 1, 16, 256 };
+
+static BenchmarksTop* g_top = nullptr;
+
+static RouterBench& router_for(size_t nb_targets)
+{
+    for (auto& r : g_top->routers) {
+        if (r->nb_targets() == nb_targets) return *r;
+    }
+    SCP_FATAL("benchmarks") << "No router with " << nb_targets << " targets";
+    abort();
+}
+
+static void router_sizes(benchmark::internal::Benchmark* b)
+{
+    for (size_t nb : ROUTER_SIZES) b->Arg(nb);
+}
+
+static void access_sizes(benchmark::internal::Benchmark* b) { b->Arg(4)->Arg(8)->Arg(64); }
+
+#define CHECK_OK(state, status)                                   \
+    if ((status) != tlm::TLM_OK_RESPONSE) {                       \
+        (state).SkipWithError("transaction did not complete OK"); \
+        break;                                                    \
+    }
+
+/* Router decode, accesses spread over all the targets */
+static void BM_RouterDecode(benchmark::State& state)
+{
+    RouterBench& r = router_for(state.range(0));
+    uint64_t i = 0;
+
+    for (auto _ : state) {
+        uint64_t target = (i++ * 7) % r.nb_targets();
+        CHECK_OK(state, r.access(tlm::TLM_READ_COMMAND, target * RouterBench::TARGET_SIZE + 0x10, 4));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RouterDecode)->Apply(router_sizes);
+
+/* Router decode, accesses always hitting the last target */
+static void BM_RouterDecodeSameTarget(benchmark::State& state)
+{
+    RouterBench& r = router_for(state.range(0));
+    uint64_t addr = (r.nb_targets() - 1) * RouterBench::TARGET_SIZE + 0x10;
+
+    for (auto _ : state) {
+        CHECK_OK(state, r.access(tlm::TLM_READ_COMMAND, addr, 4));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RouterDecodeSameTarget)->Apply(router_sizes);
+
+static void BM_MemoryRead(benchmark::State& state)
+{
+    MemoryBench& m = g_top->memory;
+    size_t len = state.range(0);
+
+    for (auto _ : state) {
+        CHECK_OK(state, m.access(tlm::TLM_READ_COMMAND, 0x100, len));
+        benchmark::DoNotOptimize(m.txn().get_data_ptr());
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_MemoryRead)->Apply(access_sizes);
+
+static void BM_MemoryWrite(benchmark::State& state)
+{
+    MemoryBench& m = g_top->memory;
+    size_t len = state.range(0);
+
+    for (auto _ : state) {
+        CHECK_OK(state, m.access(tlm::TLM_WRITE_COMMAND, 0x100, len));
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_MemoryWrite)->Apply(access_sizes);
+
+/* Writes with every other byte enabled */
+static void BM_MemoryWriteByteEnable(benchmark::State& state)
+{
+    MemoryBench& m = g_top->memory;
+    size_t len = state.range(0);
+    uint8_t be[2] = { TLM_BYTE_ENABLED, TLM_BYTE_DISABLED };
+
+    m.txn().set_byte_enable_ptr(be);
+    m.txn().set_byte_enable_length(sizeof(be));
+    for (auto _ : state) {
+        CHECK_OK(state, m.access(tlm::TLM_WRITE_COMMAND, 0x100, len));
+    }
+    m.txn().set_byte_enable_ptr(nullptr);
+    m.txn().set_byte_enable_length(0);
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_MemoryWriteByteEnable)->Apply(access_sizes);
+
+static void BM_DmiConverterRead(benchmark::State& state)
+{
+    DmiConverterBench& d = g_top->dmi_converter;
+    size_t len = state.range(0);
+
+    for (auto _ : state) {
+        CHECK_OK(state, d.access(tlm::TLM_READ_COMMAND, 0x100, len));
+        benchmark::DoNotOptimize(d.txn().get_data_ptr());
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_DmiConverterRead)->Apply(access_sizes);
+
+static void BM_DmiConverterWrite(benchmark::State& state)
+{
+    DmiConverterBench& d = g_top->dmi_converter;
+    size_t len = state.range(0);
+
+    for (auto _ : state) {
+        CHECK_OK(state, d.access(tlm::TLM_WRITE_COMMAND, 0x100, len));
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_DmiConverterWrite)->Apply(access_sizes);
+
+/* Plain accesses going through the monitor */
+static void BM_ExclusiveMonitorAccess(benchmark::State& state)
+{
+    ExclusiveMonitorBench& e = g_top->exclusive_monitor;
+
+    for (auto _ : state) {
+        CHECK_OK(state, e.access(tlm::TLM_READ_COMMAND, 0x100, 8));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ExclusiveMonitorAccess);
+
+/* Exclusive load/store pairs, each one locking then unlocking a region */
+static void BM_ExclusiveMonitorPair(benchmark::State& state)
+{
+    ExclusiveMonitorBench& e = g_top->exclusive_monitor;
+
+    for (auto _ : state) {
+        if (!e.exclusive_pair(0x100, 8)) {
+            state.SkipWithError("exclusive store failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ExclusiveMonitorPair);
+
+static void BM_RegisterWrite(benchmark::State& state)
+{
+    RegisterBench& r = g_top->registers;
+
+    for (auto _ : state) {
+        CHECK_OK(state, r.access(tlm::TLM_WRITE_COMMAND, RegisterBench::CTRL_ADDR, 4));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RegisterWrite);
+
+static void BM_RegisterRead(benchmark::State& state)
+{
+    RegisterBench& r = g_top->registers;
+
+    for (auto _ : state) {
+        CHECK_OK(state, r.access(tlm::TLM_READ_COMMAND, RegisterBench::CTRL_ADDR, 4));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RegisterRead);
+
+/* Accesses to the last element of a register array */
+static void BM_RegisterArrayWrite(benchmark::State& state)
+{
+    RegisterBench& r = g_top->registers;
+    uint64_t addr = RegisterBench::FIFO_ADDR + (RegisterBench::FIFO_LEN - 1) * sizeof(uint32_t);
+
+    for (auto _ : state) {
+        CHECK_OK(state, r.access(tlm::TLM_WRITE_COMMAND, addr, 4));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RegisterArrayWrite);
+
+/* Model side accesses, without any transaction */
+static void BM_RegisterModelAccess(benchmark::State& state)
+{
+    RegisterBench& r = g_top->registers;
+    uint32_t v = 0;
+
+    for (auto _ : state) {
+        r.CTRL = v;
+        v = r.CTRL;
+        benchmark::DoNotOptimize(v);
+        v++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RegisterModelAccess);
+
+static void BM_RegisterFieldAccess(benchmark::State& state)
+{
+    RegisterBench& r = g_top->registers;
+    uint32_t v = 0;
+
+    for (auto _ : state) {
+        r.CTRL_EN = v & 1;
+        v += r.CTRL_EN;
+        benchmark::DoNotOptimize(v);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RegisterFieldAccess);
+
+/* Round trip from another thread to the SystemC kernel and back */
+static void BM_RunOnSyscHop(benchmark::State& state)
+{
+    RunOnSyscBench& r = g_top->run_on_sysc;
+
+    r.start_poster();
+    for (auto _ : state) {
+        r.hop();
+    }
+    r.stop_poster();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RunOnSyscHop)->UseRealTime();
+
+/* Calls made from the SystemC thread, which run inline */
+static void BM_RunOnSyscInline(benchmark::State& state)
+{
+    RunOnSyscBench& r = g_top->run_on_sysc;
+    uint64_t n = 0;
+
+    for (auto _ : state) {
+        r.sc().run_on_sysc([&n]() { n++; });
+    }
+    benchmark::DoNotOptimize(n);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RunOnSyscInline);
+
+void BenchmarksTop::run()
+{
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    m_keep_alive.async_detach_suspending();
+    sc_core::sc_stop();
+}
+
+int sc_main(int argc, char* argv[])
+{
+    scp::init_logging(scp::LogConfig()
+                          .fileInfoFrom(sc_core::SC_ERROR)
+                          .logAsync(false)
+                          .logLevel(scp::log::WARNING)
+                          .msgTypeFieldWidth(30));
+
+    gs::ConfigurableBroker m_broker({
+        { "bench.registers.reg_memory.target_socket.address", cci::cci_value(uint64_t(RegisterBench::REG_MEM_ADDR)) },
+        { "bench.registers.reg_memory.target_socket.size", cci::cci_value(uint64_t(RegisterBench::REG_MEM_SZ)) },
+        { "bench.registers.reg_memory.target_socket.relative_addresses", cci::cci_value(false) },
+    });
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    BenchmarksTop top("bench", ROUTER_SIZES);
+    g_top = &top;
+
+    sc_core::sc_start();
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <systemc>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "host_affinity.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+int sc_main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    int status = RUN_ALL_TESTS();
+    return status;
+}
+
+TEST(host_affinity, parse)
+{
+    std::vector<int> cpus{ 42 };
+    EXPECT_TRUE(gs::parse_host_cpus("", cpus));
+    EXPECT_TRUE(cpus.empty());
+
+    EXPECT_TRUE(gs::parse_host_cpus("3, 0-1,8-9,1", cpus));
+    EXPECT_THAT(cpus, testing::ElementsAre(0, 1, 3, 8, 9));
+    EXPECT_EQ(gs::format_host_cpus(cpus), "0-1,3,8-9");
+
+    EXPECT_FALSE(gs::parse_host_cpus("a", cpus));
+    EXPECT_FALSE(gs::parse_host_cpus("3-1", cpus));
+    EXPECT_FALSE(gs::parse_host_cpus("1-2x", cpus));
+    EXPECT_THAT(cpus, testing::ElementsAre(0, 1, 3, 8, 9));
+}
+
+TEST(host_affinity, place)
+{
+    // Stay on the cores we were given, whatever they are
+    std::vector<int> any;
+    EXPECT_EQ(gs::HostPlacement::get().place("test", any), 0);
+
+    std::string report = gs::HostPlacement::get().report();
+    EXPECT_THAT(report, testing::HasSubstr("test (tid "));
+    EXPECT_THAT(report, testing::HasSubstr("requested any"));
+}
+
+#ifdef __linux__
+TEST(host_affinity, place_unplaced)
+{
+    cpu_set_t all;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(all), &all), 0);
+    if (CPU_COUNT(&all) < 2) {
+        GTEST_SKIP() << "Needs at least 2 host cores";
+    }
+    int first = 0;
+    while (!CPU_ISSET(first, &all)) first++;
+
+    // Nothing is moved without reserved cores
+    gs::HostPlacement::get().reserve({});
+    EXPECT_EQ(gs::HostPlacement::get().place_unplaced("unplaced"), 0);
+
+    // Threads started from a pinned thread share its core, until they are moved back. Reserve a core
+    // the process can't run on, so that the others are all left.
+    gs::HostPlacement::get().reserve({ CPU_SETSIZE - 1 });
+    ASSERT_EQ(gs::HostPlacement::get().place("pinned", { first }), 0);
+
+    std::atomic<bool> stop{ false };
+    std::atomic<pid_t> tid{ 0 };
+    std::thread t([&]() {
+        tid = syscall(SYS_gettid);
+        while (!stop) std::this_thread::yield();
+    });
+    while (!tid) std::this_thread::yield();
+
+    cpu_set_t set;
+    ASSERT_EQ(sched_getaffinity(tid, sizeof(set), &set), 0);
+    EXPECT_EQ(CPU_COUNT(&set), 1);
+
+    EXPECT_GE(gs::HostPlacement::get().place_unplaced("unplaced"), 1);
+    ASSERT_EQ(sched_getaffinity(tid, sizeof(set), &set), 0);
+    EXPECT_TRUE(CPU_EQUAL(&set, &all));
+
+    // Only once
+    EXPECT_EQ(gs::HostPlacement::get().place_unplaced("unplaced"), 0);
+    EXPECT_THAT(gs::HostPlacement::get().report(), testing::HasSubstr("unplaced (tid " + std::to_string(tid)));
+
+    stop = true;
+    t.join();
+    sched_setaffinity(0, sizeof(all), &all);
+    gs::HostPlacement::get().reserve({});
+}
+#endif
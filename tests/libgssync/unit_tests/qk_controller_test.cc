@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define SC_ALLOW_DEPRECATED_IEEE_API
+#include <systemc>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cciutils.h>
+#include "qk_controller.h"
+
+gs::QuantumController* controller = nullptr;
+
+static uint64_t global_quantum_ns()
+{
+    return uint64_t(tlm_utils::tlm_quantumkeeper::get_global_quantum().to_seconds() * 1e9);
+}
+
+int sc_main(int argc, char** argv)
+{
+    auto m_broker = new gs::ConfigurableBroker();
+    m_broker->set_preset_cci_value("controller.min_quantum_ns", cci::cci_value(uint64_t(1000)));
+    m_broker->set_preset_cci_value("controller.max_quantum_ns", cci::cci_value(uint64_t(64000)));
+    m_broker->set_preset_cci_value("controller.period", cci::cci_value(1));
+
+    controller = new gs::QuantumController("controller");
+    tlm_utils::tlm_quantumkeeper::set_global_quantum(sc_core::sc_time(8, sc_core::SC_US));
+    testing::InitGoogleTest(&argc, argv);
+    int status = RUN_ALL_TESTS();
+    return status;
+}
+
+TEST(qk_controller, policy)
+{
+    // I/O bound: shrink
+    EXPECT_EQ(controller->next_quantum(8000, 0, 500, 0, 0), 4000u);
+    EXPECT_EQ(controller->next_quantum(8000, 0, 0, 10, 0), 4000u);
+    EXPECT_EQ(controller->next_quantum(8000, 0, 0, 1, 5000000), 4000u);
+    // Compute bound: grow, faster while stalling
+    EXPECT_EQ(controller->next_quantum(8000, 0, 0, 0, 0), 10000u);
+    EXPECT_EQ(controller->next_quantum(8000, 0.5, 0, 0, 0), 16000u);
+    // In between: keep
+    EXPECT_EQ(controller->next_quantum(8000, 0.5, 50, 0, 0), 8000u);
+    // Within bounds
+    EXPECT_EQ(controller->next_quantum(1000, 0, 500, 0, 0), 1000u);
+    EXPECT_EQ(controller->next_quantum(64000, 0.5, 0, 0, 0), 64000u);
+}
+
+TEST(qk_controller, adjusts_global_quantum)
+{
+    // Nothing happens: the quantum grows to the upper bound
+    sc_core::sc_start(2, sc_core::SC_MS);
+    EXPECT_EQ(global_quantum_ns(), 64000u);
+    EXPECT_EQ(gs::SyncStats::get().quantum_ns.load(), 64000u);
+
+    // An interrupt storm: it shrinks to the lower bound
+    for (int i = 0; i < 20; i++) {
+        gs::SyncStats::add(gs::SyncStats::get().irqs, 1000);
+        sc_core::sc_start(global_quantum_ns(), sc_core::SC_NS);
+    }
+    EXPECT_EQ(global_quantum_ns(), 1000u);
+}
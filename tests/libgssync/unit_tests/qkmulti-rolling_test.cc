@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define SC_ALLOW_DEPRECATED_IEEE_API
+#include <systemc>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "qkmulti-rolling.h"
+
+gs::tlm_quantumkeeper_extended* qk = nullptr;
+sc_core::sc_event* ev = nullptr;
+
+bool done;
+void run_quanta()
+{
+    sc_core::sc_time quantum(1, sc_core::SC_MS);
+    sc_core::sc_time event_time(300, sc_core::SC_NS);
+    sc_core::sc_time end = qk->get_current_time() + 3 * quantum;
+
+    while (qk->get_current_time() < end) {
+        sc_core::sc_time budget = qk->time_to_sync();
+        // Never more than a quantum, and never past a pending SystemC event
+        EXPECT_LE(budget, quantum);
+        if (qk->get_current_time() < event_time) {
+            EXPECT_LE(qk->get_current_time() + budget, event_time);
+        }
+        if (budget == sc_core::SC_ZERO_TIME) {
+            qk->sync();
+            continue;
+        }
+        qk->inc(std::min(budget, end - qk->get_current_time()));
+        qk->sync();
+    }
+    done = true;
+    qk->stop();
+}
+
+int sc_main(int argc, char** argv)
+{
+    qk = new gs::tlm_quantumkeeper_multi_rolling;
+    ev = new sc_core::sc_event("ev");
+    sc_core::sc_time quantum(1, sc_core::SC_MS);
+    tlm_utils::tlm_quantumkeeper::set_global_quantum(quantum);
+    testing::InitGoogleTest(&argc, argv);
+    int status = RUN_ALL_TESTS();
+    return status;
+}
+
+TEST(qkmulti_rolling, bounded_by_pending_activity)
+{
+    done = false;
+    ev->notify(300, sc_core::SC_NS);
+    qk->start();
+    qk->reset();
+    std::thread t1(run_quanta);
+    while (sc_core::sc_pending_activity() || !done) {
+        if (sc_core::sc_pending_activity()) {
+            sc_core::sc_time t = sc_core::sc_time_to_pending_activity();
+            sc_start(t);
+        }
+    }
+    t1.join();
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define SC_ALLOW_DEPRECATED_IEEE_API
+#include <systemc>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "qkmulti-switchable.h"
+
+gs::tlm_quantumkeeper_switchable* qk = nullptr;
+
+bool done;
+void boot_then_switch()
+{
+    sc_core::sc_time quantum(1, sc_core::SC_MS);
+    sc_core::sc_time start = qk->get_current_time();
+
+    // Free running: never held back by SystemC
+    for (int i = 0; i < 5; i++) {
+        qk->inc(quantum);
+        qk->sync();
+    }
+    EXPECT_EQ(qk->get_policy(), "multithread-freerunning");
+
+    EXPECT_FALSE(qk->switch_to("no-such-policy"));
+    EXPECT_TRUE(qk->switch_to("multithread-quantum"));
+    qk->sync();
+    EXPECT_EQ(qk->get_policy(), "multithread-quantum");
+    // The local time is handed over, and the budget is now bounded by the quantum
+    EXPECT_EQ(qk->get_current_time(), start + 5 * quantum);
+    EXPECT_LE(qk->time_to_sync(), quantum);
+
+    qk->inc(quantum);
+    qk->sync();
+    EXPECT_EQ(qk->get_current_time(), start + 6 * quantum);
+    done = true;
+    qk->stop();
+}
+
+int sc_main(int argc, char** argv)
+{
+    qk = new gs::tlm_quantumkeeper_switchable("multithread-freerunning", { "multithread-quantum" });
+    sc_core::sc_time quantum(1, sc_core::SC_MS);
+    tlm_utils::tlm_quantumkeeper::set_global_quantum(quantum);
+    testing::InitGoogleTest(&argc, argv);
+    int status = RUN_ALL_TESTS();
+    return status;
+}
+
+TEST(qkmulti_switchable, boot_then_switch)
+{
+    done = false;
+    qk->start();
+    qk->reset();
+    std::thread t1(boot_then_switch);
+    while (sc_core::sc_pending_activity() || !done) {
+        if (sc_core::sc_pending_activity()) {
+            sc_core::sc_time t = sc_core::sc_time_to_pending_activity();
+            sc_start(t);
+        }
+    }
+    t1.join();
+}
@@ -64,6 +64,21 @@ void finished_quantum()
     qk->stop();
 }
 
+void many_quanta()
+{
+    sc_core::sc_time quantum(1, sc_core::SC_MS);
+    sc_core::sc_time start = qk->get_current_time();
+    for (int i = 0; i < 20; i++) {
+        qk->inc(quantum);
+        qk->sync();
+        // sync only returns once there is some budget again
+        EXPECT_GT(qk->time_to_sync(), sc_core::SC_ZERO_TIME);
+    }
+    EXPECT_EQ(qk->get_current_time(), start + 20 * quantum);
+    done = true;
+    qk->stop();
+}
+
 int sc_main(int argc, char** argv)
 {
     scp::init_logging(scp::LogConfig()
@@ -111,3 +126,41 @@ TEST(qkmultithread, finished_quantum)
     }
     t1.join();
 }
+
+TEST(qkmultithread, many_quanta)
+{
+    done = false;
+    qk->start();
+    qk->reset();
+    std::thread t1(many_quanta);
+    while (sc_core::sc_pending_activity() || !done) {
+        if (sc_core::sc_pending_activity()) {
+            sc_core::sc_time t = sc_core::sc_time_to_pending_activity();
+            sc_start(t);
+        }
+    }
+    t1.join();
+}
+
+TEST(qkmultithread, stats)
+{
+    auto mt = static_cast<gs::tlm_quantumkeeper_multithread*>(qk);
+    gs::qk_stats_snapshot st = mt->get_stats();
+    EXPECT_EQ(st.version, gs::qk_stats_snapshot::VERSION);
+    // The tests above synced, and many_quanta ran out of budget
+    EXPECT_GT(st.syncs, 0u);
+    EXPECT_GT(st.budget_exhaustions, 0u);
+    EXPECT_LE(st.budget_exhaustions, st.syncs);
+
+    uint64_t blocked = 0;
+    for (auto n : st.blocked_hist) blocked += n;
+    EXPECT_EQ(blocked, st.budget_exhaustions);
+    uint64_t suspended = 0;
+    for (auto n : st.suspended_hist) suspended += n;
+    EXPECT_EQ(suspended, st.unsuspends);
+    EXPECT_THAT(st.suspends - st.unsuspends, AnyOf(Eq(0u), Eq(1u)));
+
+    std::string json = mt->get_status_json();
+    EXPECT_NE(json.find("\"syncs\":" + std::to_string(st.syncs)), std::string::npos);
+    EXPECT_NE(json.find("\"blocked_hist\":["), std::string::npos);
+}
@@ -0,0 +1,136 @@
+/*
+ * This file is part of libqbox
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define SC_ALLOW_DEPRECATED_IEEE_API
+#include <systemc>
+
+#include <cstdio>
+
+#include "test/cpu.h"
+#include "test/tester/dmi.h"
+
+#include "cortex-a53.h"
+#include "qemu-instance.h"
+
+/*
+ * ARM Cortex-A53 DMI alias coalescing test.
+ *
+ * The tester only grants DMI on the 4 bytes accessed, so the first CPU gets
+ * one grant per word of the DMI region, more than the number of aliases a
+ * QEMU initiator keeps mapped. Consecutive grants map the same host memory
+ * at the same offset, and must be coalesced into a single alias: reading the
+ * whole region again must then be done through DMI only.
+ */
+class CpuArmCortexA53DmiCoalesceTest : public CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>
+{
+public:
+    static constexpr size_t GRANT_SIZE = 4;
+    static constexpr size_t NUM_GRANTS = CpuTesterDmi::DMI_SIZE / GRANT_SIZE;
+
+    static constexpr const char* FIRMWARE = R"(
+        _start:
+            ldr x2, =0x%08)" PRIx64 R"(
+            ldr x1, =0x%08)" PRIx64 R"(
+
+            mrs x0, mpidr_el1
+            and x0, x0, #0xffff
+            cbnz x0, end
+
+            mov x3, #0
+        pass1:
+            ldr w0, [x1, x3]
+            add x3, x3, #4
+            cmp x3, #%d
+            b.ne pass1
+            mov x0, #1
+            str x0, [x2]
+
+            mov x3, #0
+        pass2:
+            ldr w0, [x1, x3]
+            add x3, x3, #4
+            cmp x3, #%d
+            b.ne pass2
+            mov x0, #2
+            str x0, [x2]
+
+        end:
+            wfi
+            b end
+    )";
+
+protected:
+    int m_pass = 1;
+    size_t m_grants = 0;
+    size_t m_io_reads = 0;
+
+public:
+    CpuArmCortexA53DmiCoalesceTest(const sc_core::sc_module_name& n): CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>(n)
+    {
+        char buf[1024];
+
+        std::snprintf(buf, sizeof(buf), FIRMWARE, CpuTesterDmi::MMIO_ADDR, CpuTesterDmi::DMI_ADDR,
+                      int(CpuTesterDmi::DMI_SIZE), int(CpuTesterDmi::DMI_SIZE));
+        set_firmware(buf);
+    }
+
+    virtual ~CpuArmCortexA53DmiCoalesceTest() {}
+
+    virtual void mmio_write(int id, uint64_t addr, uint64_t data, size_t len) override
+    {
+        TEST_ASSERT(id == CpuTesterDmi::SOCKET_MMIO);
+        TEST_ASSERT(data == m_pass);
+
+        SCP_INFO(SCMOD) << "Pass " << m_pass << " done, " << m_grants << " grants, " << m_io_reads << " I/O reads";
+
+        switch (m_pass) {
+        case 1:
+            /* Each word was read through I/O once, then granted */
+            TEST_ASSERT(m_grants == NUM_GRANTS);
+            TEST_ASSERT(m_io_reads == NUM_GRANTS);
+            break;
+
+        case 2:
+            /* The coalesced alias covers the whole region */
+            TEST_ASSERT(m_grants == 0);
+            TEST_ASSERT(m_io_reads == 0);
+            break;
+        }
+
+        m_grants = 0;
+        m_io_reads = 0;
+        m_pass++;
+    }
+
+    virtual uint64_t mmio_read(int id, uint64_t addr, size_t len) override
+    {
+        TEST_ASSERT(id == CpuTesterDmi::SOCKET_DMI);
+        m_io_reads++;
+        return 0;
+    }
+
+    virtual bool dmi_request(int id, uint64_t addr, size_t len, tlm::tlm_dmi& ret) override
+    {
+        uint64_t start = addr & ~uint64_t(GRANT_SIZE - 1);
+
+        ret.set_start_address(start);
+        ret.set_end_address(start + GRANT_SIZE - 1);
+        m_grants++;
+        return true;
+    }
+
+    virtual void end_of_simulation() override
+    {
+        CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>::end_of_simulation();
+
+        TEST_ASSERT(m_pass == 3);
+    }
+};
+
+constexpr const char* CpuArmCortexA53DmiCoalesceTest::FIRMWARE;
+
+int sc_main(int argc, char* argv[]) { return run_testbench<CpuArmCortexA53DmiCoalesceTest>(argc, argv); }
@@ -0,0 +1,137 @@
+/*
+ * This file is part of libqbox
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define SC_ALLOW_DEPRECATED_IEEE_API
+#include <systemc>
+
+#include <cstdio>
+
+#include "test/cpu.h"
+#include "test/tester/dmi.h"
+
+#include "cortex-a53.h"
+#include "qemu-instance.h"
+
+/*
+ * ARM Cortex-A53 DMI alias eviction test.
+ *
+ * The tester grants DMI on the 2 bytes accessed, and the first CPU reads one
+ * half-word every 4 bytes of the DMI region, so that the grants cannot be
+ * coalesced. There are more of them than the number of aliases a QEMU
+ * initiator keeps mapped, so the least recently requested ones are evicted.
+ * Reading the region again backwards, the most recent grants must still be
+ * mapped, and only the evicted ones must go through I/O again.
+ */
+class CpuArmCortexA53DmiEvictTest : public CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>
+{
+public:
+    static constexpr size_t STRIDE = 4;
+    static constexpr size_t NUM_GRANTS = CpuTesterDmi::DMI_SIZE / STRIDE;
+    /* As kept mapped by a QEMU initiator socket */
+    static constexpr size_t MAX_DMI_ALIASES = 250;
+
+    static constexpr const char* FIRMWARE = R"(
+        _start:
+            ldr x2, =0x%08)" PRIx64 R"(
+            ldr x1, =0x%08)" PRIx64 R"(
+
+            mrs x0, mpidr_el1
+            and x0, x0, #0xffff
+            cbnz x0, end
+
+            mov x3, #0
+        pass1:
+            ldrh w0, [x1, x3]
+            add x3, x3, #4
+            cmp x3, #%d
+            b.ne pass1
+            mov x0, #1
+            str x0, [x2]
+
+        pass2:
+            sub x3, x3, #4
+            ldrh w0, [x1, x3]
+            cbnz x3, pass2
+            mov x0, #2
+            str x0, [x2]
+
+        end:
+            wfi
+            b end
+    )";
+
+protected:
+    int m_pass = 1;
+    size_t m_grants = 0;
+    size_t m_io_reads = 0;
+
+public:
+    CpuArmCortexA53DmiEvictTest(const sc_core::sc_module_name& n): CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>(n)
+    {
+        char buf[1024];
+
+        std::snprintf(buf, sizeof(buf), FIRMWARE, CpuTesterDmi::MMIO_ADDR, CpuTesterDmi::DMI_ADDR,
+                      int(CpuTesterDmi::DMI_SIZE));
+        set_firmware(buf);
+    }
+
+    virtual ~CpuArmCortexA53DmiEvictTest() {}
+
+    virtual void mmio_write(int id, uint64_t addr, uint64_t data, size_t len) override
+    {
+        TEST_ASSERT(id == CpuTesterDmi::SOCKET_MMIO);
+        TEST_ASSERT(data == m_pass);
+
+        SCP_INFO(SCMOD) << "Pass " << m_pass << " done, " << m_grants << " grants, " << m_io_reads << " I/O reads";
+
+        switch (m_pass) {
+        case 1:
+            TEST_ASSERT(m_grants == NUM_GRANTS);
+            TEST_ASSERT(m_io_reads == NUM_GRANTS);
+            break;
+
+        case 2:
+            /* Some grants were evicted, but not the most recent ones */
+            TEST_ASSERT(m_io_reads >= NUM_GRANTS - MAX_DMI_ALIASES);
+            TEST_ASSERT(m_io_reads < NUM_GRANTS / 4);
+            TEST_ASSERT(m_grants == m_io_reads);
+            break;
+        }
+
+        m_grants = 0;
+        m_io_reads = 0;
+        m_pass++;
+    }
+
+    virtual uint64_t mmio_read(int id, uint64_t addr, size_t len) override
+    {
+        TEST_ASSERT(id == CpuTesterDmi::SOCKET_DMI);
+        m_io_reads++;
+        return 0;
+    }
+
+    virtual bool dmi_request(int id, uint64_t addr, size_t len, tlm::tlm_dmi& ret) override
+    {
+        uint64_t start = addr & ~uint64_t(STRIDE - 1);
+
+        ret.set_start_address(start);
+        ret.set_end_address(start + 1);
+        m_grants++;
+        return true;
+    }
+
+    virtual void end_of_simulation() override
+    {
+        CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>::end_of_simulation();
+
+        TEST_ASSERT(m_pass == 3);
+    }
+};
+
+constexpr const char* CpuArmCortexA53DmiEvictTest::FIRMWARE;
+
+int sc_main(int argc, char* argv[]) { return run_testbench<CpuArmCortexA53DmiEvictTest>(argc, argv); }
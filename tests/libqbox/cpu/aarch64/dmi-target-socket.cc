@@ -0,0 +1,195 @@
+/*
+ * This file is part of libqbox
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define SC_ALLOW_DEPRECATED_IEEE_API
+#include <systemc>
+
+#include <cstdio>
+#include <thread>
+
+#include <tlm_utils/simple_initiator_socket.h>
+
+#include "test/cpu.h"
+#include "test/tester/dmi.h"
+
+#include "cortex-a53.h"
+#include "qemu-instance.h"
+#include "ports/target.h"
+
+/*
+ * ARM Cortex-A53 DMI through a QEMU target socket test.
+ *
+ * A SystemC initiator is bound to a QEMU target socket exposing the address
+ * space of the first CPU. Once the CPU got a DMI pointer on the tester DMI
+ * region, the SystemC initiator must get the same one through the target
+ * socket. When the tester invalidates the region, the SystemC initiator must
+ * be told on the SystemC thread before the invalidation returns, and must not
+ * be given the region again until the CPU mapped it again.
+ */
+class CpuArmCortexA53DmiTargetSocketTest : public CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>
+{
+public:
+    static constexpr int NUM_LOOPS = 100;
+
+    static constexpr const char* FIRMWARE = R"(
+        _start:
+            ldr x2, =0x%08)" PRIx64 R"(
+            ldr x1, =0x%08)" PRIx64 R"(
+            mov x3, #%d
+
+            mrs x0, mpidr_el1
+            and x0, x0, #0xffff
+            cbnz x0, end
+
+        loop:
+            # Access the DMI region, then report on the control socket
+            ldr x0, [x1]
+            str x0, [x2]
+            b next
+        next:
+            sub x3, x3, #1
+            cbnz x3, loop
+
+        end:
+            wfi
+            b end
+    )";
+
+protected:
+    enum State {
+        ST_START = 0,
+        ST_INVALIDATED,
+        ST_REMAPPED,
+    };
+
+    QemuTargetSocket<> m_qemu_target;
+    tlm_utils::simple_initiator_socket<CpuArmCortexA53DmiTargetSocketTest> m_sysc_initiator;
+
+    std::thread::id m_sysc_thread;
+    State m_state = ST_START;
+    int m_invalidations = 0;
+
+    bool get_dmi(tlm::tlm_dmi& dmi)
+    {
+        tlm::tlm_generic_payload trans;
+
+        trans.set_address(CpuTesterDmi::DMI_ADDR);
+        trans.set_command(tlm::TLM_READ_COMMAND);
+        return m_sysc_initiator->get_direct_mem_ptr(trans, dmi);
+    }
+
+    void check_dmi(const tlm::tlm_dmi& dmi)
+    {
+        TEST_ASSERT(dmi.get_start_address() == CpuTesterDmi::DMI_ADDR);
+        TEST_ASSERT(dmi.get_end_address() == CpuTesterDmi::DMI_ADDR + CpuTesterDmi::DMI_SIZE - 1);
+        TEST_ASSERT(dmi.is_read_write_allowed());
+
+        /* The pointer gives access to the tester memory */
+        uint64_t* ptr = reinterpret_cast<uint64_t*>(dmi.get_dmi_ptr());
+        TEST_ASSERT(*ptr == m_tester.get_buf_value(0));
+        *ptr = *ptr + 1;
+        TEST_ASSERT(*ptr == m_tester.get_buf_value(0));
+    }
+
+    void invalidate_direct_mem_ptr(sc_dt::uint64 start, sc_dt::uint64 end)
+    {
+        SCP_INFO(SCMOD) << "SystemC initiator DMI invalidated [0x" << std::hex << start << "-0x" << end << "]";
+
+        TEST_ASSERT(std::this_thread::get_id() == m_sysc_thread);
+        TEST_ASSERT(start <= CpuTesterDmi::DMI_ADDR);
+        TEST_ASSERT(end >= CpuTesterDmi::DMI_ADDR);
+        m_invalidations++;
+    }
+
+public:
+    SC_HAS_PROCESS(CpuArmCortexA53DmiTargetSocketTest);
+
+    CpuArmCortexA53DmiTargetSocketTest(const sc_core::sc_module_name& n)
+        : CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>(n)
+        , m_qemu_target("qemu_target", m_inst_a)
+        , m_sysc_initiator("sysc_initiator")
+        , m_sysc_thread(std::this_thread::get_id())
+    {
+        char buf[1024];
+
+        std::snprintf(buf, sizeof(buf), FIRMWARE, CpuTesterDmi::MMIO_ADDR, CpuTesterDmi::DMI_ADDR, NUM_LOOPS);
+        set_firmware(buf);
+
+        m_sysc_initiator.bind(m_qemu_target);
+        m_sysc_initiator.register_invalidate_direct_mem_ptr(
+            this, &CpuArmCortexA53DmiTargetSocketTest::invalidate_direct_mem_ptr);
+    }
+
+    virtual ~CpuArmCortexA53DmiTargetSocketTest() {}
+
+    virtual void end_of_elaboration() override
+    {
+        CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>::end_of_elaboration();
+
+        /* The first CPU is in the first instance, its address space is ready once it is instantiated */
+        m_qemu_target.init_with_mr(*m_cpus[0].socket.get_root_mr());
+    }
+
+    void ctrl_write()
+    {
+        tlm::tlm_dmi dmi;
+
+        switch (m_state) {
+        case ST_START:
+            /* The CPU access just mapped the region */
+            TEST_ASSERT(get_dmi(dmi));
+            check_dmi(dmi);
+
+            m_tester.dmi_invalidate();
+            TEST_ASSERT(m_invalidations == 1);
+            TEST_ASSERT(!get_dmi(dmi));
+            m_state = ST_INVALIDATED;
+            break;
+
+        case ST_INVALIDATED:
+            /* The region is given again once QEMU unmapped it and the CPU mapped it again */
+            if (get_dmi(dmi)) {
+                check_dmi(dmi);
+                m_state = ST_REMAPPED;
+            }
+            break;
+
+        case ST_REMAPPED:
+            break;
+        }
+    }
+
+    virtual void mmio_write(int id, uint64_t addr, uint64_t data, size_t len) override
+    {
+        SCP_INFO(SCMOD) << "CPU write at 0x" << std::hex << addr << ", data: " << std::hex << data
+                        << ", len: " << len;
+
+        if (id == CpuTesterDmi::SOCKET_MMIO) {
+            TEST_ASSERT(addr == 0);
+            ctrl_write();
+        }
+    }
+
+    virtual uint64_t mmio_read(int id, uint64_t addr, size_t len) override
+    {
+        TEST_ASSERT(id == CpuTesterDmi::SOCKET_DMI);
+        return 0;
+    }
+
+    virtual bool dmi_request(int id, uint64_t addr, size_t len, tlm::tlm_dmi& ret) override { return true; }
+
+    virtual void end_of_simulation() override
+    {
+        CpuTestBench<cpu_arm_cortexA53, CpuTesterDmi>::end_of_simulation();
+
+        TEST_ASSERT(m_state == ST_REMAPPED);
+    }
+};
+
+constexpr const char* CpuArmCortexA53DmiTargetSocketTest::FIRMWARE;
+
+int sc_main(int argc, char* argv[]) { return run_testbench<CpuArmCortexA53DmiTargetSocketTest>(argc, argv); }
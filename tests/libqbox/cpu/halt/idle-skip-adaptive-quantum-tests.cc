@@ -0,0 +1,205 @@
+/*
+ * This file is part of libqbox
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define SC_ALLOW_DEPRECATED_IEEE_API
+#include <systemc>
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+
+#include "test/cpu.h"
+#include "test/tester/mmio.h"
+
+#include "cortex-a53.h"
+#include "qemu-instance.h"
+
+#include <qk_controller.h>
+
+using namespace sc_core;
+
+/*
+ * ARM Cortex-A53 idle skipping with an adaptive quantum.
+ *
+ * With idle_skip set on the instances and a quantum controller, each CPU
+ * reports it is ready, then waits for an interrupt with wfi. Once all of them
+ * are halted, the controller must pause: a long simulated time then elapses
+ * without the quantum being adjusted.
+ *
+ * The test bench then raises the IRQ line of every CPU. The controller must
+ * resume, while each CPU runs a busy loop before reporting it is done.
+ */
+class CpuArmCortexA53IdleSkipAdaptiveQuantum : public CpuTestBench<cpu_arm_cortexA53, CpuTesterMmio>
+{
+public:
+    static constexpr int BUSY_LOOPS = 0x1000000;
+    static constexpr int IDLE_STEPS = 100;
+    static constexpr int MAX_WAIT_QUANTA = 10000;
+
+    enum Report {
+        READY = 0,
+        WOKE,
+        DONE,
+    };
+
+    static constexpr const char* FIRMWARE = R"(
+        _start:
+            ldr x1, =0x%08)" PRIx64 R"(
+
+            mrs x0, mpidr_el1
+
+            and x2, x0, #0xff
+            and x0, x0, #0xff00
+            lsr x0, x0, #5
+            orr  x0, x0, x2
+
+            lsl x0, x0, #3
+            add x1, x1, x0
+
+            mov x0, #0
+            str x0, [x1]
+
+        idle:
+            # The IRQ is masked, wfi returns once it is pending
+            wfi
+            mrs x2, isr_el1
+            tbz x2, #7, idle
+
+            mov x0, #1
+            str x0, [x1]
+
+            ldr x3, =%d
+        busy:
+            subs x3, x3, #1
+            b.ne busy
+
+            mov x0, #2
+            str x0, [x1]
+
+        end:
+            wfi
+            b end
+    )";
+
+protected:
+    sc_core::sc_vector<InitiatorSignalSocket<bool>> m_irq;
+    std::unique_ptr<gs::QuantumController> m_controller;
+
+    int m_num_cpu;
+    std::atomic<int> m_ready{ 0 };
+    std::atomic<int> m_done{ 0 };
+    bool m_resumed = false;
+
+    void set_param(const std::string& name, const cci::cci_value& v)
+    {
+        cci::cci_get_broker().get_param_handle(name).set_cci_value(v);
+    }
+
+    /* The CPUs alternate between the instances, the second one has none with a single CPU */
+    bool all_cpus_halted() { return m_inst_a.all_cpus_halted() && (m_num_cpu < 2 || m_inst_b.all_cpus_halted()); }
+
+    /* Wait for cond, one quantum at a time */
+    template <typename F>
+    void wait_for(F cond, const char* what)
+    {
+        for (int i = 0; !cond(); i++) {
+            if (i == MAX_WAIT_QUANTA) {
+                TEST_FAIL(what);
+            }
+            wait(tlm_utils::tlm_quantumkeeper::get_global_quantum());
+        }
+    }
+
+public:
+    SC_HAS_PROCESS(CpuArmCortexA53IdleSkipAdaptiveQuantum);
+
+    CpuArmCortexA53IdleSkipAdaptiveQuantum(const sc_core::sc_module_name& n)
+        : CpuTestBench<cpu_arm_cortexA53, CpuTesterMmio>(n), m_irq("irq", p_num_cpu), m_num_cpu(p_num_cpu)
+    {
+        char buf[1024];
+
+        set_param(std::string(m_inst_a.name()) + ".idle_skip", cci::cci_value(true));
+        set_param(std::string(m_inst_b.name()) + ".idle_skip", cci::cci_value(true));
+
+        /* Adjust every quantum, the quantum would keep growing if the controller did not pause */
+        m_controller = std::make_unique<gs::QuantumController>("quantum_controller");
+        set_param(std::string(m_controller->name()) + ".period", cci::cci_value(1u));
+        set_param(std::string(m_controller->name()) + ".max_quantum_ns", cci::cci_value(uint64_t(1000000000)));
+
+        map_irqs_to_cpus(m_irq);
+
+        std::snprintf(buf, sizeof(buf), FIRMWARE, CpuTesterMmio::MMIO_ADDR, BUSY_LOOPS);
+        set_firmware(buf);
+
+        SC_THREAD(idle_ctrl);
+    }
+
+    virtual ~CpuArmCortexA53IdleSkipAdaptiveQuantum() {}
+
+    void idle_ctrl()
+    {
+        wait_for([this]() { return m_ready == m_num_cpu; }, "CPUs did not start");
+        wait_for([this]() { return all_cpus_halted(); }, "CPUs did not halt");
+        wait_for([this]() { return m_controller->paused(); }, "The quantum controller did not pause");
+
+        /* Time jumps from one SystemC event to the next, and the quantum is left alone */
+        sc_time quantum = tlm_utils::tlm_quantumkeeper::get_global_quantum();
+        for (int i = 0; i < IDLE_STEPS; i++) {
+            wait(quantum * 10);
+            TEST_ASSERT(all_cpus_halted());
+            TEST_ASSERT(m_controller->paused());
+        }
+        TEST_ASSERT(tlm_utils::tlm_quantumkeeper::get_global_quantum() == quantum);
+
+        for (auto& irq : m_irq) {
+            irq->write(true);
+        }
+        wait_for([this]() { return !m_controller->paused(); }, "The quantum controller did not resume");
+        m_resumed = true;
+        for (auto& irq : m_irq) {
+            irq->write(false);
+        }
+
+        wait_for([this]() { return m_done == m_num_cpu; }, "CPUs did not finish");
+    }
+
+    virtual void mmio_write(int id, uint64_t addr, uint64_t data, size_t len) override
+    {
+        int cpuid = addr >> 3;
+
+        SCP_INFO(SCMOD) << "CPU " << cpuid << " reports " << data;
+
+        TEST_ASSERT(cpuid < m_num_cpu);
+        switch (data) {
+        case READY:
+            m_ready++;
+            break;
+
+        case WOKE:
+            break;
+
+        case DONE:
+            m_done++;
+            break;
+
+        default:
+            TEST_FAIL("Unexpected report");
+        }
+    }
+
+    virtual void end_of_simulation() override
+    {
+        CpuTestBench<cpu_arm_cortexA53, CpuTesterMmio>::end_of_simulation();
+
+        TEST_ASSERT(m_resumed);
+        TEST_ASSERT(m_done == m_num_cpu);
+    }
+};
+
+constexpr const char* CpuArmCortexA53IdleSkipAdaptiveQuantum::FIRMWARE;
+
+int sc_main(int argc, char* argv[]) { return run_testbench<CpuArmCortexA53IdleSkipAdaptiveQuantum>(argc, argv); }
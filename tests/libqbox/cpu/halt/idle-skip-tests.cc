@@ -0,0 +1,234 @@
+/*
+ * This file is part of libqbox
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define SC_ALLOW_DEPRECATED_IEEE_API
+#include <systemc>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "test/cpu.h"
+#include "test/tester/mmio.h"
+
+#include "cortex-a53.h"
+#include "qemu-instance.h"
+
+using namespace sc_core;
+
+/*
+ * ARM Cortex-A53 idle skipping.
+ *
+ * With idle_skip set on the instances, each CPU reports it is ready, then
+ * waits for an interrupt with wfi. Once all of them are halted, the test bench
+ * lets a long simulated time elapse: the CPUs must stay halted all along, as
+ * their deadline timers no longer kick them every quantum, and time goes
+ * straight to the next SystemC event.
+ *
+ * The test bench then raises the IRQ line of every CPU. Each CPU reports it
+ * woke up, and runs a busy loop spanning several quanta before reporting it is
+ * done. The deadline timers must have been rearmed by the interrupt: the CPUs
+ * keep synchronizing with SystemC while busy, so the test bench gets to run in
+ * the meantime.
+ */
+class CpuArmCortexA53IdleSkip : public CpuTestBench<cpu_arm_cortexA53, CpuTesterMmio>
+{
+public:
+    static constexpr int BUSY_LOOPS = 0x1000000;
+    static constexpr int IDLE_STEPS = 100;
+    static constexpr int MAX_WAIT_QUANTA = 10000;
+
+    enum Report {
+        READY = 0,
+        WOKE,
+        DONE,
+    };
+
+    static constexpr const char* FIRMWARE = R"(
+        _start:
+            ldr x1, =0x%08)" PRIx64 R"(
+
+            mrs x0, mpidr_el1
+
+            and x2, x0, #0xff
+            and x0, x0, #0xff00
+            lsr x0, x0, #5
+            orr  x0, x0, x2
+
+            lsl x0, x0, #3
+            add x1, x1, x0
+
+            mov x0, #0
+            str x0, [x1]
+
+        idle:
+            # The IRQ is masked, wfi returns once it is pending
+            wfi
+            mrs x2, isr_el1
+            tbz x2, #7, idle
+
+            mov x0, #1
+            str x0, [x1]
+
+            ldr x3, =%d
+        busy:
+            subs x3, x3, #1
+            b.ne busy
+
+            mov x0, #2
+            str x0, [x1]
+
+        end:
+            wfi
+            b end
+    )";
+
+protected:
+    sc_core::sc_vector<InitiatorSignalSocket<bool>> m_irq;
+
+    int m_num_cpu;
+    std::vector<std::atomic<int>> m_reports;
+    std::atomic<int> m_ready{ 0 };
+    std::atomic<int> m_woke{ 0 };
+    std::atomic<int> m_done{ 0 };
+    int m_busy_ticks = 0;
+    std::atomic<bool> m_idle_checked{ false };
+
+    void set_idle_skip(QemuInstance& inst)
+    {
+        cci::cci_get_broker()
+            .get_param_handle(std::string(inst.name()) + ".idle_skip")
+            .set_cci_value(cci::cci_value(true));
+    }
+
+    /* The CPUs alternate between the instances, the second one has none with a single CPU */
+    bool all_cpus_halted() { return m_inst_a.all_cpus_halted() && (m_num_cpu < 2 || m_inst_b.all_cpus_halted()); }
+
+    /* Wait for cond, one quantum at a time */
+    template <typename F>
+    void wait_for(F cond, const char* what)
+    {
+        sc_time quantum = tlm_utils::tlm_quantumkeeper::get_global_quantum();
+        for (int i = 0; !cond(); i++) {
+            if (i == MAX_WAIT_QUANTA) {
+                TEST_FAIL(what);
+            }
+            wait(quantum);
+        }
+    }
+
+public:
+    SC_HAS_PROCESS(CpuArmCortexA53IdleSkip);
+
+    CpuArmCortexA53IdleSkip(const sc_core::sc_module_name& n)
+        : CpuTestBench<cpu_arm_cortexA53, CpuTesterMmio>(n)
+        , m_irq("irq", p_num_cpu)
+        , m_num_cpu(p_num_cpu)
+        , m_reports(p_num_cpu)
+    {
+        char buf[1024];
+
+        set_idle_skip(m_inst_a);
+        set_idle_skip(m_inst_b);
+
+        map_irqs_to_cpus(m_irq);
+
+        for (auto& r : m_reports) {
+            r = -1;
+        }
+
+        std::snprintf(buf, sizeof(buf), FIRMWARE, CpuTesterMmio::MMIO_ADDR, BUSY_LOOPS);
+        set_firmware(buf);
+
+        SC_THREAD(idle_ctrl);
+    }
+
+    virtual ~CpuArmCortexA53IdleSkip() {}
+
+    void idle_ctrl()
+    {
+        sc_time quantum = tlm_utils::tlm_quantumkeeper::get_global_quantum();
+
+        wait_for([this]() { return m_ready == m_num_cpu; }, "CPUs did not start");
+        wait_for([this]() { return all_cpus_halted(); }, "CPUs did not halt");
+
+        /* Nothing wakes the CPUs up, time jumps from one SystemC event to the next */
+        sc_time start = sc_time_stamp();
+        auto host_start = std::chrono::steady_clock::now();
+        for (int i = 0; i < IDLE_STEPS; i++) {
+            wait(quantum * 10);
+            TEST_ASSERT(all_cpus_halted());
+        }
+        auto host_time = std::chrono::steady_clock::now() - host_start;
+        SCP_INFO(SCMOD) << "Idle for " << (sc_time_stamp() - start) << " in "
+                        << std::chrono::duration_cast<std::chrono::milliseconds>(host_time).count() << " ms";
+        m_idle_checked = true;
+
+        for (auto& irq : m_irq) {
+            irq->write(true);
+        }
+
+        /* Count the quanta SystemC gets to run while CPUs are busy */
+        wait_for(
+            [this]() {
+                if (m_woke > m_done) m_busy_ticks++;
+                return m_woke == m_num_cpu;
+            },
+            "CPUs did not wake up");
+        for (auto& irq : m_irq) {
+            irq->write(false);
+        }
+        wait_for(
+            [this]() {
+                if (m_woke > m_done) m_busy_ticks++;
+                return m_done == m_num_cpu;
+            },
+            "CPUs did not finish");
+    }
+
+    virtual void mmio_write(int id, uint64_t addr, uint64_t data, size_t len) override
+    {
+        int cpuid = addr >> 3;
+
+        SCP_INFO(SCMOD) << "CPU " << cpuid << " reports " << data;
+
+        TEST_ASSERT(cpuid < m_num_cpu);
+        TEST_ASSERT(int(data) == m_reports[cpuid] + 1);
+        m_reports[cpuid] = int(data);
+
+        switch (data) {
+        case READY:
+            m_ready++;
+            break;
+
+        case WOKE:
+            /* Only the interrupt wakes the CPU up */
+            TEST_ASSERT(m_idle_checked);
+            m_woke++;
+            break;
+
+        case DONE:
+            m_done++;
+            break;
+        }
+    }
+
+    virtual void end_of_simulation() override
+    {
+        CpuTestBench<cpu_arm_cortexA53, CpuTesterMmio>::end_of_simulation();
+
+        TEST_ASSERT(m_idle_checked);
+        TEST_ASSERT(m_done == m_num_cpu);
+        SCP_INFO(SCMOD) << "SystemC ran " << m_busy_ticks << " quanta while CPUs were busy";
+        TEST_ASSERT(m_busy_ticks > 0);
+    }
+};
+
+constexpr const char* CpuArmCortexA53IdleSkip::FIRMWARE;
+
+int sc_main(int argc, char* argv[]) { return run_testbench<CpuArmCortexA53IdleSkip>(argc, argv); }
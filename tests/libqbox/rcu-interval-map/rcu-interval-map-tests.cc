@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All Rights Reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <systemc>
+#include <gtest/gtest.h>
+
+#include <libqemu-cxx/rcu_interval_map.h>
+
+using namespace gs;
+
+struct Entry {
+    uint64_t base;
+    uint64_t check; /* always ~base, to catch torn reads */
+};
+
+TEST(RcuIntervalMap, Lookup)
+{
+    RcuIntervalMap<Entry> map;
+    Entry e;
+
+    ASSERT_FALSE(map.lookup(0, e));
+    map.insert(0x1000, 0x1fff, { 0x1000, ~0x1000ull });
+    map.insert(0x4000, 0x7fff, { 0x4000, ~0x4000ull });
+
+    ASSERT_EQ(map.size(), 2);
+    ASSERT_FALSE(map.lookup(0xfff, e));
+    ASSERT_TRUE(map.lookup(0x1000, e));
+    ASSERT_EQ(e.base, 0x1000);
+    ASSERT_TRUE(map.lookup(0x1fff, e));
+    ASSERT_EQ(e.base, 0x1000);
+    ASSERT_FALSE(map.lookup(0x2000, e));
+    ASSERT_TRUE(map.lookup(0x5000, e));
+    ASSERT_EQ(e.base, 0x4000);
+    ASSERT_FALSE(map.lookup(0x8000, e));
+}
+
+TEST(RcuIntervalMap, InsertReplacesOverlaps)
+{
+    RcuIntervalMap<Entry> map;
+    Entry e;
+
+    map.insert(0x1000, 0x1fff, { 0x1000, ~0x1000ull });
+    map.insert(0x2000, 0x2fff, { 0x2000, ~0x2000ull });
+    map.insert(0x0000, 0x3fff, { 0x0000, ~0x0000ull });
+
+    ASSERT_EQ(map.size(), 1);
+    ASSERT_TRUE(map.lookup(0x2800, e));
+    ASSERT_EQ(e.base, 0);
+}
+
+TEST(RcuIntervalMap, Invalidate)
+{
+    RcuIntervalMap<Entry> map;
+    Entry e;
+
+    for (uint64_t i = 0; i < 16; i++) {
+        map.insert(i * 0x1000, i * 0x1000 + 0xfff, { i * 0x1000, ~(i * 0x1000) });
+    }
+
+    /* Partially covered intervals are removed too */
+    std::vector<uint64_t> removed;
+    size_t n = map.invalidate(0x2800, 0x4000, [&](RcuIntervalMap<Entry>::interval& iv) {
+        removed.push_back(iv.start);
+    });
+    ASSERT_EQ(n, 3);
+    ASSERT_EQ(removed, std::vector<uint64_t>({ 0x2000, 0x3000, 0x4000 }));
+    ASSERT_EQ(map.size(), 13);
+    ASSERT_TRUE(map.lookup(0x1fff, e));
+    ASSERT_FALSE(map.lookup(0x2000, e));
+    ASSERT_FALSE(map.lookup(0x4fff, e));
+    ASSERT_TRUE(map.lookup(0x5000, e));
+
+    ASSERT_EQ(map.invalidate(0x2000, 0x4fff), 0);
+
+    /* Dead intervals are dropped when the map is next updated */
+    map.insert(0x3000, 0x3fff, { 0x3000, ~0x3000ull });
+    ASSERT_EQ(map.size(), 14);
+    ASSERT_TRUE(map.lookup(0x3000, e));
+
+    map.clear();
+    ASSERT_EQ(map.size(), 0);
+    ASSERT_FALSE(map.lookup(0x5000, e));
+}
+
+TEST(RcuIntervalMap, ConcurrentReaders)
+{
+    RcuIntervalMap<Entry> map;
+    std::atomic<bool> stop{ false };
+    std::atomic<bool> torn{ false };
+    std::vector<std::thread> readers;
+
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&, t]() {
+            Entry e;
+            uint64_t i = t;
+            while (!stop.load()) {
+                uint64_t addr = (i++ % 64) * 0x1000 + 0x10;
+                if (map.lookup(addr, e) && (e.check != ~e.base || e.base != (addr & ~0xfffull))) {
+                    torn = true;
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 200; round++) {
+        for (uint64_t i = round % 2; i < 64; i += 2) {
+            map.insert(i * 0x1000, i * 0x1000 + 0xfff, { i * 0x1000, ~(i * 0x1000) });
+        }
+        map.invalidate(0, 64 * 0x1000, [&](RcuIntervalMap<Entry>::interval& iv) {
+            /* No lookup can see the entry any more, so it may be recycled */
+            iv.value.check = 0;
+        });
+    }
+
+    stop = true;
+    for (auto& r : readers) r.join();
+    ASSERT_FALSE(torn.load());
+    ASSERT_EQ(map.size(), 0);
+}
+
+TEST(RcuIntervalMap, ManyInserts)
+{
+    RcuIntervalMap<Entry> map;
+    Entry e;
+
+    /* Enough inserts, in both orders, for the delta to be merged into the base several times */
+    for (uint64_t i = 0; i < 4096; i += 2) {
+        map.insert(i * 0x1000, i * 0x1000 + 0xfff, { i * 0x1000, ~(i * 0x1000) });
+    }
+    for (uint64_t i = 4095; i < 4096; i -= 2) {
+        map.insert(i * 0x1000, i * 0x1000 + 0xfff, { i * 0x1000, ~(i * 0x1000) });
+    }
+    ASSERT_EQ(map.size(), 4096);
+
+    /* Replace every fourth pair by a single interval */
+    for (uint64_t i = 0; i < 4096; i += 4) {
+        map.insert(i * 0x1000, i * 0x1000 + 0x1fff, { i * 0x1000, ~(i * 0x1000) });
+    }
+    ASSERT_EQ(map.size(), 4096 - 1024);
+
+    for (uint64_t i = 0; i < 4096; i++) {
+        ASSERT_TRUE(map.lookup(i * 0x1000 + 0x10, e));
+        ASSERT_EQ(e.base, i % 4 == 1 ? (i - 1) * 0x1000 : i * 0x1000);
+        ASSERT_EQ(e.check, ~e.base);
+    }
+}
+
+TEST(RcuIntervalMap, InsertDoesNotWaitForReaders)
+{
+    RcuIntervalMap<Entry> map;
+    std::atomic<bool> locked{ false };
+    std::atomic<bool> done{ false };
+
+    std::thread reader([&]() {
+        Rcu::ReadLock lock;
+        locked = true;
+        while (!done.load()) {
+            std::this_thread::yield();
+        }
+    });
+    while (!locked.load()) {
+        std::this_thread::yield();
+    }
+
+    /* The snapshots replaced meanwhile are only freed once the reader is done */
+    for (uint64_t i = 0; i < 1024; i++) {
+        map.insert(i * 0x1000, i * 0x1000 + 0xfff, { i * 0x1000, ~(i * 0x1000) });
+    }
+    ASSERT_EQ(map.size(), 1024);
+
+    done = true;
+    reader.join();
+}
+
+int sc_main(int argc, char* argv[])
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}